@@ -0,0 +1,64 @@
+#version 450
+
+// 16 bit unorm within the mesh bounds
+layout (location = 0) in vec4 inPos;
+// octahedral encoded, 16 bit snorm
+layout (location = 1) in vec2 inNormals;
+
+
+layout (location = 0) out vec3 outFragPos;
+layout (location = 1) out vec3 outNormals;
+
+
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 proj;
+    mat4 view;
+} camera;
+
+// rows of a 3x4 affine matrix per instance
+struct InstanceTransform {
+    vec4 rows[3];
+};
+
+layout(std140, set = 1, binding = 0) readonly buffer ObjectData {
+    InstanceTransform transforms[];
+} objectData;
+
+// written by cull.comp, instances that survived frustum culling
+layout(std430, set = 1, binding = 2) readonly buffer VisibleInstances {
+    uint indices[];
+} visibleInstances;
+
+layout(push_constant) uniform MeshBounds {
+    vec4 boundsMin;
+    vec4 boundsExtent;
+} meshBounds;
+
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
+}
+
+// the cofactor matrix points normals the same way as the inverse
+// transpose, flipped for mirroring transforms
+mat3 getNormalMatrix(mat3 linear) {
+    mat3 cofactor = mat3(cross(linear[1], linear[2]),
+                         cross(linear[2], linear[0]),
+                         cross(linear[0], linear[1]));
+    return cofactor * sign(dot(linear[0], cofactor[0]));
+}
+
+void main() {
+    uint instance = visibleInstances.indices[gl_InstanceIndex];
+    InstanceTransform instanceTransform = objectData.transforms[instance];
+    mat4x3 currentTransform = transpose(mat3x4(instanceTransform.rows[0],
+                                               instanceTransform.rows[1],
+                                               instanceTransform.rows[2]));
+    vec3 position = meshBounds.boundsMin.xyz + inPos.xyz * meshBounds.boundsExtent.xyz;
+    outNormals = getNormalMatrix(mat3(currentTransform)) * decodeOctahedral(inNormals);
+    outFragPos = currentTransform * vec4(position, 1.0);
+    gl_Position = camera.proj * camera.view * vec4(outFragPos, 1.0);
+}
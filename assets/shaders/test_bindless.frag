@@ -0,0 +1,34 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inFragPos;
+layout(location = 1) in vec3 inNormals;
+
+layout(location = 0) out vec4 outColor;
+
+// every material lives in the bindless heap
+layout(set = 2, binding = 0) readonly buffer Material {
+    vec4 color;
+} materials[];
+
+// starts after the vertex stage's mesh bounds
+layout(push_constant) uniform MaterialIndex {
+    layout(offset = 32) uint materialIndex;
+};
+
+void main() {
+    vec4 color = materials[nonuniformEXT(materialIndex)].color;
+    vec3 lightPos = vec3(0.0, 0.0, 5.0);
+    //ambient
+    float ambientStrength = 0.1;
+    vec3 ambient = ambientStrength * vec3(1.0);
+
+    //diffuse
+    vec3 norm = normalize(inNormals);
+    vec3 lightDir = normalize(lightPos - inFragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * vec3(1.0);
+
+    vec3 result = (ambient + diffuse) * vec3(color);
+    outColor = vec4(result, color.a);
+}
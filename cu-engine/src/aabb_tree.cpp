@@ -0,0 +1,320 @@
+#include "aabb_tree.h"
+#include <algorithm>
+
+bool AABB::contains(const AABB &p_other) const {
+  return glm::all(glm::lessThanEqual(min, p_other.min)) &&
+         glm::all(glm::greaterThanEqual(max, p_other.max));
+}
+
+float AABB::get_surface_area() const {
+  const glm::vec3 size = max - min;
+  return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+AABB AABB::transformed(const glm::mat4 &p_transform) const {
+  const glm::vec3 center = (min + max) * 0.5f;
+  const glm::vec3 extent = (max - min) * 0.5f;
+  const glm::vec3 new_center =
+      glm::vec3(p_transform * glm::vec4(center, 1.0f));
+  const glm::mat3 absolute =
+      glm::mat3(glm::abs(glm::vec3(p_transform[0])),
+                glm::abs(glm::vec3(p_transform[1])),
+                glm::abs(glm::vec3(p_transform[2])));
+  const glm::vec3 new_extent = absolute * extent;
+  return {new_center - new_extent, new_center + new_extent};
+}
+
+AABB AABB::merge(const AABB &p_a, const AABB &p_b) {
+  return {glm::min(p_a.min, p_b.min), glm::max(p_a.max, p_b.max)};
+}
+
+int32_t CuAabbTree::create_proxy(const AABB &p_aabb, void *p_user_data) {
+  const int32_t proxy = allocate_node();
+  nodes[proxy].aabb = {p_aabb.min - glm::vec3(margin),
+                       p_aabb.max + glm::vec3(margin)};
+  nodes[proxy].user_data = p_user_data;
+  nodes[proxy].height = 0;
+  insert_leaf(proxy);
+  proxy_count++;
+  return proxy;
+}
+
+void CuAabbTree::destroy_proxy(int32_t p_proxy) {
+  if (p_proxy < 0 || p_proxy >= nodes.size() || !nodes[p_proxy].is_leaf()) {
+    return;
+  }
+  remove_leaf(p_proxy);
+  free_node(p_proxy);
+  proxy_count--;
+}
+
+bool CuAabbTree::move_proxy(int32_t p_proxy, const AABB &p_aabb) {
+  if (p_proxy < 0 || p_proxy >= nodes.size()) {
+    return false;
+  }
+  if (nodes[p_proxy].aabb.contains(p_aabb)) {
+    return false;
+  }
+  remove_leaf(p_proxy);
+  nodes[p_proxy].aabb = {p_aabb.min - glm::vec3(margin),
+                         p_aabb.max + glm::vec3(margin)};
+  insert_leaf(p_proxy);
+  return true;
+}
+
+void *CuAabbTree::get_user_data(int32_t p_proxy) const {
+  if (p_proxy < 0 || p_proxy >= nodes.size()) {
+    return nullptr;
+  }
+  return nodes[p_proxy].user_data;
+}
+
+enum FrustumTest { OUTSIDE, INTERSECTING, INSIDE };
+
+static FrustumTest test_frustum(const AABB &p_aabb,
+                                const std::array<glm::vec4, 6> &p_planes) {
+  FrustumTest result = INSIDE;
+  for (const glm::vec4 &plane : p_planes) {
+    const glm::vec3 normal = glm::vec3(plane);
+    // the corners furthest along and against the plane's normal
+    const glm::bvec3 facing = glm::greaterThanEqual(normal, glm::vec3(0.0f));
+    const glm::vec3 positive = glm::mix(p_aabb.min, p_aabb.max, facing);
+    const glm::vec3 negative = glm::mix(p_aabb.max, p_aabb.min, facing);
+    if (glm::dot(normal, positive) + plane.w < 0.0f) {
+      return OUTSIDE;
+    }
+    if (glm::dot(normal, negative) + plane.w < 0.0f) {
+      result = INTERSECTING;
+    }
+  }
+  return result;
+}
+
+void CuAabbTree::query_frustum(const std::array<glm::vec4, 6> &p_planes,
+                               std::vector<void *> &out_user_data) const {
+  if (root == NULL_NODE) {
+    return;
+  }
+  std::vector<int32_t> stack = {root};
+  std::vector<int32_t> subtree_stack = {};
+  while (!stack.empty()) {
+    const int32_t index = stack.back();
+    stack.pop_back();
+    const Node &node = nodes[index];
+    const FrustumTest result = test_frustum(node.aabb, p_planes);
+    if (result == OUTSIDE) {
+      continue;
+    }
+    if (node.is_leaf()) {
+      out_user_data.push_back(node.user_data);
+    } else if (result == INSIDE) {
+      // nothing below can be outside either
+      collect_leaves(index, out_user_data, subtree_stack);
+    } else {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+    }
+  }
+}
+
+void CuAabbTree::collect_leaves(int32_t p_node,
+                                std::vector<void *> &out_user_data,
+                                std::vector<int32_t> &p_stack) const {
+  p_stack.clear();
+  p_stack.push_back(p_node);
+  while (!p_stack.empty()) {
+    const Node &node = nodes[p_stack.back()];
+    p_stack.pop_back();
+    if (node.is_leaf()) {
+      out_user_data.push_back(node.user_data);
+    } else {
+      p_stack.push_back(node.left);
+      p_stack.push_back(node.right);
+    }
+  }
+}
+
+int32_t CuAabbTree::get_height() const {
+  return root == NULL_NODE ? 0 : nodes[root].height;
+}
+
+void CuAabbTree::clear() {
+  nodes.clear();
+  root = NULL_NODE;
+  free_list = NULL_NODE;
+  proxy_count = 0;
+}
+
+int32_t CuAabbTree::allocate_node() {
+  if (free_list == NULL_NODE) {
+    nodes.push_back({});
+    return nodes.size() - 1;
+  }
+  const int32_t node = free_list;
+  free_list = nodes[node].parent;
+  nodes[node] = {};
+  return node;
+}
+
+void CuAabbTree::free_node(int32_t p_node) {
+  nodes[p_node] = {};
+  nodes[p_node].parent = free_list;
+  free_list = p_node;
+}
+
+void CuAabbTree::insert_leaf(int32_t p_leaf) {
+  if (root == NULL_NODE) {
+    root = p_leaf;
+    nodes[root].parent = NULL_NODE;
+    return;
+  }
+
+  // walk down to the sibling that grows the tree's surface area the least
+  const AABB leaf_aabb = nodes[p_leaf].aabb;
+  int32_t index = root;
+  while (!nodes[index].is_leaf()) {
+    const Node &node = nodes[index];
+    const float area = node.aabb.get_surface_area();
+    const float combined_area =
+        AABB::merge(node.aabb, leaf_aabb).get_surface_area();
+    // pairing with this node creates a parent of the combined size
+    const float cost = 2.0f * combined_area;
+    // every node below grows the ancestors by this much
+    const float inheritance_cost = 2.0f * (combined_area - area);
+
+    auto get_descend_cost = [&](int32_t p_child) {
+      const Node &child = nodes[p_child];
+      float child_cost = AABB::merge(child.aabb, leaf_aabb).get_surface_area();
+      if (!child.is_leaf()) {
+        child_cost -= child.aabb.get_surface_area();
+      }
+      return child_cost + inheritance_cost;
+    };
+    const float left_cost = get_descend_cost(node.left);
+    const float right_cost = get_descend_cost(node.right);
+    if (cost < left_cost && cost < right_cost) {
+      break;
+    }
+    index = left_cost < right_cost ? node.left : node.right;
+  }
+
+  const int32_t sibling = index;
+  const int32_t old_parent = nodes[sibling].parent;
+  const int32_t new_parent = allocate_node();
+  nodes[new_parent].parent = old_parent;
+  nodes[new_parent].aabb = AABB::merge(leaf_aabb, nodes[sibling].aabb);
+  nodes[new_parent].height = nodes[sibling].height + 1;
+  nodes[new_parent].left = sibling;
+  nodes[new_parent].right = p_leaf;
+  nodes[sibling].parent = new_parent;
+  nodes[p_leaf].parent = new_parent;
+  if (old_parent == NULL_NODE) {
+    root = new_parent;
+  } else if (nodes[old_parent].left == sibling) {
+    nodes[old_parent].left = new_parent;
+  } else {
+    nodes[old_parent].right = new_parent;
+  }
+
+  refit(nodes[p_leaf].parent);
+}
+
+void CuAabbTree::remove_leaf(int32_t p_leaf) {
+  if (p_leaf == root) {
+    root = NULL_NODE;
+    return;
+  }
+
+  const int32_t parent = nodes[p_leaf].parent;
+  const int32_t grand_parent = nodes[parent].parent;
+  const int32_t sibling = nodes[parent].left == p_leaf ? nodes[parent].right
+                                                       : nodes[parent].left;
+  // the sibling takes the parent's place
+  nodes[sibling].parent = grand_parent;
+  if (grand_parent == NULL_NODE) {
+    root = sibling;
+    free_node(parent);
+    return;
+  }
+  if (nodes[grand_parent].left == parent) {
+    nodes[grand_parent].left = sibling;
+  } else {
+    nodes[grand_parent].right = sibling;
+  }
+  free_node(parent);
+  refit(grand_parent);
+}
+
+void CuAabbTree::refit(int32_t p_node) {
+  int32_t index = p_node;
+  while (index != NULL_NODE) {
+    index = balance(index);
+    Node &node = nodes[index];
+    const Node &left = nodes[node.left];
+    const Node &right = nodes[node.right];
+    node.height = 1 + std::max(left.height, right.height);
+    node.aabb = AABB::merge(left.aabb, right.aabb);
+    index = node.parent;
+  }
+}
+
+int32_t CuAabbTree::balance(int32_t p_node) {
+  Node &a = nodes[p_node];
+  if (a.is_leaf() || a.height < 2) {
+    return p_node;
+  }
+
+  const int32_t b_index = a.left;
+  const int32_t c_index = a.right;
+  Node &b = nodes[b_index];
+  Node &c = nodes[c_index];
+  const int32_t difference = c.height - b.height;
+
+  // lifts the higher child into a's place, a takes over one of its children
+  auto rotate = [&](int32_t p_up_index, Node &p_up, Node &p_other,
+                    bool p_up_is_right) {
+    const int32_t f_index = p_up.left;
+    const int32_t g_index = p_up.right;
+    Node &f = nodes[f_index];
+    Node &g = nodes[g_index];
+
+    p_up.left = p_node;
+    p_up.parent = a.parent;
+    a.parent = p_up_index;
+    if (p_up.parent == NULL_NODE) {
+      root = p_up_index;
+    } else if (nodes[p_up.parent].left == p_node) {
+      nodes[p_up.parent].left = p_up_index;
+    } else {
+      nodes[p_up.parent].right = p_up_index;
+    }
+
+    // the higher grandchild stays with the lifted node
+    const bool keep_f = f.height > g.height;
+    const int32_t kept_index = keep_f ? f_index : g_index;
+    const int32_t moved_index = keep_f ? g_index : f_index;
+    Node &kept = nodes[kept_index];
+    Node &moved = nodes[moved_index];
+    p_up.right = kept_index;
+    if (p_up_is_right) {
+      a.right = moved_index;
+    } else {
+      a.left = moved_index;
+    }
+    moved.parent = p_node;
+    a.aabb = AABB::merge(p_other.aabb, moved.aabb);
+    a.height = 1 + std::max(p_other.height, moved.height);
+    p_up.aabb = AABB::merge(a.aabb, kept.aabb);
+    p_up.height = 1 + std::max(a.height, kept.height);
+  };
+
+  if (difference > 1) {
+    rotate(c_index, c, b, true);
+    return c_index;
+  }
+  if (difference < -1) {
+    rotate(b_index, b, c, false);
+    return b_index;
+  }
+  return p_node;
+}
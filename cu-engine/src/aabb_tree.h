@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm.hpp>
+#include <vector>
+
+struct AABB {
+  glm::vec3 min = glm::vec3(0.0f);
+  glm::vec3 max = glm::vec3(0.0f);
+
+  bool contains(const AABB &p_other) const;
+  float get_surface_area() const;
+  /**
+   bounds of the box after p_transform, still axis aligned.
+   */
+  AABB transformed(const glm::mat4 &p_transform) const;
+  static AABB merge(const AABB &p_a, const AABB &p_b);
+};
+
+/**
+Dynamic AABB tree. Leaves hold proxies with boxes that are a margin larger
+than requested, moving a proxy only reinserts it once its box leaves the
+enlarged one. Inserts pick the sibling by surface area and rotations keep
+the tree balanced.
+ */
+class CuAabbTree {
+public:
+  CuAabbTree(float p_margin = 0.2f) : margin(p_margin) {}
+
+  int32_t create_proxy(const AABB &p_aabb, void *p_user_data);
+  void destroy_proxy(int32_t p_proxy);
+  /**
+   returns true if the proxy had to be reinserted.
+   */
+  bool move_proxy(int32_t p_proxy, const AABB &p_aabb);
+  void *get_user_data(int32_t p_proxy) const;
+  /**
+   appends the user data of every proxy that isn't fully outside of one of
+   the planes. Planes are in the form of Camera::get_frustum_planes().
+   */
+  void query_frustum(const std::array<glm::vec4, 6> &p_planes,
+                     std::vector<void *> &out_user_data) const;
+  uint32_t get_proxy_count() const { return proxy_count; }
+  int32_t get_height() const;
+  void clear();
+
+  static const int32_t NULL_NODE = -1;
+
+private:
+  struct Node {
+    AABB aabb = {};
+    void *user_data = nullptr;
+    // next free node while the node is unused
+    int32_t parent = NULL_NODE;
+    int32_t left = NULL_NODE;
+    int32_t right = NULL_NODE;
+    // leaves are 0, free nodes -1
+    int32_t height = -1;
+    bool is_leaf() const { return left == NULL_NODE; }
+  };
+
+  int32_t allocate_node();
+  void free_node(int32_t p_node);
+  void insert_leaf(int32_t p_leaf);
+  void remove_leaf(int32_t p_leaf);
+  void refit(int32_t p_node);
+  int32_t balance(int32_t p_node);
+  void collect_leaves(int32_t p_node, std::vector<void *> &out_user_data,
+                      std::vector<int32_t> &p_stack) const;
+
+  std::vector<Node> nodes = {};
+  int32_t root = NULL_NODE;
+  int32_t free_list = NULL_NODE;
+  uint32_t proxy_count = 0;
+  float margin = 0.2f;
+};
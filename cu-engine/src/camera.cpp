@@ -6,6 +6,7 @@
 #include <ext/matrix_clip_space.hpp>
 #include <ext/matrix_transform.hpp>
 #include <glm.hpp>
+#include <gtc/matrix_access.hpp>
 #include <gtx/transform.hpp>
 
 Camera::Camera() {
@@ -41,6 +42,22 @@ void Camera::update() {
   }
 }
 
+std::array<glm::vec4, 6> Camera::get_frustum_planes() const {
+  const glm::mat4 view_projection = gpu_data.projection * gpu_data.view;
+  const glm::vec4 row_x = glm::row(view_projection, 0);
+  const glm::vec4 row_y = glm::row(view_projection, 1);
+  const glm::vec4 row_z = glm::row(view_projection, 2);
+  const glm::vec4 row_w = glm::row(view_projection, 3);
+  // depth goes from 0 to 1, so the near plane is the z row on its own
+  std::array<glm::vec4, 6> planes = {row_w + row_x, row_w - row_x,
+                                     row_w + row_y, row_w - row_y,
+                                     row_z, row_w - row_z};
+  for (glm::vec4 &plane : planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return planes;
+}
+
 CameraManager *CameraManager::singleton = nullptr;
 
 CameraManager::CameraManager() { singleton = this; }
@@ -49,9 +66,9 @@ CameraManager *CameraManager::get_singleton() { return singleton; }
 void CameraManager::init() {
   device = CuRenderDevice::get_singleton();
   if (device) {
-    camera_buffer = device->create_buffer(sizeof(glm::mat4) * 2,
-                                          VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                          VMA_MEMORY_USAGE_CPU_TO_GPU);
+    camera_buffer = device->create_buffer(
+        sizeof(glm::mat4) * 2, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU, MEMORY_UNIFORMS);
   }
 }
 
@@ -64,6 +81,15 @@ Camera *CameraManager::create_camera() {
   return &cameras[cameras.size() - 1];
 }
 
+Camera *CameraManager::get_active_camera() {
+  for (Camera &camera : cameras) {
+    if (camera.active) {
+      return &camera;
+    }
+  }
+  return nullptr;
+}
+
 void CameraManager::update_active_camera() {
   if (!device) {
     return;
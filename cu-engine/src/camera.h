@@ -1,6 +1,7 @@
 #pragma once
 
 #include "render_device/utils.h"
+#include <array>
 #include <glm.hpp>
 #include <vector>
 
@@ -15,6 +16,12 @@ public:
   void update();
   bool active = false;
   bool dirty = false;
+  /**
+   left, right, bottom, top, near and far planes in world space. Normals
+   point inwards and are normalized, so a point p is inside a plane when
+   dot(plane.xyz, p) + plane.w >= 0.
+   */
+  std::array<glm::vec4, 6> get_frustum_planes() const;
 
   struct GPUCameraData {
     glm::mat4 projection;
@@ -31,6 +38,10 @@ public:
   CameraManager();
   void init();
   Camera *create_camera();
+  /**
+   returns nullptr if there's no active camera.
+   */
+  Camera *get_active_camera();
   // Camera *get_camera(int p_idx);
   Buffer &get_camera_buffer() { return camera_buffer; }
   void update_active_camera();
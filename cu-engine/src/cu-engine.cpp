@@ -1,24 +1,102 @@
 #include "cu-engine.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstdlib>
 
+#include "render_device/render_device.h"
 #include "render_passes/geometry_pass.h"
 
+static bool is_benchmark() {
+  const char *benchmark = std::getenv("CU_BENCHMARK");
+  return benchmark && std::string(benchmark) != "0";
+}
+
+static RenderDeviceOptions read_device_options(int p_width, int p_height,
+                                               int &out_frame_limit) {
+  RenderDeviceOptions options = {};
+  const char *headless = std::getenv("CU_HEADLESS");
+  options.headless = headless && std::string(headless) != "0";
+  options.extent = {(uint32_t)p_width, (uint32_t)p_height};
+  const char *frame_limit = std::getenv("CU_FRAME_LIMIT");
+  out_frame_limit = frame_limit ? std::atoi(frame_limit) : 0;
+  const char *frame_overlap = std::getenv("CU_FRAMES_IN_FLIGHT");
+  if (frame_overlap) {
+    options.frame_overlap = std::max(std::atoi(frame_overlap), 1);
+  }
+  // CU_VSYNC=0 and benchmarks present as fast as the surface allows
+  const char *vsync = std::getenv("CU_VSYNC");
+  if ((vsync && std::string(vsync) == "0") || is_benchmark()) {
+    options.present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+  }
+  // CU_MEMORY_REPORT=<seconds> logs GPU memory use and heap budgets
+  const char *memory_report = std::getenv("CU_MEMORY_REPORT");
+  if (memory_report) {
+    options.memory_report_seconds = std::atof(memory_report);
+  }
+  return options;
+}
+
+static void report_startup_pipelines() {
+  // the passes wait for their pipelines in init(), so all of them exist
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (device) {
+    device->get_pipeline_cache().report();
+  }
+}
+
 CuEngine::CuEngine(const std::string &p_title) {
-  ready = window.init(p_title, 1280, 720);
-  ready = renderer.init(&window);
+  RenderDeviceOptions options = read_device_options(1280, 720, frame_limit);
+  headless = options.headless;
+  if (!headless) {
+    ready = window.init(p_title, 1280, 720);
+  }
+  ready = renderer.init(headless ? nullptr : &window, options);
+  if (is_benchmark()) {
+    renderer.enable_benchmark();
+  }
   camera_manager.init();
   renderer.add_render_pass(std::make_unique<GeometryPass>());
+  report_startup_pipelines();
 }
 
 CuEngine::CuEngine() {
-  ready = window.init("test", 1280, 720);
-  ready = renderer.init(&window);
+  RenderDeviceOptions options = read_device_options(1280, 720, frame_limit);
+  headless = options.headless;
+  if (!headless) {
+    ready = window.init("test", 1280, 720);
+  }
+  ready = renderer.init(headless ? nullptr : &window, options);
+  if (is_benchmark()) {
+    renderer.enable_benchmark();
+  }
 
   renderer.add_render_pass(std::make_unique<GeometryPass>());
+  report_startup_pipelines();
 }
 
-bool CuEngine::running() const { return ready && !window.should_close(); }
+bool CuEngine::running() const {
+  if (!ready) {
+    return false;
+  }
+  if (frame_limit > 0 && renderer.get_frame_count() >= frame_limit) {
+    return false;
+  }
+  return headless || !window.should_close();
+}
 
 void CuEngine::clear() {
+  const char *trace_path = std::getenv("CU_PROFILE_TRACE");
+  if (trace_path) {
+    CuProfiler::export_chrome_trace(trace_path);
+  }
+  // VMA's JSON statistics, taken while every resource is still alive
+  const char *memory_stats_path = std::getenv("CU_MEMORY_STATS");
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (memory_stats_path && device && ready) {
+    device->dump_memory_stats(memory_stats_path);
+  }
   renderer.clear();
-  window.clear();
+  if (!headless) {
+    window.clear();
+  }
 }
\ No newline at end of file
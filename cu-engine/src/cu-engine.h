@@ -3,12 +3,14 @@
 #include "camera.h"
 #include "physics-server.h"
 #include "renderer.h"
+#include "thread_pool.h"
 #include "window.h"
 
 class CuEngine {
 public:
   CuEngine();
   CuEngine(const std::string &p_title);
+  bool is_headless() const { return headless; }
   bool running() const;
   void clear();
 
@@ -16,6 +18,13 @@ public:
 
 private:
   bool ready = false;
+  // CU_HEADLESS renders without a window, CU_FRAME_LIMIT stops after that
+  // many frames. CU_BENCHMARK=1 turns vsync off and logs frame rates and
+  // latency, CU_FRAMES_IN_FLIGHT picks 1 to 3 frames in flight.
+  bool headless = false;
+  int frame_limit = 0;
+  // constructed before the renderer so it can build pipelines with it
+  CuThreadPool thread_pool;
   CuRenderer renderer;
   CuPhysicsServer physics;
   CameraManager camera_manager;
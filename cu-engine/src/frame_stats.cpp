@@ -0,0 +1,106 @@
+#include "frame_stats.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+
+void CuFrameStats::tick() {
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  if (started) {
+    const double milliseconds =
+        std::chrono::duration<double, std::milli>(now - last_frame).count();
+    interval_times.push_back(milliseconds);
+    interval_milliseconds += milliseconds;
+
+    const size_t bucket = std::min<size_t>(
+        milliseconds / BUCKET_MILLISECONDS, BUCKET_COUNT - 1);
+    run_histogram[bucket]++;
+    run_frame_count++;
+    run_milliseconds += milliseconds;
+    run_max_milliseconds = std::max(run_max_milliseconds, milliseconds);
+  }
+  started = true;
+  last_frame = now;
+}
+
+FrameTimeSummary CuFrameStats::summarize_interval() const {
+  FrameTimeSummary summary = {};
+  if (interval_times.empty()) {
+    return summary;
+  }
+  std::vector<double> sorted = interval_times;
+  std::sort(sorted.begin(), sorted.end());
+  // nearest rank percentiles
+  auto percentile = [&](double p_percent) {
+    const size_t rank = std::ceil(p_percent / 100.0 * sorted.size());
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+  };
+  summary.frame_count = sorted.size();
+  summary.average_milliseconds = interval_milliseconds / sorted.size();
+  summary.frames_per_second = interval_milliseconds > 0.0
+                                  ? sorted.size() * 1000.0 /
+                                        interval_milliseconds
+                                  : 0.0;
+  summary.p50_milliseconds = percentile(50.0);
+  summary.p95_milliseconds = percentile(95.0);
+  summary.p99_milliseconds = percentile(99.0);
+  summary.max_milliseconds = sorted.back();
+  return summary;
+}
+
+FrameTimeSummary CuFrameStats::summarize_run() const {
+  FrameTimeSummary summary = {};
+  if (run_frame_count == 0) {
+    return summary;
+  }
+  // nearest rank percentiles, reported as the upper edge of their bucket
+  auto percentile = [&](double p_percent) {
+    const size_t rank = std::clamp<size_t>(
+        std::ceil(p_percent / 100.0 * run_frame_count), 1, run_frame_count);
+    size_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+      seen += run_histogram[i];
+      if (seen >= rank) {
+        return std::min((i + 1) * BUCKET_MILLISECONDS, run_max_milliseconds);
+      }
+    }
+    return run_max_milliseconds;
+  };
+  summary.frame_count = run_frame_count;
+  summary.average_milliseconds = run_milliseconds / run_frame_count;
+  summary.frames_per_second =
+      run_milliseconds > 0.0 ? run_frame_count * 1000.0 / run_milliseconds
+                             : 0.0;
+  summary.p50_milliseconds = percentile(50.0);
+  summary.p95_milliseconds = percentile(95.0);
+  summary.p99_milliseconds = percentile(99.0);
+  summary.max_milliseconds = run_max_milliseconds;
+  return summary;
+}
+
+bool CuFrameStats::report_interval(double p_interval_seconds /*= 5.0*/) {
+  if (interval_milliseconds < p_interval_seconds * 1000.0) {
+    return false;
+  }
+  log_summary("Last interval", summarize_interval());
+  interval_times.clear();
+  interval_milliseconds = 0.0;
+  return true;
+}
+
+void CuFrameStats::report() const {
+  log_summary("Benchmark", summarize_run());
+}
+
+void CuFrameStats::log_summary(const char *p_label,
+                               const FrameTimeSummary &p_summary) {
+  if (p_summary.frame_count == 0) {
+    return;
+  }
+  ENGINE_INFO("{}: {} frames, {:.1f} FPS, frame time avg {:.2f} ms, p50 "
+              "{:.2f} ms, p95 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+              p_label, p_summary.frame_count, p_summary.frames_per_second,
+              p_summary.average_milliseconds, p_summary.p50_milliseconds,
+              p_summary.p95_milliseconds, p_summary.p99_milliseconds,
+              p_summary.max_milliseconds);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct FrameTimeSummary {
+  size_t frame_count = 0;
+  double frames_per_second = 0.0;
+  double average_milliseconds = 0.0;
+  double p50_milliseconds = 0.0;
+  double p95_milliseconds = 0.0;
+  double p99_milliseconds = 0.0;
+  double max_milliseconds = 0.0;
+};
+
+/**
+Wall clock time between consecutive frames. Used by the benchmark mode
+(CU_BENCHMARK=1), which presents without vsync and logs the achieved frame
+rate every few seconds and once more for the whole run. Only the current
+interval keeps every frame time, the whole run goes into a histogram.
+ */
+class CuFrameStats {
+public:
+  /**
+   call once per frame. The first call only starts the clock.
+   */
+  void tick();
+  /**
+   summary of the frames since the last interval report.
+   */
+  FrameTimeSummary summarize_interval() const;
+  /**
+   summary of the whole run, percentiles are rounded up to the histogram's
+   bucket size.
+   */
+  FrameTimeSummary summarize_run() const;
+  /**
+   logs the frames since the last report once p_interval_seconds passed.
+   Returns true if it did.
+   */
+  bool report_interval(double p_interval_seconds = 5.0);
+  /**
+   logs the whole run.
+   */
+  void report() const;
+  size_t get_frame_count() const { return run_frame_count; }
+
+private:
+  static void log_summary(const char *p_label,
+                          const FrameTimeSummary &p_summary);
+
+  static constexpr double BUCKET_MILLISECONDS = 0.05;
+  // frames slower than 100 ms land in the last bucket
+  static constexpr size_t BUCKET_COUNT = 2000;
+
+  std::vector<double> interval_times = {};
+  std::chrono::steady_clock::time_point last_frame = {};
+  bool started = false;
+  double interval_milliseconds = 0.0;
+
+  std::array<uint32_t, BUCKET_COUNT> run_histogram = {};
+  size_t run_frame_count = 0;
+  double run_milliseconds = 0.0;
+  double run_max_milliseconds = 0.0;
+};
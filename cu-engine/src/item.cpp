@@ -1,5 +1,8 @@
 #include "item.h"
+#include "profiler.h"
 #include "render_device/render_device.h"
+#include <algorithm>
+#include <chrono>
 
 CuItem::CuItem(const std::string p_id, const int p_item_type) {
   id = p_id;
@@ -63,6 +66,11 @@ void CuItem::set_scale(const glm::vec3 &p_scale) {
   is_dirty = true;
 };
 
+void CuItem::set_mesh(uint32_t p_mesh_id) {
+  mesh_id = p_mesh_id;
+  is_dirty = true;
+}
+
 void CuItem::add_child(std::shared_ptr<CuItem> p_item) {
   p_item->parent = shared_from_this();
   children.push_back(p_item);
@@ -154,53 +162,10 @@ void CuItemManager::add_root(std::unique_ptr<CuItem> p_item) {
   if (root) {
     return;
   }
-  CuRenderDevice *device = CuRenderDevice::get_singleton();
-  if (device) {
-    {
-      // create vertex buffer
-      {
-        cube_vertex_buffer =
-            device->create_buffer(sizeof(Vertex) * cube_vertices.size(),
-                                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                  VMA_MEMORY_USAGE_GPU_ONLY);
-
-        Buffer staging_buffer = device->create_buffer(
-            sizeof(Vertex) * cube_vertices.size(),
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-        device->write_buffer(cube_vertices.data(),
-                             sizeof(Vertex) * cube_vertices.size(),
-                             staging_buffer);
-        device->immediate_submit([&]() {
-          device->copy_buffer(staging_buffer, cube_vertex_buffer,
-                              sizeof(Vertex) * cube_vertices.size(), 0, 0);
-        });
-
-        device->clear_buffer(staging_buffer);
-      }
-    }
-    // create index buffer
-    {
-      cube_index_buffer = device->create_buffer(
-          sizeof(uint16_t) * cube_indices.size(),
-          VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-          VMA_MEMORY_USAGE_GPU_ONLY);
-
-      Buffer staging_buffer = device->create_buffer(
-          sizeof(uint16_t) * cube_indices.size(),
-          VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-      device->write_buffer(cube_indices.data(),
-                           sizeof(uint16_t) * cube_indices.size(),
-                           staging_buffer);
-      device->immediate_submit([&]() {
-        device->copy_buffer(staging_buffer, cube_index_buffer,
-                            sizeof(uint16_t) * cube_indices.size(), 0, 0);
-      });
-
-      device->clear_buffer(staging_buffer);
-    }
+  if (CuRenderDevice::get_singleton()) {
+    mesh_registry.init();
+    // mesh 0, what every renderable is drawn with by default
+    mesh_registry.add_mesh(cube_vertices, cube_indices);
   }
 
   root = std::move(p_item);
@@ -254,38 +219,200 @@ CuItemManager::get_items_by_type(CuItemType p_type) {
   return find_items_of_type_in_node(root, p_type);
 }
 
-void CuItemManager::update_items() { root->update(); }
+void CuItemManager::update_items() {
+  CU_PROFILE_SCOPE("CuItemManager::update_items");
+  root->update();
+}
 
-void CuItemManager::draw_items() {
-  CuRenderDevice *device = CuRenderDevice::get_singleton();
-  if (!device || cube_vertex_buffer.buffer == VK_NULL_HANDLE) {
+void CuItemManager::prepare_batches(std::vector<CuItem *> &p_items) {
+  // counting sort, keeps the order of items within a mesh
+  const uint32_t mesh_count = mesh_registry.get_mesh_count();
+  mesh_offsets.assign(mesh_count, 0);
+  for (CuItem *item : p_items) {
+    if (mesh_registry.is_valid(item->get_mesh())) {
+      mesh_offsets[item->get_mesh()]++;
+    }
+  }
+  // meshes of the same format follow each other so they share a pipeline
+  batches.clear();
+  uint32_t instance_offset = 0;
+  for (uint32_t format = 0; format < VERTEX_FORMAT_COUNT; ++format) {
+    format_batch_offsets[format] = batches.size();
+    for (uint32_t i = 0; i < mesh_count; ++i) {
+      const uint32_t instance_count = mesh_offsets[i];
+      if (instance_count == 0 || mesh_registry.get_mesh(i).format != format) {
+        continue;
+      }
+      batches.push_back({i, instance_offset, instance_count});
+      mesh_offsets[i] = instance_offset;
+      instance_offset += instance_count;
+    }
+  }
+  format_batch_offsets[VERTEX_FORMAT_COUNT] = batches.size();
+
+  sorted_items.resize(instance_offset);
+  for (CuItem *item : p_items) {
+    if (mesh_registry.is_valid(item->get_mesh())) {
+      sorted_items[mesh_offsets[item->get_mesh()]++] = item;
+    }
+  }
+  // items with removed meshes are left out
+  p_items.swap(sorted_items);
+}
+
+void CuItemManager::draw_items(VertexFormat p_format,
+                               const RenderPipeline &p_pipeline) {
+  if (batches.empty()) {
     return;
   }
+  draw_batch_range(0, batches.size(), p_format, p_pipeline);
+}
+
+bool CuItemManager::has_batches(uint32_t p_first_batch,
+                                uint32_t p_batch_count,
+                                VertexFormat p_format) const {
+  return std::max(p_first_batch, format_batch_offsets[p_format]) <
+         std::min(p_first_batch + p_batch_count,
+                  format_batch_offsets[p_format + 1]);
+}
+
+void CuItemManager::reset_dirty_states() {
   std::vector<std::shared_ptr<CuItem>> renderables =
       get_items_by_type(CuItemType::RENDERABLE);
-  const int instance_count = renderables.size();
-
-  device->bind_vertex_buffer(0, 1, {cube_vertex_buffer}, {0});
-  if (cube_index_buffer.buffer == VK_NULL_HANDLE) {
-    device->draw(cube_vertices.size(), instance_count, 0, 0);
-  } else {
-    device->bind_index_buffer(cube_index_buffer, 0);
-    device->draw_indexed(static_cast<uint16_t>(cube_indices.size()),
-                         instance_count, 0, 0, 0);
-  }
-
   for (int i = 0; i < renderables.size(); ++i) {
     renderables[i]->reset_dirty_state();
   }
 }
 
+void CuItemManager::cull_items(
+    const std::vector<std::shared_ptr<CuItem>> &p_renderables,
+    const std::array<glm::vec4, 6> &p_planes,
+    std::vector<CuItem *> &out_visible) {
+  CU_PROFILE_SCOPE("CuItemManager::cull_items");
+  auto cull_start = std::chrono::high_resolution_clock::now();
+  const uint64_t cull_frame = cull_stats.frame_count + 1;
+  for (const std::shared_ptr<CuItem> &item : p_renderables) {
+    if (!mesh_registry.is_valid(item->get_mesh())) {
+      continue;
+    }
+    const AABB &mesh_bounds = mesh_registry.get_mesh(item->get_mesh()).bounds;
+    ItemProxy &item_proxy = item_proxies[item.get()];
+    if (item_proxy.proxy == CuAabbTree::NULL_NODE) {
+      item_proxy.proxy = item_tree.create_proxy(
+          mesh_bounds.transformed(item->get_transform()), item.get());
+    } else if (item->get_dirty_state()) {
+      item_tree.move_proxy(item_proxy.proxy,
+                           mesh_bounds.transformed(item->get_transform()));
+    }
+    item_proxy.cull_frame = cull_frame;
+  }
+  // drop the proxies of items that are gone
+  if (item_proxies.size() != p_renderables.size()) {
+    for (auto it = item_proxies.begin(); it != item_proxies.end();) {
+      if (it->second.cull_frame != cull_frame) {
+        item_tree.destroy_proxy(it->second.proxy);
+        it = item_proxies.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  query_results.clear();
+  item_tree.query_frustum(p_planes, query_results);
+  out_visible.resize(query_results.size());
+  for (size_t i = 0; i < query_results.size(); ++i) {
+    out_visible[i] = static_cast<CuItem *>(query_results[i]);
+  }
+
+  auto cull_end = std::chrono::high_resolution_clock::now();
+  cull_stats.visible_count = out_visible.size();
+  cull_stats.total_count = p_renderables.size();
+  cull_stats.milliseconds =
+      std::chrono::duration<double, std::milli>(cull_end - cull_start).count();
+  cull_stats.frame_count = cull_frame;
+  cull_stats.average_visible_count +=
+      (cull_stats.visible_count - cull_stats.average_visible_count) /
+      cull_frame;
+  cull_stats.average_milliseconds +=
+      (cull_stats.milliseconds - cull_stats.average_milliseconds) / cull_frame;
+}
+
+void CuItemManager::draw_batch_range(uint32_t p_first_batch,
+                                     uint32_t p_batch_count,
+                                     VertexFormat p_format,
+                                     const RenderPipeline &p_pipeline) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device || !mesh_registry.is_ready() ||
+      !has_batches(p_first_batch, p_batch_count, p_format)) {
+    return;
+  }
+  // all meshes of a format share their buffers, so they're bound once
+  mesh_registry.bind(p_format);
+  const uint32_t end = std::min(p_first_batch + p_batch_count,
+                                format_batch_offsets[p_format + 1]);
+  for (uint32_t i = std::max(p_first_batch, format_batch_offsets[p_format]);
+       i < end; ++i) {
+    const MeshBatch &batch = batches[i];
+    const MeshInfo &mesh = mesh_registry.get_mesh(batch.mesh_id);
+    if (p_format == VERTEX_FORMAT_COMPRESSED) {
+      MeshBoundsConstants constants = mesh.get_bounds_constants();
+      device->bind_push_constant(p_pipeline, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                 sizeof(constants), &constants);
+    }
+    device->draw_indexed(mesh.index_count, batch.instance_count,
+                         mesh.first_index, mesh.first_vertex,
+                         batch.first_instance);
+  }
+}
+
+void CuItemManager::draw_items_indirect(const Buffer &p_commands,
+                                        VkDeviceSize p_offset,
+                                        const Buffer &p_count_buffer,
+                                        VkDeviceSize p_count_offset,
+                                        VertexFormat p_format,
+                                        const RenderPipeline &p_pipeline) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device || !mesh_registry.is_ready() || get_batch_count(p_format) == 0) {
+    return;
+  }
+  mesh_registry.bind(p_format);
+  if (p_format == VERTEX_FORMAT_FLOAT) {
+    // float batches come first, so the count written by the compute pass
+    // only has to be clamped to them
+    device->draw_indexed_indirect_count(p_commands, p_offset, p_count_buffer,
+                                        p_count_offset,
+                                        get_batch_count(p_format));
+    return;
+  }
+  for (uint32_t i = format_batch_offsets[p_format];
+       i < format_batch_offsets[p_format + 1]; ++i) {
+    MeshBoundsConstants constants =
+        mesh_registry.get_mesh(batches[i].mesh_id).get_bounds_constants();
+    device->bind_push_constant(p_pipeline, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(constants), &constants);
+    device->draw_indexed_indirect(
+        p_commands, p_offset + sizeof(VkDrawIndexedIndirectCommand) * i, 1);
+  }
+}
+
 void CuItemManager::clear_renderable_resources() {
   CuRenderDevice *device = CuRenderDevice::get_singleton();
   if (!device) {
     return;
   }
-  device->clear_buffer(cube_vertex_buffer);
-  device->clear_buffer(cube_index_buffer);
+  mesh_registry.clear();
+  batches.clear();
+  std::fill(std::begin(format_batch_offsets), std::end(format_batch_offsets),
+            0);
+  if (cull_stats.frame_count > 0) {
+    ENGINE_INFO("Frustum culling: {:.1f} of {} items visible on average, "
+                "{:.3f} ms per frame",
+                cull_stats.average_visible_count, cull_stats.total_count,
+                cull_stats.average_milliseconds);
+  }
+  item_tree.clear();
+  item_proxies.clear();
 }
 
 void CuItemManager::clear_items() {
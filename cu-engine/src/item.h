@@ -1,11 +1,24 @@
 #pragma once
+#include "aabb_tree.h"
+#include "mesh_registry.h"
 #include "physics-server.h"
 #include "render_device/utils.h"
 #include <string>
+#include <unordered_map>
 #include <vector>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <gtx/transform.hpp>
 
+struct RenderPipeline;
+
+/**
+affine transform as the rows of a 3x4 matrix, the per instance data the
+shaders read. A quarter smaller than a mat4.
+ */
+struct InstanceTransform {
+  glm::vec4 rows[3];
+};
+
 /**
 Bitflags for CuItem
  */
@@ -16,11 +29,6 @@ enum CuItemType {
   RIGID_BODY = 1 << 2
 };
 
-struct Vertex {
-  glm::vec3 position;
-  glm::vec3 normals;
-};
-
 /**
 Similar in the functionality of a Node.
 Handles things like rendering, physics etc.
@@ -68,10 +76,20 @@ public:
    retuns CuItem's model matrix.
    */
   glm::mat4 get_transform() const { return transform; }
+  InstanceTransform get_instance_transform() const {
+    const glm::mat4 rows = glm::transpose(transform);
+    return {{rows[0], rows[1], rows[2]}};
+  }
   /**
    retuns CuItem's CuItemTypes.
    */
   CuItemType get_type() const { return item_type; }
+  /**
+   sets the mesh renderables are drawn with, see CuMeshRegistry. Mesh 0 is
+   the built-in cube.
+   */
+  void set_mesh(uint32_t p_mesh_id);
+  uint32_t get_mesh() const { return mesh_id; }
 
   void reset_dirty_state() { is_dirty = false; }
   bool get_dirty_state() const { return is_dirty; }
@@ -98,6 +116,7 @@ private:
   glm::mat4 transform;
   btTransform bt_transform;
   CuItemType item_type = NONE;
+  uint32_t mesh_id = 0;
   std::weak_ptr<CuItem> parent;
   std::vector<std::shared_ptr<CuItem>> children;
   btCollisionShape *shape = nullptr;
@@ -106,6 +125,16 @@ private:
   bool is_dirty = true;
 };
 
+struct CuCullStats {
+  uint32_t visible_count = 0;
+  uint32_t total_count = 0;
+  double milliseconds = 0.0;
+  // over every cull_items() call so far
+  double average_visible_count = 0.0;
+  double average_milliseconds = 0.0;
+  uint64_t frame_count = 0;
+};
+
 /**
 Manages all living items in the scene.
  */
@@ -119,7 +148,55 @@ public:
 
   void update_items();
 
-  void draw_items();
+  /**
+   sorts p_items by vertex format and mesh and remembers the batches they
+   form. Instance data has to be written in the sorted order, the draw calls
+   below draw these batches.
+   */
+  void prepare_batches(std::vector<CuItem *> &p_items);
+  const std::vector<MeshBatch> &get_batches() const { return batches; }
+  uint32_t get_batch_count(VertexFormat p_format) const {
+    return format_batch_offsets[p_format + 1] - format_batch_offsets[p_format];
+  }
+  /**
+   draws every batch of p_format, one draw call per mesh. p_pipeline has to
+   be bound and match the format, compressed meshes push their bounds to it.
+   */
+  void draw_items(VertexFormat p_format, const RenderPipeline &p_pipeline);
+  /**
+   draws the batches of p_format among get_batches() from p_first_batch to
+   p_first_batch + p_batch_count, one draw call each. Unlike draw_items() it
+   doesn't touch the items, so ranges can be recorded from several threads.
+   */
+  void draw_batch_range(uint32_t p_first_batch, uint32_t p_batch_count,
+                        VertexFormat p_format,
+                        const RenderPipeline &p_pipeline);
+  /**
+   whether batches from p_first_batch to p_first_batch + p_batch_count
+   include any of p_format.
+   */
+  bool has_batches(uint32_t p_first_batch, uint32_t p_batch_count,
+                   VertexFormat p_format) const;
+  /**
+   draws the batches of p_format with the commands a compute pass wrote into
+   p_commands, one per batch. Float meshes are drawn with a single
+   CuRenderDevice::draw_indexed_indirect_count(), compressed ones need their
+   bounds pushed per draw.
+   */
+  void draw_items_indirect(const Buffer &p_commands, VkDeviceSize p_offset,
+                           const Buffer &p_count_buffer,
+                           VkDeviceSize p_count_offset, VertexFormat p_format,
+                           const RenderPipeline &p_pipeline);
+  CuMeshRegistry &get_mesh_registry() { return mesh_registry; }
+  void reset_dirty_states();
+  /**
+   refits the bounds of moved renderables in the item tree and collects the
+   ones inside of p_planes. Has to run before the dirty states get reset.
+   */
+  void cull_items(const std::vector<std::shared_ptr<CuItem>> &p_renderables,
+                  const std::array<glm::vec4, 6> &p_planes,
+                  std::vector<CuItem *> &out_visible);
+  const CuCullStats &get_cull_stats() const { return cull_stats; }
 
   void clear_renderable_resources();
 
@@ -130,9 +207,23 @@ public:
 private:
   std::shared_ptr<CuItem> root;
   static CuItemManager *singleton;
-  Buffer cube_vertex_buffer;
-  Buffer cube_index_buffer;
-  Buffer transforms_buffer;
+  CuMeshRegistry mesh_registry;
+  std::vector<MeshBatch> batches;
+  // batches of each vertex format start at its offset
+  uint32_t format_batch_offsets[VERTEX_FORMAT_COUNT + 1] = {};
+  // scratch space of prepare_batches()
+  std::vector<uint32_t> mesh_offsets;
+  std::vector<CuItem *> sorted_items;
+
+  struct ItemProxy {
+    int32_t proxy = CuAabbTree::NULL_NODE;
+    uint64_t cull_frame = 0;
+  };
+  // world space bounds of the renderables
+  CuAabbTree item_tree;
+  std::unordered_map<CuItem *, ItemProxy> item_proxies;
+  std::vector<void *> query_results;
+  CuCullStats cull_stats;
 
   std::vector<Vertex> cube_vertices = {
       // Front face
@@ -168,7 +259,7 @@ private:
   };
 
   // Define the indices for the 12 triangles that make up the cube
-  std::vector<uint16_t> cube_indices = {
+  std::vector<uint32_t> cube_indices = {
       // Front face
       0, 1, 2, 2, 3, 0,
       // Back face
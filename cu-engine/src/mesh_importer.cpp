@@ -0,0 +1,590 @@
+#include "mesh_importer.h"
+#include "logger.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+read only view of a whole file, memory mapped where the platform allows it.
+ */
+class MappedFile {
+public:
+  ~MappedFile() { close(); }
+  bool open(const std::string &p_path);
+  void close();
+  const char *get_data() const { return data; }
+  size_t get_size() const { return size; }
+
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+#ifdef _WIN32
+  std::vector<char> contents = {};
+#endif
+};
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string &p_path) {
+  std::ifstream file(p_path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  contents.resize(file.tellg());
+  file.seekg(0);
+  file.read(contents.data(), contents.size());
+  data = contents.data();
+  size = contents.size();
+  return size > 0;
+}
+
+void MappedFile::close() {
+  contents.clear();
+  data = nullptr;
+  size = 0;
+}
+#else
+bool MappedFile::open(const std::string &p_path) {
+  const int file = ::open(p_path.c_str(), O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+  struct stat info = {};
+  if (fstat(file, &info) != 0 || info.st_size == 0) {
+    ::close(file);
+    return false;
+  }
+  void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  // the mapping keeps the file alive
+  ::close(file);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  // every chunk gets read once, let the kernel fetch ahead
+  madvise(mapping, info.st_size, MADV_WILLNEED);
+  data = static_cast<const char *>(mapping);
+  size = info.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (data) {
+    munmap(const_cast<char *>(data), size);
+  }
+  data = nullptr;
+  size = 0;
+}
+#endif
+
+// corners without a normal in the file
+static const uint32_t NO_NORMAL = UINT32_MAX;
+static const uint64_t EMPTY_KEY = UINT64_MAX;
+// smaller files aren't worth splitting
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+enum ObjLine { LINE_OTHER, LINE_POSITION, LINE_NORMAL, LINE_FACE };
+
+/**
+a range of whole lines, parsed by one thread.
+ */
+struct ObjChunk {
+  const char *begin = nullptr;
+  const char *end = nullptr;
+  uint32_t position_count = 0;
+  uint32_t normal_count = 0;
+  uint32_t corner_count = 0;
+  // where the chunk's elements start in the whole file
+  uint32_t first_position = 0;
+  uint32_t first_normal = 0;
+  uint32_t first_corner = 0;
+  bool failed = false;
+};
+
+static bool is_space(char p_character) {
+  return p_character == ' ' || p_character == '\t' || p_character == '\r';
+}
+
+static const char *skip_spaces(const char *p_begin, const char *p_end) {
+  while (p_begin < p_end && is_space(*p_begin)) {
+    p_begin++;
+  }
+  return p_begin;
+}
+
+static const char *skip_token(const char *p_begin, const char *p_end) {
+  while (p_begin < p_end && !is_space(*p_begin)) {
+    p_begin++;
+  }
+  return p_begin;
+}
+
+/**
+returns the end of the line at p_begin without the newline or a comment.
+ */
+static const char *find_line_end(const char *p_begin, const char *p_end,
+                                 const char *&out_next_line) {
+  const char *newline =
+      static_cast<const char *>(memchr(p_begin, '\n', p_end - p_begin));
+  const char *line_end = newline ? newline : p_end;
+  out_next_line = newline ? newline + 1 : p_end;
+  const char *comment =
+      static_cast<const char *>(memchr(p_begin, '#', line_end - p_begin));
+  return comment ? comment : line_end;
+}
+
+static ObjLine get_line_type(const char *&p_line, const char *p_end) {
+  if (p_end - p_line < 2) {
+    return LINE_OTHER;
+  }
+  if (p_line[0] == 'v' && is_space(p_line[1])) {
+    p_line += 2;
+    return LINE_POSITION;
+  }
+  if (p_line[0] == 'v' && p_line[1] == 'n' && p_end - p_line > 2 &&
+      is_space(p_line[2])) {
+    p_line += 3;
+    return LINE_NORMAL;
+  }
+  if (p_line[0] == 'f' && is_space(p_line[1])) {
+    p_line += 2;
+    return LINE_FACE;
+  }
+  return LINE_OTHER;
+}
+
+static uint32_t count_tokens(const char *p_begin, const char *p_end) {
+  uint32_t count = 0;
+  for (const char *token = skip_spaces(p_begin, p_end); token < p_end;
+       token = skip_spaces(skip_token(token, p_end), p_end)) {
+    count++;
+  }
+  return count;
+}
+
+/**
+first pass, only counts elements so every chunk knows where to write.
+ */
+static void count_chunk(ObjChunk &p_chunk) {
+  const char *next_line = p_chunk.begin;
+  while (next_line < p_chunk.end) {
+    const char *line = skip_spaces(next_line, p_chunk.end);
+    const char *line_end = find_line_end(line, p_chunk.end, next_line);
+    switch (get_line_type(line, line_end)) {
+    case LINE_POSITION:
+      p_chunk.position_count++;
+      break;
+    case LINE_NORMAL:
+      p_chunk.normal_count++;
+      break;
+    case LINE_FACE: {
+      const uint32_t corners = count_tokens(line, line_end);
+      if (corners >= 3) {
+        p_chunk.corner_count += (corners - 2) * 3;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+static bool parse_vec3(const char *p_begin, const char *p_end,
+                       glm::vec3 &out_value) {
+  const char *current = p_begin;
+  for (int i = 0; i < 3; ++i) {
+    current = skip_spaces(current, p_end);
+    const std::from_chars_result result =
+        std::from_chars(current, p_end, out_value[i]);
+    if (result.ec != std::errc()) {
+      return false;
+    }
+    current = result.ptr;
+  }
+  return true;
+}
+
+/**
+turns 1 based and negative, relative OBJ indices into 0 based ones.
+ */
+static bool resolve_index(int32_t p_index, uint32_t p_read_count,
+                          uint32_t p_total_count, uint32_t &out_index) {
+  const int64_t index =
+      p_index > 0 ? int64_t(p_index) - 1 : int64_t(p_read_count) + p_index;
+  if (p_index == 0 || index < 0 || index >= p_total_count) {
+    return false;
+  }
+  out_index = index;
+  return true;
+}
+
+/**
+parses a position/texture/normal reference into a key of both indices.
+ */
+static bool parse_corner(const char *p_begin, const char *p_end,
+                         const ObjChunk &p_chunk, uint32_t p_position_count,
+                         uint32_t p_normal_count, const ObjChunk &p_totals,
+                         bool p_use_normals, uint64_t &out_key) {
+  int32_t position = 0;
+  int32_t normal = 0;
+  std::from_chars_result result = std::from_chars(p_begin, p_end, position);
+  if (result.ec != std::errc()) {
+    return false;
+  }
+  const char *current = result.ptr;
+  if (current < p_end && *current == '/') {
+    // texture coordinates are skipped
+    current++;
+    while (current < p_end && *current != '/') {
+      current++;
+    }
+    if (current < p_end && *current == '/') {
+      result = std::from_chars(current + 1, p_end, normal);
+      if (result.ec != std::errc()) {
+        return false;
+      }
+    }
+  }
+
+  uint32_t position_index = 0;
+  if (!resolve_index(position, p_chunk.first_position + p_position_count,
+                     p_totals.position_count, position_index)) {
+    return false;
+  }
+  uint32_t normal_index = NO_NORMAL;
+  if (p_use_normals && normal != 0 &&
+      !resolve_index(normal, p_chunk.first_normal + p_normal_count,
+                     p_totals.normal_count, normal_index)) {
+    return false;
+  }
+  out_key = uint64_t(position_index) << 32 | normal_index;
+  return true;
+}
+
+/**
+second pass, writes the chunk's elements to where count_chunk() placed them.
+ */
+static void parse_chunk(ObjChunk &p_chunk, const ObjChunk &p_totals,
+                        bool p_use_normals, glm::vec3 *out_positions,
+                        glm::vec3 *out_normals, uint64_t *out_corners) {
+  uint32_t position_count = 0;
+  uint32_t normal_count = 0;
+  uint32_t corner_count = 0;
+  const char *next_line = p_chunk.begin;
+  while (next_line < p_chunk.end && !p_chunk.failed) {
+    const char *line = skip_spaces(next_line, p_chunk.end);
+    const char *line_end = find_line_end(line, p_chunk.end, next_line);
+    switch (get_line_type(line, line_end)) {
+    case LINE_POSITION:
+      p_chunk.failed =
+          !parse_vec3(line, line_end,
+                      out_positions[p_chunk.first_position + position_count]);
+      position_count++;
+      break;
+    case LINE_NORMAL:
+      p_chunk.failed = !parse_vec3(
+          line, line_end, out_normals[p_chunk.first_normal + normal_count]);
+      normal_count++;
+      break;
+    case LINE_FACE: {
+      if (count_tokens(line, line_end) < 3) {
+        break;
+      }
+      // triangulated as a fan around the first corner
+      uint64_t *corners = out_corners + p_chunk.first_corner;
+      uint64_t first = 0;
+      uint64_t previous = 0;
+      uint32_t index = 0;
+      for (const char *token = skip_spaces(line, line_end); token < line_end;
+           token = skip_spaces(token, line_end), ++index) {
+        const char *token_end = skip_token(token, line_end);
+        uint64_t key = 0;
+        if (!parse_corner(token, token_end, p_chunk, position_count,
+                          normal_count, p_totals, p_use_normals, key)) {
+          p_chunk.failed = true;
+          break;
+        }
+        token = token_end;
+        if (index == 0) {
+          first = key;
+        } else if (index >= 2) {
+          corners[corner_count++] = first;
+          corners[corner_count++] = previous;
+          corners[corner_count++] = key;
+        }
+        previous = key;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+static void run_parallel(
+    size_t p_count, const std::function<void(size_t, size_t)> &p_function) {
+  CuThreadPool *thread_pool = CuThreadPool::get_singleton();
+  if (thread_pool) {
+    thread_pool->parallel_for(p_count, p_function);
+  } else {
+    p_function(0, p_count);
+  }
+}
+
+/**
+splits the file at newlines into about one chunk per thread.
+ */
+static std::vector<ObjChunk> split_chunks(const char *p_data, size_t p_size) {
+  CuThreadPool *thread_pool = CuThreadPool::get_singleton();
+  const size_t thread_count =
+      thread_pool ? thread_pool->get_worker_count() + 1 : 1;
+  const size_t chunk_count =
+      std::max<size_t>(1, std::min(thread_count, p_size / MIN_CHUNK_SIZE));
+
+  std::vector<ObjChunk> chunks = {};
+  const char *end = p_data + p_size;
+  const char *begin = p_data;
+  for (size_t i = 1; i <= chunk_count && begin < end; ++i) {
+    const char *chunk_end =
+        i == chunk_count ? end : p_data + p_size * i / chunk_count;
+    if (chunk_end < begin) {
+      continue;
+    }
+    const char *newline = static_cast<const char *>(
+        memchr(chunk_end, '\n', end - chunk_end));
+    chunk_end = newline ? newline + 1 : end;
+    ObjChunk chunk = {};
+    chunk.begin = begin;
+    chunk.end = chunk_end;
+    chunks.push_back(chunk);
+    begin = chunk_end;
+  }
+  return chunks;
+}
+
+/**
+maps every distinct position and normal pair to one vertex. Returns the
+distinct keys in the order they were first seen.
+ */
+static std::vector<uint64_t>
+deduplicate_corners(const std::vector<uint64_t> &p_corners,
+                    std::vector<uint32_t> &out_indices) {
+  uint32_t bits = 4;
+  while ((size_t(1) << bits) < p_corners.size() * 2) {
+    bits++;
+  }
+  const size_t mask = (size_t(1) << bits) - 1;
+  // open addressing with linear probing, keys are never removed
+  std::vector<uint64_t> keys(mask + 1, EMPTY_KEY);
+  std::vector<uint32_t> values(mask + 1);
+  std::vector<uint64_t> unique = {};
+
+  out_indices.resize(p_corners.size());
+  for (size_t i = 0; i < p_corners.size(); ++i) {
+    const uint64_t key = p_corners[i];
+    size_t slot = (key * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+    while (keys[slot] != EMPTY_KEY && keys[slot] != key) {
+      slot = (slot + 1) & mask;
+    }
+    if (keys[slot] == EMPTY_KEY) {
+      keys[slot] = key;
+      values[slot] = unique.size();
+      unique.push_back(key);
+    }
+    out_indices[i] = values[slot];
+  }
+  return unique;
+}
+
+/**
+smooth normals, faces contribute by their area.
+ */
+static std::vector<glm::vec3>
+generate_normals(const std::vector<uint64_t> &p_unique,
+                 const std::vector<uint32_t> &p_indices,
+                 const std::vector<glm::vec3> &p_positions) {
+  std::vector<glm::vec3> normals(p_unique.size(), glm::vec3(0.0f));
+  for (size_t i = 0; i + 2 < p_indices.size(); i += 3) {
+    const glm::vec3 &a = p_positions[p_unique[p_indices[i]] >> 32];
+    const glm::vec3 &b = p_positions[p_unique[p_indices[i + 1]] >> 32];
+    const glm::vec3 &c = p_positions[p_unique[p_indices[i + 2]] >> 32];
+    // the cross product's length is twice the triangle's area
+    const glm::vec3 normal = glm::cross(b - a, c - a);
+    normals[p_indices[i]] += normal;
+    normals[p_indices[i + 1]] += normal;
+    normals[p_indices[i + 2]] += normal;
+  }
+  return normals;
+}
+
+static uint32_t import_obj(const std::string &p_path, const MappedFile &p_file,
+                           CuMeshRegistry &p_registry,
+                           const MeshImportOptions &p_options,
+                           MeshImportStats &out_stats) {
+  auto parse_start = std::chrono::high_resolution_clock::now();
+  std::vector<ObjChunk> chunks =
+      split_chunks(p_file.get_data(), p_file.get_size());
+  run_parallel(chunks.size(), [&](size_t p_begin, size_t p_end) {
+    for (size_t i = p_begin; i < p_end; ++i) {
+      count_chunk(chunks[i]);
+    }
+  });
+
+  ObjChunk totals = {};
+  for (ObjChunk &chunk : chunks) {
+    chunk.first_position = totals.position_count;
+    chunk.first_normal = totals.normal_count;
+    chunk.first_corner = totals.corner_count;
+    totals.position_count += chunk.position_count;
+    totals.normal_count += chunk.normal_count;
+    totals.corner_count += chunk.corner_count;
+  }
+  if (totals.corner_count == 0) {
+    ENGINE_ERROR("{} has no faces", p_path);
+    return CuMeshRegistry::INVALID_MESH;
+  }
+
+  const bool generate =
+      p_options.generate_normals || totals.normal_count == 0;
+  std::vector<glm::vec3> positions(totals.position_count);
+  std::vector<glm::vec3> normals(totals.normal_count);
+  std::vector<uint64_t> corners(totals.corner_count);
+  run_parallel(chunks.size(), [&](size_t p_begin, size_t p_end) {
+    for (size_t i = p_begin; i < p_end; ++i) {
+      parse_chunk(chunks[i], totals, !generate, positions.data(),
+                  normals.data(), corners.data());
+    }
+  });
+  for (const ObjChunk &chunk : chunks) {
+    if (chunk.failed) {
+      ENGINE_ERROR("{} has malformed vertex or face data", p_path);
+      return CuMeshRegistry::INVALID_MESH;
+    }
+  }
+  auto parse_end = std::chrono::high_resolution_clock::now();
+
+  std::vector<uint32_t> indices = {};
+  const std::vector<uint64_t> unique = deduplicate_corners(corners, indices);
+  corners = {};
+  std::vector<glm::vec3> generated_normals = {};
+  if (generate) {
+    generated_normals = generate_normals(unique, indices, positions);
+  }
+
+  MeshStaging staging = {};
+  if (!p_registry.reserve_mesh(unique.size(), indices.size(), staging,
+                               p_options.vertex_format)) {
+    ENGINE_ERROR("Rejected {}: no room for its {} vertices and {} indices "
+                 "in the mesh buffers",
+                 p_path, unique.size(), indices.size());
+    return CuMeshRegistry::INVALID_MESH;
+  }
+  // staging memory is write combined, bounds come from the source arrays.
+  // Compressed vertices are quantized against them, so they come first
+  staging.bounds = {positions[unique[0] >> 32], positions[unique[0] >> 32]};
+  std::mutex bounds_mutex;
+  run_parallel(unique.size(), [&](size_t p_begin, size_t p_end) {
+    AABB bounds = {positions[unique[p_begin] >> 32],
+                   positions[unique[p_begin] >> 32]};
+    for (size_t i = p_begin; i < p_end; ++i) {
+      bounds.min = glm::min(bounds.min, positions[unique[i] >> 32]);
+      bounds.max = glm::max(bounds.max, positions[unique[i] >> 32]);
+    }
+    std::lock_guard<std::mutex> guard(bounds_mutex);
+    staging.bounds = AABB::merge(staging.bounds, bounds);
+  });
+  run_parallel(unique.size(), [&](size_t p_begin, size_t p_end) {
+    for (size_t i = p_begin; i < p_end; ++i) {
+      Vertex vertex = {};
+      vertex.position = positions[unique[i] >> 32];
+      const uint32_t normal = unique[i] & 0xFFFFFFFF;
+      if (generate) {
+        const float length = glm::length(generated_normals[i]);
+        vertex.normals = length > 0.0f ? generated_normals[i] / length
+                                       : glm::vec3(0.0f, 1.0f, 0.0f);
+      } else if (normal != NO_NORMAL) {
+        vertex.normals = normals[normal];
+      } else {
+        vertex.normals = glm::vec3(0.0f);
+      }
+      if (staging.compressed_vertices) {
+        staging.compressed_vertices[i] =
+            compress_vertex(vertex, staging.bounds);
+      } else {
+        staging.vertices[i] = vertex;
+      }
+    }
+  });
+  run_parallel(indices.size(), [&](size_t p_begin, size_t p_end) {
+    memcpy(staging.indices + p_begin, indices.data() + p_begin,
+           sizeof(uint32_t) * (p_end - p_begin));
+  });
+
+  out_stats.vertex_count = unique.size();
+  out_stats.triangle_count = indices.size() / 3;
+  out_stats.parse_milliseconds =
+      std::chrono::duration<double, std::milli>(parse_end - parse_start)
+          .count();
+  return p_registry.commit_mesh(staging);
+}
+
+uint32_t import_mesh(const std::string &p_path, CuMeshRegistry &p_registry,
+                     const MeshImportOptions &p_options /*= {}*/,
+                     MeshImportStats *out_stats /*= nullptr*/) {
+  const size_t extension_start = p_path.find_last_of('.');
+  std::string extension = extension_start == std::string::npos
+                              ? std::string()
+                              : p_path.substr(extension_start + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char p_character) {
+                   return std::tolower(p_character);
+                 });
+  if (extension != "obj") {
+    ENGINE_ERROR("Can't import {}, only OBJ meshes are supported", p_path);
+    return CuMeshRegistry::INVALID_MESH;
+  }
+
+  auto import_start = std::chrono::high_resolution_clock::now();
+  MappedFile file;
+  if (!file.open(p_path)) {
+    ENGINE_ERROR("Failed to open {}", p_path);
+    return CuMeshRegistry::INVALID_MESH;
+  }
+  MeshImportStats stats = {};
+  stats.file_size = file.get_size();
+  const uint32_t mesh =
+      import_obj(p_path, file, p_registry, p_options, stats);
+  if (mesh == CuMeshRegistry::INVALID_MESH) {
+    return mesh;
+  }
+  auto import_end = std::chrono::high_resolution_clock::now();
+
+  stats.total_milliseconds =
+      std::chrono::duration<double, std::milli>(import_end - import_start)
+          .count();
+  const double megabytes = stats.file_size / (1024.0 * 1024.0);
+  stats.megabytes_per_second =
+      megabytes / std::max(stats.parse_milliseconds / 1000.0, 1e-6);
+  ENGINE_INFO("Imported {}: {} vertices, {} triangles, parsed {:.2f} MB in "
+              "{:.2f} ms ({:.1f} MB/s), {:.2f} ms total",
+              p_path, stats.vertex_count, stats.triangle_count, megabytes,
+              stats.parse_milliseconds, stats.megabytes_per_second,
+              stats.total_milliseconds);
+  if (out_stats) {
+    *out_stats = stats;
+  }
+  return mesh;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "mesh_registry.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct MeshImportOptions {
+  // replaces the file's normals with smooth, area weighted ones. Files
+  // without normals always get generated ones
+  bool generate_normals = false;
+  // compressed vertices are half the size, see CompressedVertex
+  VertexFormat vertex_format = VERTEX_FORMAT_FLOAT;
+};
+
+struct MeshImportStats {
+  size_t file_size = 0;
+  double parse_milliseconds = 0.0;
+  // parsing, deduplication and writing into staging memory
+  double total_milliseconds = 0.0;
+  double megabytes_per_second = 0.0;
+  uint32_t vertex_count = 0;
+  uint32_t triangle_count = 0;
+};
+
+/**
+Loads a Wavefront OBJ file into p_registry and returns the mesh id, or
+CuMeshRegistry::INVALID_MESH on failure. The file is memory mapped and
+parsed in chunks on the thread pool, so call it from outside of the pool.
+Faces with more than three corners are triangulated as fans and texture
+coordinates are skipped since Vertex has none.
+ */
+uint32_t import_mesh(const std::string &p_path, CuMeshRegistry &p_registry,
+                     const MeshImportOptions &p_options = {},
+                     MeshImportStats *out_stats = nullptr);
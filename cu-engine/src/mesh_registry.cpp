@@ -0,0 +1,325 @@
+#include "mesh_registry.h"
+#include "render_device/render_device.h"
+#include <algorithm>
+#include <cstring>
+
+void CuMeshRegistry::FreeRanges::init(uint32_t p_capacity) {
+  ranges = {{0, p_capacity}};
+}
+
+uint32_t CuMeshRegistry::FreeRanges::allocate(uint32_t p_count) {
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i].second < p_count) {
+      continue;
+    }
+    const uint32_t offset = ranges[i].first;
+    ranges[i].first += p_count;
+    ranges[i].second -= p_count;
+    if (ranges[i].second == 0) {
+      ranges.erase(ranges.begin() + i);
+    }
+    return offset;
+  }
+  return UINT32_MAX;
+}
+
+void CuMeshRegistry::FreeRanges::free(uint32_t p_offset, uint32_t p_count) {
+  size_t index = 0;
+  while (index < ranges.size() && ranges[index].first < p_offset) {
+    index++;
+  }
+  ranges.insert(ranges.begin() + index, {p_offset, p_count});
+  // merge with the following and the previous range
+  if (index + 1 < ranges.size() &&
+      ranges[index].first + ranges[index].second == ranges[index + 1].first) {
+    ranges[index].second += ranges[index + 1].second;
+    ranges.erase(ranges.begin() + index + 1);
+  }
+  if (index > 0 && ranges[index - 1].first + ranges[index - 1].second ==
+                       ranges[index].first) {
+    ranges[index - 1].second += ranges[index].second;
+    ranges.erase(ranges.begin() + index);
+  }
+}
+
+const VkBufferUsageFlags VERTEX_BUFFER_USAGE =
+    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+const VkBufferUsageFlags INDEX_BUFFER_USAGE =
+    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+// offsets into the buffers are 32 bit
+const uint64_t MAX_ELEMENTS = UINT32_MAX;
+
+static size_t get_vertex_size(VertexFormat p_format) {
+  return p_format == VERTEX_FORMAT_COMPRESSED ? sizeof(CompressedVertex)
+                                              : sizeof(Vertex);
+}
+
+static glm::vec2 encode_octahedral(const glm::vec3 &p_normal) {
+  const float length =
+      glm::abs(p_normal.x) + glm::abs(p_normal.y) + glm::abs(p_normal.z);
+  if (length == 0.0f) {
+    return glm::vec2(0.0f);
+  }
+  const glm::vec3 normal = p_normal / length;
+  if (normal.z >= 0.0f) {
+    return glm::vec2(normal);
+  }
+  // the lower half gets folded over the diagonals
+  const glm::vec2 sign = glm::vec2(normal.x >= 0.0f ? 1.0f : -1.0f,
+                                   normal.y >= 0.0f ? 1.0f : -1.0f);
+  return (1.0f - glm::abs(glm::vec2(normal.y, normal.x))) * sign;
+}
+
+CompressedVertex compress_vertex(const Vertex &p_vertex,
+                                 const AABB &p_bounds) {
+  CompressedVertex result = {};
+  const glm::vec3 extent = p_bounds.max - p_bounds.min;
+  for (int i = 0; i < 3; ++i) {
+    const float position =
+        extent[i] > 0.0f
+            ? (p_vertex.position[i] - p_bounds.min[i]) / extent[i]
+            : 0.0f;
+    result.position[i] =
+        glm::round(glm::clamp(position, 0.0f, 1.0f) * 65535.0f);
+  }
+  const glm::vec2 normal = encode_octahedral(p_vertex.normals);
+  for (int i = 0; i < 2; ++i) {
+    result.normal[i] =
+        glm::round(glm::clamp(normal[i], -1.0f, 1.0f) * 32767.0f);
+  }
+  return result;
+}
+
+void CuMeshRegistry::init(uint32_t p_vertex_capacity /*= 1 << 20*/,
+                          uint32_t p_index_capacity /*= 1 << 22*/) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device) {
+    ENGINE_ERROR("Can't create mesh buffers without a render device");
+    return;
+  }
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+    vertex_buffers[i] = device->create_buffer(
+        get_vertex_size(VertexFormat(i)) * p_vertex_capacity,
+        VERTEX_BUFFER_USAGE, VMA_MEMORY_USAGE_GPU_ONLY, MEMORY_GEOMETRY);
+    free_vertices[i].init(p_vertex_capacity);
+    vertex_capacities[i] = p_vertex_capacity;
+  }
+  index_buffer = device->create_buffer(sizeof(uint32_t) * p_index_capacity,
+                                       INDEX_BUFFER_USAGE,
+                                       VMA_MEMORY_USAGE_GPU_ONLY,
+                                       MEMORY_GEOMETRY);
+  free_indices.init(p_index_capacity);
+  index_capacity = p_index_capacity;
+}
+
+uint32_t CuMeshRegistry::allocate(Buffer &p_buffer, FreeRanges &p_ranges,
+                                  uint32_t &p_capacity,
+                                  VkDeviceSize p_element_size,
+                                  VkBufferUsageFlags p_usage,
+                                  uint32_t p_count) {
+  const uint32_t offset = p_ranges.allocate(p_count);
+  if (offset != UINT32_MAX) {
+    return offset;
+  }
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  const uint64_t needed = uint64_t(p_capacity) + p_count;
+  if (!device || needed > MAX_ELEMENTS) {
+    return UINT32_MAX;
+  }
+  // doubling keeps the number of copies low while meshes keep coming in
+  const uint32_t capacity =
+      std::min(std::max(uint64_t(p_capacity) * 2, needed), MAX_ELEMENTS);
+  Buffer buffer =
+      device->create_buffer(p_element_size * capacity, p_usage,
+                            VMA_MEMORY_USAGE_GPU_ONLY, MEMORY_GEOMETRY);
+  UploadManager &upload_manager = device->get_upload_manager();
+  const uint64_t copied =
+      upload_manager.copy(p_buffer, buffer, p_element_size * p_capacity);
+  // frames in flight still draw from the old buffer, and the copy out of it
+  // may not have run yet
+  device->queue_frame_deletion([device, old_buffer = p_buffer,
+                                copied]() mutable {
+    device->get_upload_manager().wait(copied);
+    device->clear_buffer(old_buffer);
+  });
+  ENGINE_INFO("Mesh buffer grew from {} to {} elements ({:.1f} MiB)",
+              p_capacity, capacity,
+              p_element_size * capacity / (1024.0 * 1024.0));
+  p_buffer = buffer;
+  p_ranges.free(p_capacity, capacity - p_capacity);
+  p_capacity = capacity;
+  return p_ranges.allocate(p_count);
+}
+
+uint32_t CuMeshRegistry::add_mesh(const std::vector<Vertex> &p_vertices,
+                                  const std::vector<uint32_t> &p_indices,
+                                  VertexFormat p_format /*= FLOAT*/) {
+  MeshStaging staging = {};
+  if (!reserve_mesh(p_vertices.size(), p_indices.size(), staging, p_format)) {
+    return INVALID_MESH;
+  }
+  staging.bounds = {p_vertices[0].position, p_vertices[0].position};
+  for (const Vertex &vertex : p_vertices) {
+    staging.bounds.min = glm::min(staging.bounds.min, vertex.position);
+    staging.bounds.max = glm::max(staging.bounds.max, vertex.position);
+  }
+  if (staging.compressed_vertices) {
+    for (size_t i = 0; i < p_vertices.size(); ++i) {
+      staging.compressed_vertices[i] =
+          compress_vertex(p_vertices[i], staging.bounds);
+    }
+  } else {
+    memcpy(staging.vertices, p_vertices.data(),
+           sizeof(Vertex) * p_vertices.size());
+  }
+  memcpy(staging.indices, p_indices.data(),
+         sizeof(uint32_t) * p_indices.size());
+  return commit_mesh(staging);
+}
+
+bool CuMeshRegistry::reserve_mesh(uint32_t p_vertex_count,
+                                  uint32_t p_index_count,
+                                  MeshStaging &out_staging,
+                                  VertexFormat p_format /*= FLOAT*/) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device || !is_ready() || p_vertex_count == 0 || p_index_count == 0 ||
+      p_format >= VERTEX_FORMAT_COUNT) {
+    ENGINE_ERROR("Can't add an empty mesh or one without mesh buffers");
+    return false;
+  }
+
+  MeshInfo &mesh = out_staging.mesh;
+  mesh.vertex_count = p_vertex_count;
+  mesh.index_count = p_index_count;
+  mesh.format = p_format;
+  mesh.first_vertex = allocate(
+      vertex_buffers[p_format], free_vertices[p_format],
+      vertex_capacities[p_format], get_vertex_size(p_format),
+      VERTEX_BUFFER_USAGE, mesh.vertex_count);
+  if (mesh.first_vertex == UINT32_MAX) {
+    ENGINE_ERROR("Mesh buffers can't grow to fit {} more vertices, they "
+                 "hold {} already",
+                 mesh.vertex_count, vertex_capacities[p_format]);
+    return false;
+  }
+  mesh.first_index =
+      allocate(index_buffer, free_indices, index_capacity, sizeof(uint32_t),
+               INDEX_BUFFER_USAGE, mesh.index_count);
+  if (mesh.first_index == UINT32_MAX) {
+    free_vertices[p_format].free(mesh.first_vertex, mesh.vertex_count);
+    ENGINE_ERROR("Mesh buffers can't grow to fit {} more indices, they "
+                 "hold {} already",
+                 mesh.index_count, index_capacity);
+    return false;
+  }
+
+  UploadManager &upload_manager = device->get_upload_manager();
+  out_staging.vertex_region =
+      upload_manager.reserve(get_vertex_size(p_format) * mesh.vertex_count);
+  out_staging.index_region =
+      upload_manager.reserve(sizeof(uint32_t) * mesh.index_count);
+  void *vertices = out_staging.vertex_region.data;
+  if (p_format == VERTEX_FORMAT_COMPRESSED) {
+    out_staging.compressed_vertices = static_cast<CompressedVertex *>(vertices);
+  } else {
+    out_staging.vertices = static_cast<Vertex *>(vertices);
+  }
+  out_staging.indices = static_cast<uint32_t *>(out_staging.index_region.data);
+  if (!vertices || !out_staging.indices) {
+    ENGINE_ERROR("Failed to get staging memory for a mesh");
+    cancel_mesh(out_staging);
+    return false;
+  }
+  return true;
+}
+
+void CuMeshRegistry::cancel_mesh(MeshStaging &p_staging) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device) {
+    return;
+  }
+  UploadManager &upload_manager = device->get_upload_manager();
+  upload_manager.cancel(p_staging.vertex_region);
+  upload_manager.cancel(p_staging.index_region);
+  // nothing was uploaded, the ranges can be reused right away
+  const MeshInfo &mesh = p_staging.mesh;
+  if (mesh.vertex_count > 0) {
+    free_vertices[mesh.format].free(mesh.first_vertex, mesh.vertex_count);
+  }
+  if (mesh.index_count > 0) {
+    free_indices.free(mesh.first_index, mesh.index_count);
+  }
+  p_staging = {};
+}
+
+uint32_t CuMeshRegistry::commit_mesh(MeshStaging &p_staging) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device || !p_staging.indices) {
+    return INVALID_MESH;
+  }
+  MeshInfo mesh = p_staging.mesh;
+  mesh.bounds = p_staging.bounds;
+  mesh.alive = true;
+
+  // the copies run on the transfer queue, frames wait for them on the GPU
+  UploadManager &upload_manager = device->get_upload_manager();
+  upload_manager.commit(p_staging.vertex_region, vertex_buffers[mesh.format],
+                        get_vertex_size(mesh.format) * mesh.first_vertex);
+  upload_manager.commit(p_staging.index_region, index_buffer,
+                        sizeof(uint32_t) * mesh.first_index);
+  p_staging = {};
+
+  meshes.push_back(mesh);
+  return meshes.size() - 1;
+}
+
+void CuMeshRegistry::remove_mesh(uint32_t p_mesh_id) {
+  if (!is_valid(p_mesh_id)) {
+    return;
+  }
+  MeshInfo &mesh = meshes[p_mesh_id];
+  mesh.alive = false;
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device) {
+    return;
+  }
+  // frames in flight may still draw the old contents
+  device->queue_frame_deletion([this, mesh]() {
+    free_vertices[mesh.format].free(mesh.first_vertex, mesh.vertex_count);
+    free_indices.free(mesh.first_index, mesh.index_count);
+  });
+}
+
+void CuMeshRegistry::bind(VertexFormat p_format /*= FLOAT*/) const {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (!device || !is_ready()) {
+    return;
+  }
+  device->bind_vertex_buffer(0, 1, {vertex_buffers[p_format]}, {0});
+  device->bind_index_buffer(index_buffer, 0, true);
+}
+
+void CuMeshRegistry::clear() {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  if (device) {
+    for (Buffer &vertex_buffer : vertex_buffers) {
+      device->clear_buffer(vertex_buffer);
+    }
+    device->clear_buffer(index_buffer);
+  }
+  std::fill(std::begin(vertex_buffers), std::end(vertex_buffers), Buffer{});
+  std::fill(std::begin(vertex_capacities), std::end(vertex_capacities), 0);
+  index_buffer = {};
+  index_capacity = 0;
+  meshes.clear();
+}
+
+std::vector<VkFormat>
+CuMeshRegistry::get_vertex_input_formats(VertexFormat p_format) {
+  if (p_format == VERTEX_FORMAT_COMPRESSED) {
+    return {VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16_SNORM};
+  }
+  return {VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT};
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "aabb_tree.h"
+#include "render_device/upload_manager.h"
+#include "render_device/utils.h"
+#include <cstdint>
+#include <glm.hpp>
+#include <utility>
+#include <vector>
+
+struct Vertex {
+  glm::vec3 position;
+  glm::vec3 normals;
+};
+
+enum VertexFormat : uint32_t {
+  // Vertex
+  VERTEX_FORMAT_FLOAT,
+  // CompressedVertex
+  VERTEX_FORMAT_COMPRESSED,
+  VERTEX_FORMAT_COUNT,
+};
+
+/**
+half the size of Vertex. Positions are 16 bit unorm within the mesh's
+bounds, w is unused. Normals are octahedral encoded as 16 bit snorm.
+ */
+struct CompressedVertex {
+  uint16_t position[4];
+  int16_t normal[2];
+};
+
+/**
+push constants of vertex shaders reading compressed vertices, a position
+is bounds_min + position * bounds_extent.
+ */
+struct MeshBoundsConstants {
+  glm::vec4 bounds_min;
+  glm::vec4 bounds_extent;
+};
+
+CompressedVertex compress_vertex(const Vertex &p_vertex, const AABB &p_bounds);
+
+struct MeshInfo {
+  uint32_t first_vertex = 0;
+  uint32_t vertex_count = 0;
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+  VertexFormat format = VERTEX_FORMAT_FLOAT;
+  // local space
+  AABB bounds = {};
+  bool alive = false;
+
+  MeshBoundsConstants get_bounds_constants() const {
+    return {glm::vec4(bounds.min, 0.0f),
+            glm::vec4(bounds.max - bounds.min, 0.0f)};
+  }
+};
+
+/**
+instances of one mesh that lie next to each other in the instance data.
+ */
+struct MeshBatch {
+  uint32_t mesh_id = 0;
+  uint32_t first_instance = 0;
+  uint32_t instance_count = 0;
+};
+
+/**
+staging memory of a mesh that's being added, see
+CuMeshRegistry::reserve_mesh().
+ */
+struct MeshStaging {
+  // only the pointer of the mesh's format is set
+  Vertex *vertices = nullptr;
+  CompressedVertex *compressed_vertices = nullptr;
+  uint32_t *indices = nullptr;
+  // has to be filled in by whoever writes the vertices. Compressed vertices
+  // are quantized against it, so it has to be known before they're written
+  AABB bounds = {};
+  MeshInfo mesh = {};
+  StagingRegion vertex_region = {};
+  StagingRegion index_region = {};
+};
+
+/**
+Keeps the geometry of every mesh in one device local vertex buffer per
+vertex format and one index buffer, so draws of meshes with the same format
+don't need to rebind anything. Ranges of removed meshes are reused by later
+ones. Buffers that run out of space are replaced with bigger ones, the old
+contents are copied over on the transfer queue.
+ */
+class CuMeshRegistry {
+public:
+  /**
+   initial capacities, the buffers grow when meshes need more.
+   */
+  void init(uint32_t p_vertex_capacity = 1 << 20,
+            uint32_t p_index_capacity = 1 << 22);
+  /**
+   uploads the mesh and returns its id. Returns INVALID_MESH if the shared
+   buffers are out of space.
+   */
+  uint32_t add_mesh(const std::vector<Vertex> &p_vertices,
+                    const std::vector<uint32_t> &p_indices,
+                    VertexFormat p_format = VERTEX_FORMAT_FLOAT);
+  /**
+   allocates room for a mesh and hands out staging memory to write its
+   vertices and indices into, which saves a copy for big meshes. Indices are
+   relative to the mesh's first vertex. Every successful reserve has to be
+   followed by commit_mesh() soon, uploads wait while staging is open.
+   */
+  bool reserve_mesh(uint32_t p_vertex_count, uint32_t p_index_count,
+                    MeshStaging &out_staging,
+                    VertexFormat p_format = VERTEX_FORMAT_FLOAT);
+  /**
+   uploads a reserved mesh and returns its id.
+   */
+  uint32_t commit_mesh(MeshStaging &p_staging);
+  /**
+   gives back what reserve_mesh() took, for imports that fail halfway.
+   */
+  void cancel_mesh(MeshStaging &p_staging);
+  /**
+   the mesh's ranges get reused once the frames in flight are done with them.
+   */
+  void remove_mesh(uint32_t p_mesh_id);
+  bool is_valid(uint32_t p_mesh_id) const {
+    return p_mesh_id < meshes.size() && meshes[p_mesh_id].alive;
+  }
+  const MeshInfo &get_mesh(uint32_t p_mesh_id) const {
+    return meshes[p_mesh_id];
+  }
+  uint32_t get_mesh_count() const { return meshes.size(); }
+  /**
+   binds the shared buffers of p_format for the following draws.
+   */
+  void bind(VertexFormat p_format = VERTEX_FORMAT_FLOAT) const;
+  bool is_ready() const { return index_buffer.buffer != VK_NULL_HANDLE; }
+  /**
+   vertex input formats of pipelines drawing p_format, in location order.
+   */
+  static std::vector<VkFormat> get_vertex_input_formats(VertexFormat p_format);
+  void clear();
+
+  static const uint32_t INVALID_MESH = UINT32_MAX;
+
+private:
+  // first fit allocator over element ranges of a shared buffer
+  struct FreeRanges {
+    // offset and count, sorted by offset
+    std::vector<std::pair<uint32_t, uint32_t>> ranges = {};
+    void init(uint32_t p_capacity);
+    uint32_t allocate(uint32_t p_count);
+    void free(uint32_t p_offset, uint32_t p_count);
+  };
+  /**
+   allocates p_count elements from p_ranges, growing p_buffer when they
+   don't fit.
+   */
+  uint32_t allocate(Buffer &p_buffer, FreeRanges &p_ranges,
+                    uint32_t &p_capacity, VkDeviceSize p_element_size,
+                    VkBufferUsageFlags p_usage, uint32_t p_count);
+
+  Buffer vertex_buffers[VERTEX_FORMAT_COUNT] = {};
+  Buffer index_buffer = {};
+  FreeRanges free_vertices[VERTEX_FORMAT_COUNT];
+  FreeRanges free_indices;
+  uint32_t vertex_capacities[VERTEX_FORMAT_COUNT] = {};
+  uint32_t index_capacity = 0;
+  std::vector<MeshInfo> meshes = {};
+};
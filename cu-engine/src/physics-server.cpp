@@ -1,5 +1,6 @@
 #include "physics-server.h"
 #include "logger.h"
+#include "profiler.h"
 
 #include "LinearMath/btVector3.h"
 
@@ -101,10 +102,12 @@ void step_simulation(btDiscreteDynamicsWorld *p_dynamic_world, double p_delta) {
     return;
   }
   std::lock_guard<std::mutex> guard(physics->get_physics_mutex());
+  CU_PROFILE_SCOPE("stepSimulation");
   p_dynamic_world->stepSimulation(p_delta);
 }
 
 void CuPhysicsServer::update_physics(double p_delta) {
+  CU_PROFILE_SCOPE("CuPhysicsServer::update_physics");
   if (!dynamic_world) {
     ENGINE_WARN("No dynamic world setup. Can't update physics");
     return;
@@ -0,0 +1,90 @@
+#include "profiler.h"
+
+#ifdef CU_ENABLE_PROFILER
+
+#include "logger.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+std::mutex CuProfiler::buffers_mutex;
+std::vector<std::unique_ptr<CuProfileThreadBuffer>> CuProfiler::buffers;
+std::mutex CuProfiler::names_mutex;
+std::unordered_set<std::string> CuProfiler::names;
+
+const std::chrono::steady_clock::time_point profiler_start =
+    std::chrono::steady_clock::now();
+
+uint64_t CuProfiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - profiler_start)
+      .count();
+}
+
+CuProfileThreadBuffer &CuProfiler::get_thread_buffer() {
+  // registering happens once per thread, recording never locks
+  thread_local CuProfileThreadBuffer *thread_buffer = nullptr;
+  if (!thread_buffer) {
+    std::lock_guard<std::mutex> guard(buffers_mutex);
+    buffers.push_back(std::make_unique<CuProfileThreadBuffer>());
+    thread_buffer = buffers.back().get();
+    thread_buffer->thread_id = buffers.size() - 1;
+  }
+  return *thread_buffer;
+}
+
+const char *CuProfiler::intern(const std::string &p_name) {
+  // set nodes never move, so the pointer stays valid
+  std::lock_guard<std::mutex> guard(names_mutex);
+  return names.insert(p_name).first->c_str();
+}
+
+void CuProfiler::record(const char *p_name, uint64_t p_begin, uint64_t p_end) {
+  CuProfileThreadBuffer &buffer = get_thread_buffer();
+  const uint64_t index = buffer.count.load(std::memory_order_relaxed);
+  buffer.events[index % CuProfileThreadBuffer::CAPACITY] = {p_name, p_begin,
+                                                            p_end};
+  buffer.count.store(index + 1, std::memory_order_release);
+}
+
+bool CuProfiler::export_chrome_trace(const std::string &p_path) {
+  std::ofstream file(p_path, std::ios::trunc);
+  if (!file.is_open()) {
+    ENGINE_WARN("Can't write profiler trace to {}", p_path);
+    return false;
+  }
+
+  // timestamps are in microseconds, keep the nanoseconds
+  file << std::fixed << std::setprecision(3);
+  file << "{\"traceEvents\":[";
+  bool first = true;
+  size_t event_count = 0;
+  std::lock_guard<std::mutex> guard(buffers_mutex);
+  for (const std::unique_ptr<CuProfileThreadBuffer> &buffer : buffers) {
+    const uint64_t count = buffer->count.load(std::memory_order_acquire);
+    // the oldest events may get overwritten while exporting, leave them out
+    const uint64_t margin = CuProfileThreadBuffer::CAPACITY / 16;
+    const uint64_t start =
+        count > CuProfileThreadBuffer::CAPACITY - margin
+            ? count - (CuProfileThreadBuffer::CAPACITY - margin)
+            : 0;
+    for (uint64_t i = start; i < count; ++i) {
+      const CuProfileEvent &event =
+          buffer->events[i % CuProfileThreadBuffer::CAPACITY];
+      if (!first) {
+        file << ",";
+      }
+      first = false;
+      file << "{\"name\":\"" << event.name
+           << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->thread_id
+           << ",\"ts\":" << event.begin / 1000.0
+           << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+      event_count++;
+    }
+  }
+  file << "],\"displayTimeUnit\":\"ms\"}\n";
+  ENGINE_INFO("Wrote {} profiler zones to {}", event_count, p_path);
+  return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+
+/**
+CU_PROFILE_SCOPE("name") measures the enclosing scope on the CPU. Names have
+to be string literals, CU_PROFILE_SCOPE_NAMED(std_string) takes names built
+at runtime and keeps a copy of each. Zones are kept per thread and can be exported as a
+Chrome trace (chrome://tracing or ui.perfetto.dev).
+Without CU_ENABLE_PROFILER the macros expand to nothing.
+ */
+#ifdef CU_ENABLE_PROFILER
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#define CU_PROFILE_CONCAT_INNER(a, b) a##b
+#define CU_PROFILE_CONCAT(a, b) CU_PROFILE_CONCAT_INNER(a, b)
+#define CU_PROFILE_SCOPE(name)                                                 \
+  CuProfileScope CU_PROFILE_CONCAT(cu_profile_scope_, __LINE__)(name)
+#define CU_PROFILE_FUNCTION() CU_PROFILE_SCOPE(__func__)
+#define CU_PROFILE_SCOPE_NAMED(name)                                           \
+  CU_PROFILE_SCOPE(CuProfiler::intern(name))
+
+struct CuProfileEvent {
+  const char *name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+/**
+ring of the latest zones of one thread. Only the owning thread writes to it,
+exporting reads up to the published count.
+ */
+struct CuProfileThreadBuffer {
+  static const uint32_t CAPACITY = 1 << 16;
+  std::unique_ptr<CuProfileEvent[]> events =
+      std::make_unique<CuProfileEvent[]>(CAPACITY);
+  std::atomic<uint64_t> count = 0;
+  uint32_t thread_id = 0;
+};
+
+class CuProfiler {
+public:
+  /**
+   nanoseconds since the profiler started.
+   */
+  static uint64_t now();
+  static void record(const char *p_name, uint64_t p_begin, uint64_t p_end);
+  /**
+   returns a copy of p_name that lives as long as the profiler.
+   */
+  static const char *intern(const std::string &p_name);
+  /**
+   writes the recorded zones of every thread as Chrome trace JSON.
+   */
+  static bool export_chrome_trace(const std::string &p_path);
+
+private:
+  static CuProfileThreadBuffer &get_thread_buffer();
+
+  static std::mutex buffers_mutex;
+  static std::vector<std::unique_ptr<CuProfileThreadBuffer>> buffers;
+  static std::mutex names_mutex;
+  static std::unordered_set<std::string> names;
+};
+
+class CuProfileScope {
+public:
+  CuProfileScope(const char *p_name) : name(p_name), begin(CuProfiler::now()) {}
+  ~CuProfileScope() { CuProfiler::record(name, begin, CuProfiler::now()); }
+
+private:
+  const char *name;
+  uint64_t begin;
+};
+
+#else
+
+#define CU_PROFILE_SCOPE(name)
+#define CU_PROFILE_FUNCTION()
+#define CU_PROFILE_SCOPE_NAMED(name)
+
+class CuProfiler {
+public:
+  static bool export_chrome_trace(const std::string &) { return false; }
+};
+
+#endif
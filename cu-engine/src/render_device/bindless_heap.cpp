@@ -0,0 +1,212 @@
+#include "bindless_heap.h"
+#include "render_device.h"
+#include <algorithm>
+
+// descriptors the per-stage limits have to leave for a pipeline's other sets
+const uint32_t RESERVED_DESCRIPTORS = 64;
+
+const VkDescriptorType BINDLESS_DESCRIPTOR_TYPES[BINDLESS_TYPE_COUNT] = {
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    VK_DESCRIPTOR_TYPE_SAMPLER};
+
+static uint32_t clamp_capacity(uint32_t p_capacity, uint32_t p_set_limit,
+                               uint32_t p_stage_limit) {
+  const uint32_t stage_limit = p_stage_limit > RESERVED_DESCRIPTORS
+                                   ? p_stage_limit - RESERVED_DESCRIPTORS
+                                   : 0;
+  return std::min({p_capacity, p_set_limit, stage_limit});
+}
+
+bool BindlessHeap::init(VkDevice p_device, VkPhysicalDevice p_physical_device,
+                        uint32_t p_buffer_capacity /*= 16384*/,
+                        uint32_t p_image_capacity /*= 16384*/,
+                        uint32_t p_sampler_capacity /*= 256*/) {
+  device = p_device;
+
+  VkPhysicalDeviceDescriptorIndexingProperties indexing_properties = {};
+  indexing_properties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties = {};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &indexing_properties;
+  vkGetPhysicalDeviceProperties2(p_physical_device, &properties);
+
+  slots[BINDLESS_STORAGE_BUFFER].capacity = clamp_capacity(
+      p_buffer_capacity,
+      indexing_properties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+      indexing_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+  slots[BINDLESS_SAMPLED_IMAGE].capacity = clamp_capacity(
+      p_image_capacity,
+      indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+      indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages);
+  slots[BINDLESS_SAMPLER].capacity = clamp_capacity(
+      p_sampler_capacity,
+      indexing_properties.maxDescriptorSetUpdateAfterBindSamplers,
+      indexing_properties.maxPerStageDescriptorUpdateAfterBindSamplers);
+
+  VkDescriptorSetLayoutBinding bindings[BINDLESS_TYPE_COUNT] = {};
+  VkDescriptorBindingFlags binding_flags[BINDLESS_TYPE_COUNT] = {};
+  VkDescriptorPoolSize pool_sizes[BINDLESS_TYPE_COUNT] = {};
+  for (uint32_t i = 0; i < BINDLESS_TYPE_COUNT; ++i) {
+    if (slots[i].capacity == 0) {
+      ENGINE_WARN("Device has no room for bindless descriptors");
+      return false;
+    }
+    bindings[i].binding = i;
+    bindings[i].descriptorType = BINDLESS_DESCRIPTOR_TYPES[i];
+    bindings[i].descriptorCount = slots[i].capacity;
+    bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+    binding_flags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                       VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                       VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    pool_sizes[i].type = BINDLESS_DESCRIPTOR_TYPES[i];
+    pool_sizes[i].descriptorCount = slots[i].capacity;
+  }
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {};
+  flags_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  flags_info.bindingCount = BINDLESS_TYPE_COUNT;
+  flags_info.pBindingFlags = binding_flags;
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.pNext = &flags_info;
+  layout_info.flags =
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layout_info.bindingCount = BINDLESS_TYPE_COUNT;
+  layout_info.pBindings = bindings;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &layout));
+
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  pool_info.maxSets = 1;
+  pool_info.poolSizeCount = BINDLESS_TYPE_COUNT;
+  pool_info.pPoolSizes = pool_sizes;
+  VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &pool));
+
+  VkDescriptorSetAllocateInfo allocate_info = {};
+  allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocate_info.descriptorPool = pool;
+  allocate_info.descriptorSetCount = 1;
+  allocate_info.pSetLayouts = &layout;
+  VK_CHECK(vkAllocateDescriptorSets(device, &allocate_info, &set));
+
+  ENGINE_INFO("Bindless heap holds {} buffers, {} images and {} samplers",
+              slots[BINDLESS_STORAGE_BUFFER].capacity,
+              slots[BINDLESS_SAMPLED_IMAGE].capacity,
+              slots[BINDLESS_SAMPLER].capacity);
+  return true;
+}
+
+uint32_t BindlessHeap::add_buffer(const Buffer &p_buffer,
+                                  VkDeviceSize p_offset /*= 0*/,
+                                  VkDeviceSize p_range /*= VK_WHOLE_SIZE*/) {
+  VkDescriptorBufferInfo info = {};
+  info.buffer = p_buffer.buffer;
+  info.offset = p_offset;
+  info.range = p_range;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  const uint32_t index = allocate_slot(BINDLESS_STORAGE_BUFFER);
+  if (index != INVALID_INDEX) {
+    write(BINDLESS_STORAGE_BUFFER, index, &info, nullptr);
+  }
+  return index;
+}
+
+uint32_t BindlessHeap::add_texture(
+    const Texture &p_texture,
+    VkImageLayout p_layout /*= SHADER_READ_ONLY_OPTIMAL*/) {
+  VkDescriptorImageInfo info = {};
+  info.imageView = p_texture.view;
+  info.imageLayout = p_layout;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  const uint32_t index = allocate_slot(BINDLESS_SAMPLED_IMAGE);
+  if (index != INVALID_INDEX) {
+    write(BINDLESS_SAMPLED_IMAGE, index, nullptr, &info);
+  }
+  return index;
+}
+
+uint32_t BindlessHeap::add_sampler(VkSampler p_sampler) {
+  VkDescriptorImageInfo info = {};
+  info.sampler = p_sampler;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  const uint32_t index = allocate_slot(BINDLESS_SAMPLER);
+  if (index != INVALID_INDEX) {
+    write(BINDLESS_SAMPLER, index, nullptr, &info);
+  }
+  return index;
+}
+
+void BindlessHeap::remove(BindlessType p_type, uint32_t p_index) {
+  if (p_type >= BINDLESS_TYPE_COUNT || p_index >= slots[p_type].capacity) {
+    return;
+  }
+  CuRenderDevice *render_device = CuRenderDevice::get_singleton();
+  if (!render_device) {
+    return;
+  }
+  // the slot keeps its descriptor, partially bound arrays don't mind
+  render_device->queue_frame_deletion([this, p_type, p_index]() {
+    std::lock_guard<std::mutex> guard(mutex);
+    slots[p_type].free_list.push_back(p_index);
+  });
+}
+
+uint32_t BindlessHeap::get_used_count(BindlessType p_type) const {
+  std::lock_guard<std::mutex> guard(mutex);
+  return slots[p_type].next - slots[p_type].free_list.size();
+}
+
+void BindlessHeap::clear() {
+  if (pool != VK_NULL_HANDLE) {
+    vkDestroyDescriptorPool(device, pool, nullptr);
+  }
+  if (layout != VK_NULL_HANDLE) {
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+  }
+  pool = VK_NULL_HANDLE;
+  layout = VK_NULL_HANDLE;
+  set = VK_NULL_HANDLE;
+  for (Slots &type_slots : slots) {
+    type_slots = {};
+  }
+}
+
+uint32_t BindlessHeap::allocate_slot(BindlessType p_type) {
+  Slots &type_slots = slots[p_type];
+  if (set == VK_NULL_HANDLE) {
+    return INVALID_INDEX;
+  }
+  if (!type_slots.free_list.empty()) {
+    const uint32_t index = type_slots.free_list.back();
+    type_slots.free_list.pop_back();
+    return index;
+  }
+  if (type_slots.next >= type_slots.capacity) {
+    ENGINE_ERROR("Bindless heap is out of slots for {} descriptors",
+                 uint32_t(p_type));
+    return INVALID_INDEX;
+  }
+  return type_slots.next++;
+}
+
+void BindlessHeap::write(BindlessType p_type, uint32_t p_index,
+                         const VkDescriptorBufferInfo *p_buffer_info,
+                         const VkDescriptorImageInfo *p_image_info) {
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set;
+  write.dstBinding = p_type;
+  write.dstArrayElement = p_index;
+  write.descriptorCount = 1;
+  write.descriptorType = BINDLESS_DESCRIPTOR_TYPES[p_type];
+  write.pBufferInfo = p_buffer_info;
+  write.pImageInfo = p_image_info;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include "utils.h"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+enum BindlessType : uint32_t {
+  // binding 0, readonly buffer arrays
+  BINDLESS_STORAGE_BUFFER,
+  // binding 1, texture2D arrays
+  BINDLESS_SAMPLED_IMAGE,
+  // binding 2, sampler arrays
+  BINDLESS_SAMPLER,
+  BINDLESS_TYPE_COUNT,
+};
+
+// set number shaders declare the heap's arrays in
+const uint32_t BINDLESS_SET = 2;
+
+/**
+One global descriptor set with large update-after-bind arrays of storage
+buffers, sampled images and samplers. Resources are registered once and
+shaders reach them through the returned index, usually passed in a push
+constant, so switching materials or meshes needs no set allocation and no
+vkCmdBindDescriptorSets. Slots may be written while command buffers using
+the set are pending, as long as those don't read the slot.
+ */
+class BindlessHeap {
+public:
+  /**
+   returns false when the device can't hold the arrays. Capacities are
+   clamped to the device's update-after-bind limits.
+   */
+  bool init(VkDevice p_device, VkPhysicalDevice p_physical_device,
+            uint32_t p_buffer_capacity = 16384,
+            uint32_t p_image_capacity = 16384,
+            uint32_t p_sampler_capacity = 256);
+  /**
+   returns the buffer's slot, or INVALID_INDEX if the heap is full.
+   */
+  uint32_t add_buffer(const Buffer &p_buffer, VkDeviceSize p_offset = 0,
+                      VkDeviceSize p_range = VK_WHOLE_SIZE);
+  uint32_t add_texture(const Texture &p_texture,
+                       VkImageLayout p_layout =
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  uint32_t add_sampler(VkSampler p_sampler);
+  /**
+   the slot is handed out again once the frames in flight are done with it.
+   */
+  void remove(BindlessType p_type, uint32_t p_index);
+  void clear();
+
+  bool is_ready() const { return set != VK_NULL_HANDLE; }
+  VkDescriptorSetLayout get_layout() const { return layout; }
+  VkDescriptorSet get_set() const { return set; }
+  uint32_t get_capacity(BindlessType p_type) const {
+    return slots[p_type].capacity;
+  }
+  uint32_t get_used_count(BindlessType p_type) const;
+
+  static const uint32_t INVALID_INDEX = UINT32_MAX;
+
+private:
+  struct Slots {
+    uint32_t capacity = 0;
+    // slots below next have been handed out at least once
+    uint32_t next = 0;
+    std::vector<uint32_t> free_list = {};
+  };
+
+  uint32_t allocate_slot(BindlessType p_type);
+  void write(BindlessType p_type, uint32_t p_index,
+             const VkDescriptorBufferInfo *p_buffer_info,
+             const VkDescriptorImageInfo *p_image_info);
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  Slots slots[BINDLESS_TYPE_COUNT];
+  // guards the slots and the set, which needs external synchronisation
+  mutable std::mutex mutex;
+};
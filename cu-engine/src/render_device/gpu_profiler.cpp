@@ -0,0 +1,161 @@
+#include "gpu_profiler.h"
+#include "utils.h"
+#include <cstdlib>
+
+void GpuProfiler::init(VkDevice p_device, VkPhysicalDevice p_physical_device,
+                       uint32_t p_queue_family, uint32_t p_frame_count,
+                       uint32_t p_max_zones /*= 32*/) {
+  device = p_device;
+  max_zones = p_max_zones;
+
+  VkPhysicalDeviceProperties properties = {};
+  vkGetPhysicalDeviceProperties(p_physical_device, &properties);
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(p_physical_device, &family_count,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(p_physical_device, &family_count,
+                                           families.data());
+  const uint32_t valid_bits = p_queue_family < family_count
+                                  ? families[p_queue_family].timestampValidBits
+                                  : 0;
+  supported = valid_bits > 0 && properties.limits.timestampPeriod > 0.0f;
+  if (!supported) {
+    ENGINE_WARN("GPU timestamps aren't supported on this queue, GPU "
+                "profiling is disabled");
+    return;
+  }
+  timestamp_period = properties.limits.timestampPeriod;
+  timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+  frames.resize(p_frame_count);
+  for (FrameQueries &frame : frames) {
+    VkQueryPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = max_zones * 2;
+    VK_CHECK(vkCreateQueryPool(device, &pool_info, nullptr, &frame.pool));
+  }
+
+  const char *csv_path = std::getenv("CU_GPU_PROFILE_CSV");
+  if (csv_path) {
+    csv_file.open(csv_path, std::ios::trunc);
+    if (csv_file.is_open()) {
+      csv_file << "frame,zone,milliseconds\n";
+    } else {
+      ENGINE_WARN("Can't open {} for GPU profiling output", csv_path);
+    }
+  }
+}
+
+void GpuProfiler::resolve(uint32_t p_frame) {
+  if (!supported || p_frame >= frames.size()) {
+    return;
+  }
+  FrameQueries &frame = frames[p_frame];
+  if (frame.zones.empty()) {
+    return;
+  }
+
+  // every query is followed by its availability
+  std::vector<uint64_t> results(frame.zones.size() * 4);
+  const VkResult result = vkGetQueryPoolResults(
+      device, frame.pool, 0, frame.zones.size() * 2,
+      results.size() * sizeof(uint64_t), results.data(), sizeof(uint64_t) * 2,
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (result != VK_SUCCESS && result != VK_NOT_READY) {
+    ENGINE_WARN("Failed to read GPU timestamps");
+    frame.zones.clear();
+    return;
+  }
+
+  timings.clear();
+  for (size_t i = 0; i < frame.zones.size(); ++i) {
+    const uint64_t *begin = &results[i * 4];
+    const uint64_t *end = &results[i * 4 + 2];
+    if (begin[1] == 0 || end[1] == 0) {
+      continue;
+    }
+    const uint64_t ticks = (end[0] - begin[0]) & timestamp_mask;
+    const double milliseconds = ticks * timestamp_period / 1000000.0;
+
+    ZoneHistory &zone_history = history[frame.zones[i]];
+    zone_history.samples[zone_history.next] = milliseconds;
+    zone_history.next = (zone_history.next + 1) % GPU_PROFILER_HISTORY;
+    if (zone_history.count < GPU_PROFILER_HISTORY) {
+      zone_history.count++;
+    }
+    double total = 0.0;
+    for (uint32_t j = 0; j < zone_history.count; ++j) {
+      total += zone_history.samples[j];
+    }
+
+    GpuZoneTiming timing = {};
+    timing.name = frame.zones[i];
+    timing.milliseconds = milliseconds;
+    timing.average_milliseconds = total / zone_history.count;
+    timings.push_back(timing);
+
+    if (csv_file.is_open()) {
+      csv_file << frame.frame_number << "," << timing.name << ","
+               << milliseconds << "\n";
+    }
+  }
+  frame.zones.clear();
+}
+
+void GpuProfiler::reset(VkCommandBuffer p_cmb, uint32_t p_frame) {
+  if (!supported || p_frame >= frames.size()) {
+    return;
+  }
+  FrameQueries &frame = frames[p_frame];
+  vkCmdResetQueryPool(p_cmb, frame.pool, 0, max_zones * 2);
+  frame.zones.clear();
+  frame.frame_number = frame_number++;
+}
+
+uint32_t GpuProfiler::begin_zone(VkCommandBuffer p_cmb, uint32_t p_frame,
+                                 const std::string &p_name) {
+  if (!supported || p_frame >= frames.size()) {
+    return UINT32_MAX;
+  }
+  FrameQueries &frame = frames[p_frame];
+  if (frame.zones.size() >= max_zones) {
+    return UINT32_MAX;
+  }
+  const uint32_t zone = frame.zones.size();
+  frame.zones.push_back(p_name);
+  vkCmdWriteTimestamp2KHR(p_cmb, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                          frame.pool, zone * 2);
+  return zone;
+}
+
+void GpuProfiler::end_zone(VkCommandBuffer p_cmb, uint32_t p_frame,
+                           uint32_t p_zone) {
+  if (!supported || p_frame >= frames.size() ||
+      p_zone >= frames[p_frame].zones.size()) {
+    return;
+  }
+  vkCmdWriteTimestamp2KHR(p_cmb, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                          frames[p_frame].pool, p_zone * 2 + 1);
+}
+
+void GpuProfiler::clear() {
+  for (FrameQueries &frame : frames) {
+    vkDestroyQueryPool(device, frame.pool, nullptr);
+  }
+  frames.clear();
+  if (csv_file.is_open()) {
+    csv_file.close();
+  }
+}
+
+double GpuProfiler::get_time(const std::string &p_name) const {
+  for (const GpuZoneTiming &timing : timings) {
+    if (timing.name == p_name) {
+      return timing.milliseconds;
+    }
+  }
+  return 0.0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <array>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct GpuZoneTiming {
+  std::string name;
+  // time of the most recent frame that got resolved
+  double milliseconds = 0.0;
+  // average over the last GPU_PROFILER_HISTORY resolved frames
+  double average_milliseconds = 0.0;
+};
+
+const uint32_t GPU_PROFILER_HISTORY = 64;
+
+/**
+Measures GPU time of named zones with timestamp queries. Every frame in
+flight has its own query pool which is read back once its fence signalled,
+so results lag behind by the number of frames in flight and reading them
+never stalls.
+Set CU_GPU_PROFILE_CSV to a file path to log every resolved frame.
+ */
+class GpuProfiler {
+public:
+  void init(VkDevice p_device, VkPhysicalDevice p_physical_device,
+            uint32_t p_queue_family, uint32_t p_frame_count,
+            uint32_t p_max_zones = 32);
+  /**
+   reads the results of p_frame. Call it once the frame's fence signalled.
+   */
+  void resolve(uint32_t p_frame);
+  /**
+   resets the queries of p_frame, p_cmb has to be the frame's command buffer.
+   */
+  void reset(VkCommandBuffer p_cmb, uint32_t p_frame);
+  /**
+   returns the zone index that has to be passed to end_zone(). Zones can
+   nest but can't be written inside a rendering with secondary contents.
+   */
+  uint32_t begin_zone(VkCommandBuffer p_cmb, uint32_t p_frame,
+                      const std::string &p_name);
+  void end_zone(VkCommandBuffer p_cmb, uint32_t p_frame, uint32_t p_zone);
+  void clear();
+
+  const std::vector<GpuZoneTiming> &get_timings() const { return timings; }
+  /**
+   latest time of the zone called p_name, 0 when it hasn't been resolved yet.
+   */
+  double get_time(const std::string &p_name) const;
+  bool is_supported() const { return supported; }
+
+private:
+  struct FrameQueries {
+    VkQueryPool pool = VK_NULL_HANDLE;
+    std::vector<std::string> zones = {};
+    uint64_t frame_number = 0;
+  };
+
+  struct ZoneHistory {
+    std::array<double, GPU_PROFILER_HISTORY> samples = {};
+    uint32_t count = 0;
+    uint32_t next = 0;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  bool supported = false;
+  double timestamp_period = 1.0;
+  uint64_t timestamp_mask = ~0ull;
+  uint32_t max_zones = 0;
+  uint64_t frame_number = 0;
+  std::vector<FrameQueries> frames;
+  std::vector<GpuZoneTiming> timings;
+  std::unordered_map<std::string, ZoneHistory> history;
+  std::ofstream csv_file;
+};
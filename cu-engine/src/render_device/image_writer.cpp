@@ -0,0 +1,195 @@
+#include "image_writer.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtc/packing.hpp>
+
+static uint8_t to_unorm8(float p_value) {
+  return (uint8_t)(std::clamp(p_value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+bool convert_to_rgba8(const TextureReadback &p_readback,
+                      std::vector<uint8_t> &out_pixels) {
+  const size_t pixel_count =
+      (size_t)p_readback.extent.width * p_readback.extent.height;
+  out_pixels.resize(pixel_count * 4);
+  const uint8_t *source = p_readback.pixels.data();
+
+  switch (p_readback.format) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+    memcpy(out_pixels.data(), source, pixel_count * 4);
+    return true;
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+    for (size_t i = 0; i < pixel_count; ++i) {
+      out_pixels[i * 4 + 0] = source[i * 4 + 2];
+      out_pixels[i * 4 + 1] = source[i * 4 + 1];
+      out_pixels[i * 4 + 2] = source[i * 4 + 0];
+      out_pixels[i * 4 + 3] = source[i * 4 + 3];
+    }
+    return true;
+  case VK_FORMAT_R16G16B16A16_SFLOAT: {
+    const uint16_t *halfs = reinterpret_cast<const uint16_t *>(source);
+    for (size_t i = 0; i < pixel_count * 4; ++i) {
+      out_pixels[i] = to_unorm8(glm::unpackHalf1x16(halfs[i]));
+    }
+    return true;
+  }
+  case VK_FORMAT_R32G32B32A32_SFLOAT: {
+    const float *floats = reinterpret_cast<const float *>(source);
+    for (size_t i = 0; i < pixel_count * 4; ++i) {
+      out_pixels[i] = to_unorm8(floats[i]);
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+static uint32_t crc32(const uint8_t *p_data, size_t p_size) {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> result = {};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      result[i] = c;
+    }
+    return result;
+  }();
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < p_size; ++i) {
+    crc = table[(crc ^ p_data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void push_u32(std::vector<uint8_t> &p_out, uint32_t p_value) {
+  p_out.push_back(p_value >> 24);
+  p_out.push_back(p_value >> 16);
+  p_out.push_back(p_value >> 8);
+  p_out.push_back(p_value);
+}
+
+static void write_chunk(std::ofstream &p_file, const char *p_type,
+                        const std::vector<uint8_t> &p_data) {
+  std::vector<uint8_t> chunk = {};
+  push_u32(chunk, p_data.size());
+  chunk.insert(chunk.end(), p_type, p_type + 4);
+  chunk.insert(chunk.end(), p_data.begin(), p_data.end());
+  push_u32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+  p_file.write((const char *)chunk.data(), chunk.size());
+}
+
+// PNG with stored deflate blocks, fast to write and needs no zlib
+static bool write_png(const std::vector<uint8_t> &p_rgba, uint32_t p_width,
+                      uint32_t p_height, const std::string &p_path) {
+  std::ofstream file(p_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  file.write((const char *)signature, sizeof(signature));
+
+  std::vector<uint8_t> header = {};
+  push_u32(header, p_width);
+  push_u32(header, p_height);
+  // 8 bit RGBA, default compression, filtering and no interlacing
+  header.insert(header.end(), {8, 6, 0, 0, 0});
+  write_chunk(file, "IHDR", header);
+
+  // every row starts with filter type 0
+  const size_t row_size = (size_t)p_width * 4;
+  std::vector<uint8_t> raw((row_size + 1) * p_height);
+  for (uint32_t y = 0; y < p_height; ++y) {
+    raw[y * (row_size + 1)] = 0;
+    memcpy(&raw[y * (row_size + 1) + 1], &p_rgba[y * row_size], row_size);
+  }
+
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  const size_t max_block = 65535;
+  size_t offset = 0;
+  do {
+    const size_t size = std::min(max_block, raw.size() - offset);
+    const bool last = offset + size >= raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(size & 0xFF);
+    zlib.push_back(size >> 8);
+    zlib.push_back(~size & 0xFF);
+    zlib.push_back((~size >> 8) & 0xFF);
+    zlib.insert(zlib.end(), raw.begin() + offset,
+                raw.begin() + offset + size);
+    offset += size;
+  } while (offset < raw.size());
+  uint32_t a = 1, b = 0;
+  for (uint8_t byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  push_u32(zlib, (b << 16) | a);
+  write_chunk(file, "IDAT", zlib);
+  write_chunk(file, "IEND", {});
+  return file.good();
+}
+
+static bool write_ppm(const std::vector<uint8_t> &p_rgba, uint32_t p_width,
+                      uint32_t p_height, const std::string &p_path) {
+  std::ofstream file(p_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  file << "P6\n" << p_width << " " << p_height << "\n255\n";
+  std::vector<uint8_t> rgb((size_t)p_width * p_height * 3);
+  for (size_t i = 0; i < (size_t)p_width * p_height; ++i) {
+    rgb[i * 3 + 0] = p_rgba[i * 4 + 0];
+    rgb[i * 3 + 1] = p_rgba[i * 4 + 1];
+    rgb[i * 3 + 2] = p_rgba[i * 4 + 2];
+  }
+  file.write((const char *)rgb.data(), rgb.size());
+  return file.good();
+}
+
+bool write_image(const TextureReadback &p_readback, const std::string &p_path) {
+  std::vector<uint8_t> rgba = {};
+  if (!convert_to_rgba8(p_readback, rgba)) {
+    ENGINE_ERROR("Can't encode {}, unsupported format {}", p_path,
+                 string_VkFormat(p_readback.format));
+    return false;
+  }
+  const std::string extension =
+      std::filesystem::path(p_path).extension().string();
+  bool written = false;
+  if (extension == ".ppm") {
+    written = write_ppm(rgba, p_readback.extent.width, p_readback.extent.height,
+                        p_path);
+  } else {
+    written = write_png(rgba, p_readback.extent.width, p_readback.extent.height,
+                        p_path);
+  }
+  if (!written) {
+    ENGINE_ERROR("Failed to write {}", p_path);
+  }
+  return written;
+}
+
+std::future<bool> write_image_async(TextureReadback &&p_readback,
+                                    const std::string &p_path) {
+  std::function<bool()> encode = [readback = std::move(p_readback),
+                                  p_path]() {
+    return write_image(readback, p_path);
+  };
+  CuThreadPool *thread_pool = CuThreadPool::get_singleton();
+  if (thread_pool) {
+    return thread_pool->submit(std::move(encode));
+  }
+  std::promise<bool> result;
+  result.set_value(encode());
+  return result.get_future();
+}
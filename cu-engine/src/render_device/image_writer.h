@@ -0,0 +1,33 @@
+#pragma once
+
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+/**
+pixels copied back from a texture, rows are tightly packed.
+ */
+struct TextureReadback {
+  std::vector<uint8_t> pixels = {};
+  VkExtent3D extent = {};
+  VkFormat format = VK_FORMAT_UNDEFINED;
+};
+
+/**
+converts the readback to 8 bit RGBA. Handles 8 bit RGBA/BGRA, half and
+float formats, HDR values get clamped. Returns false for other formats.
+ */
+bool convert_to_rgba8(const TextureReadback &p_readback,
+                      std::vector<uint8_t> &out_pixels);
+/**
+writes the readback as .png or .ppm, picked by the file extension.
+ */
+bool write_image(const TextureReadback &p_readback, const std::string &p_path);
+/**
+encodes and writes on the thread pool, inline if there is none.
+ */
+std::future<bool> write_image_async(TextureReadback &&p_readback,
+                                    const std::string &p_path);
@@ -0,0 +1,123 @@
+#include "instance_buffer.h"
+
+void InstanceBuffer::init(
+    size_t p_stride, size_t p_initial_capacity /*= 1024*/,
+    VkBufferUsageFlags p_usage /*= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT*/,
+    VmaMemoryUsage p_memory_usage /*= VMA_MEMORY_USAGE_CPU_TO_GPU*/) {
+  device = CuRenderDevice::get_singleton();
+  if (!device) {
+    ENGINE_ERROR("Can't create instance buffer without a render device");
+    return;
+  }
+  stride = p_stride;
+  usage = p_usage;
+  memory_usage = p_memory_usage;
+  count = 0;
+  for (uint32_t i = 0; i < device->get_frame_overlap(); ++i) {
+    allocate(frames[i], p_initial_capacity > 0 ? p_initial_capacity : 1);
+  }
+}
+
+void InstanceBuffer::bind_to(const RenderPipeline &p_pipeline, uint32_t p_set,
+                             uint32_t p_binding) {
+  if (!device) {
+    return;
+  }
+  Binding binding = {};
+  binding.binding = p_binding;
+  for (uint32_t i = 0; i < device->get_frame_overlap(); ++i) {
+    binding.sets[i] = p_pipeline.get_set(i, p_set);
+  }
+  bindings.push_back(binding);
+  for (uint32_t i = 0; i < device->get_frame_overlap(); ++i) {
+    write_descriptor(i);
+  }
+}
+
+bool InstanceBuffer::reserve(size_t p_count) {
+  if (!device) {
+    return false;
+  }
+  count = p_count;
+  const int frame_idx = device->get_current_frame_index();
+  FrameCopy &frame = frames[frame_idx];
+  if (p_count <= frame.capacity) {
+    return false;
+  }
+
+  size_t new_capacity = frame.capacity;
+  while (new_capacity < p_count) {
+    new_capacity = new_capacity * 1.5 + 1;
+  }
+
+  // the GPU might still read the old copy, let it go once the frame is done
+  Buffer old_buffer = frame.buffer;
+  device->queue_frame_deletion(
+      [device = device, old_buffer]() { device->clear_buffer(old_buffer); });
+
+  allocate(frame, new_capacity);
+  write_descriptor(frame_idx);
+
+  ENGINE_INFO("Instance buffer grew to {} instances ({} KiB), {:.1f}% used",
+              new_capacity, (new_capacity * stride) / 1024,
+              get_utilisation() * 100.0f);
+  return true;
+}
+
+void *InstanceBuffer::map() {
+  if (!device) {
+    return nullptr;
+  }
+  return device->map_buffer(frames[device->get_current_frame_index()].buffer);
+}
+
+void InstanceBuffer::flush(size_t p_count) {
+  if (!device || p_count == 0) {
+    return;
+  }
+  device->flush_buffer(frames[device->get_current_frame_index()].buffer, 0,
+                       p_count * stride);
+}
+
+size_t InstanceBuffer::get_capacity() const {
+  if (!device) {
+    return 0;
+  }
+  return frames[device->get_current_frame_index()].capacity;
+}
+
+float InstanceBuffer::get_utilisation() const {
+  const size_t capacity = get_capacity();
+  return capacity > 0 ? static_cast<float>(count) / capacity : 0.0f;
+}
+
+void InstanceBuffer::clear() {
+  if (!device) {
+    return;
+  }
+  for (uint32_t i = 0; i < MAX_FRAME_OVERLAP; ++i) {
+    device->clear_buffer(frames[i].buffer);
+    frames[i] = {};
+  }
+  bindings.clear();
+  count = 0;
+}
+
+void InstanceBuffer::allocate(FrameCopy &p_frame, size_t p_capacity) {
+  p_frame.buffer = device->create_buffer(p_capacity * stride, usage,
+                                         memory_usage, MEMORY_INSTANCES);
+  p_frame.capacity = p_capacity;
+}
+
+void InstanceBuffer::write_descriptor(int p_frame) {
+  for (const Binding &binding : bindings) {
+    if (binding.sets[p_frame] == VK_NULL_HANDLE) {
+      continue;
+    }
+    DescriptorWriter writer;
+    writer.write_buffer(binding.binding, frames[p_frame].buffer, 0,
+                        frames[p_frame].capacity * stride,
+                        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.update_set(binding.sets[p_frame]);
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "render_device.h"
+
+/**
+Host visible storage buffer for per-instance data. Keeps one copy per frame
+in flight and grows geometrically when more instances are requested than it
+can hold. Replaced buffers are retired through the per-frame deletion queue.
+With VMA_MEMORY_USAGE_GPU_ONLY it holds data that only shaders write.
+ */
+class InstanceBuffer {
+public:
+  void init(size_t p_stride, size_t p_initial_capacity = 1024,
+            VkBufferUsageFlags p_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VmaMemoryUsage p_memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU);
+  /**
+   rewrites p_binding of set p_set whenever a frame copy gets reallocated.
+   Can be called for several pipelines.
+   */
+  void bind_to(const RenderPipeline &p_pipeline, uint32_t p_set,
+               uint32_t p_binding);
+  /**
+   makes sure the current frame's copy fits p_count instances. Returns true
+   if it had to be reallocated, its previous content is lost in that case.
+   */
+  bool reserve(size_t p_count);
+  /**
+   returns the persistent mapping of the current frame's copy.
+   */
+  void *map();
+  /**
+   flushes the first p_count instances of the current frame's copy.
+   */
+  void flush(size_t p_count);
+  void clear();
+
+  Buffer &get_buffer(int p_frame) { return frames[p_frame].buffer; }
+  size_t get_stride() const { return stride; }
+  size_t get_count() const { return count; }
+  /**
+   capacity, in instances, of the current frame's copy.
+   */
+  size_t get_capacity() const;
+  /**
+   ratio between used and allocated instances of the current frame's copy.
+   */
+  float get_utilisation() const;
+
+private:
+  struct FrameCopy {
+    Buffer buffer;
+    size_t capacity = 0;
+  };
+
+  void allocate(FrameCopy &p_frame, size_t p_capacity);
+  void write_descriptor(int p_frame);
+
+  CuRenderDevice *device = nullptr;
+  FrameCopy frames[MAX_FRAME_OVERLAP];
+  size_t stride = 0;
+  size_t count = 0;
+  VkBufferUsageFlags usage = 0;
+  VmaMemoryUsage memory_usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+  struct Binding {
+    VkDescriptorSet sets[MAX_FRAME_OVERLAP] = {};
+    uint32_t binding = 0;
+  };
+  std::vector<Binding> bindings = {};
+};
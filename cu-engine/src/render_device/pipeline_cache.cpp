@@ -0,0 +1,134 @@
+#include "pipeline_cache.h"
+#include "utils.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43555043; // "CUPC"
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+void PipelineCache::init(VkDevice p_device, VkPhysicalDevice p_physical_device,
+                         const std::string &p_path /*= "pipeline_cache.bin"*/) {
+  device = p_device;
+  path = p_path;
+  warm = false;
+
+  id_properties = {};
+  id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties2 = {};
+  properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties2.pNext = &id_properties;
+  vkGetPhysicalDeviceProperties2(p_physical_device, &properties2);
+  properties = properties2.properties;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<char> data = {};
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (file.is_open()) {
+    const size_t file_size = (size_t)file.tellg();
+    FileHeader header = {};
+    FileHeader expected = {};
+    fill_header(expected);
+    file.seekg(0);
+    if (file_size >= sizeof(FileHeader) &&
+        file.read((char *)&header, sizeof(FileHeader))) {
+      expected.data_size = header.data_size;
+      if (memcmp(&header, &expected, sizeof(FileHeader)) != 0 ||
+          header.data_size != file_size - sizeof(FileHeader)) {
+        ENGINE_WARN("Pipeline cache {} belongs to another GPU or driver. "
+                    "Ignoring it",
+                    path);
+      } else {
+        data.resize(header.data_size);
+        file.read(data.data(), data.size());
+      }
+    }
+  }
+
+  // the driver checks its own header too, but a bad blob is better skipped
+  if (data.size() >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+    VkPipelineCacheHeaderVersionOne vk_header = {};
+    memcpy(&vk_header, data.data(), sizeof(vk_header));
+    if (vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        vk_header.vendorID != properties.vendorID ||
+        vk_header.deviceID != properties.deviceID ||
+        memcmp(vk_header.pipelineCacheUUID, properties.pipelineCacheUUID,
+               VK_UUID_SIZE) != 0) {
+      data.clear();
+    }
+  } else {
+    data.clear();
+  }
+
+  VkPipelineCacheCreateInfo cache_info = {};
+  cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cache_info.pNext = nullptr;
+  cache_info.flags = 0;
+  cache_info.initialDataSize = data.size();
+  cache_info.pInitialData = data.empty() ? nullptr : data.data();
+  VK_CHECK(vkCreatePipelineCache(device, &cache_info, nullptr, &cache));
+  warm = !data.empty();
+
+  auto end = std::chrono::high_resolution_clock::now();
+  ENGINE_INFO("Pipeline cache {} in {:.2f} ms ({} KiB)",
+              warm ? "loaded" : "created empty",
+              std::chrono::duration<double, std::milli>(end - start).count(),
+              data.size() / 1024);
+}
+
+void PipelineCache::save() {
+  if (cache == VK_NULL_HANDLE) {
+    return;
+  }
+  size_t data_size = 0;
+  VK_CHECK(vkGetPipelineCacheData(device, cache, &data_size, nullptr));
+  std::vector<char> data(data_size);
+  VK_CHECK(vkGetPipelineCacheData(device, cache, &data_size, data.data()));
+
+  FileHeader header = {};
+  fill_header(header);
+  header.data_size = data_size;
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    ENGINE_WARN("Failed to write pipeline cache to {}", path);
+    return;
+  }
+  file.write((const char *)&header, sizeof(FileHeader));
+  file.write(data.data(), data_size);
+}
+
+void PipelineCache::clear() {
+  if (cache == VK_NULL_HANDLE) {
+    return;
+  }
+  save();
+  vkDestroyPipelineCache(device, cache, nullptr);
+  cache = VK_NULL_HANDLE;
+}
+
+void PipelineCache::record_build(double p_milliseconds) {
+  std::lock_guard<std::mutex> guard(mutex);
+  build_count++;
+  build_time += p_milliseconds;
+}
+
+void PipelineCache::report() const {
+  if (build_count == 0) {
+    return;
+  }
+  ENGINE_INFO("{} pipelines built in {:.2f} ms with a {} pipeline cache",
+              build_count, build_time, warm ? "warm" : "cold");
+}
+
+void PipelineCache::fill_header(FileHeader &p_header) const {
+  memset(&p_header, 0, sizeof(FileHeader));
+  p_header.magic = PIPELINE_CACHE_MAGIC;
+  p_header.version = PIPELINE_CACHE_VERSION;
+  p_header.vendor_id = properties.vendorID;
+  p_header.device_id = properties.deviceID;
+  p_header.driver_version = properties.driverVersion;
+  memcpy(p_header.driver_uuid, id_properties.driverUUID, VK_UUID_SIZE);
+  memcpy(p_header.cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+}
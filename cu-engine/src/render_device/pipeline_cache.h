@@ -0,0 +1,58 @@
+#pragma once
+
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include <mutex>
+#include <string>
+
+/**
+VkPipelineCache that is kept on disk between runs. A cache file is only
+used when it was written by the same GPU and driver, otherwise pipelines
+are compiled from scratch and the file gets replaced on save().
+ */
+class PipelineCache {
+public:
+  void init(VkDevice p_device, VkPhysicalDevice p_physical_device,
+            const std::string &p_path = "pipeline_cache.bin");
+  void save();
+  /**
+   saves the cache and destroys it.
+   */
+  void clear();
+  /**
+   accumulates time spent in pipeline creation for the startup report.
+   Safe to call from the threads that build pipelines.
+   */
+  void record_build(double p_milliseconds);
+  /**
+   logs the builds so far. Called once the passes' startup pipelines exist.
+   */
+  void report() const;
+
+  VkPipelineCache get() const { return cache; }
+  bool is_warm() const { return warm; }
+
+private:
+  struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_size;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t driver_uuid[VK_UUID_SIZE];
+    uint8_t cache_uuid[VK_UUID_SIZE];
+  };
+
+  void fill_header(FileHeader &p_header) const;
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties properties = {};
+  VkPhysicalDeviceIDProperties id_properties = {};
+  std::string path;
+  bool warm = false;
+  int build_count = 0;
+  double build_time = 0.0;
+  std::mutex mutex;
+};
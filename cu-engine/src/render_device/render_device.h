@@ -4,11 +4,23 @@
 #include <volk.h>
 #define VMA_STATIC_VULKAN_FUNCTIONS 0
 #define VMA_DYNAMIC_VULKAN_FUNCTIONS 0
+#include "bindless_heap.h"
+#include "gpu_profiler.h"
+#include "image_writer.h"
+#include "pipeline_cache.h"
 #include "shader_compiler.h"
+#include "upload_manager.h"
 #include "utils.h"
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <span>
 #include <spirv_reflect.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <vk_mem_alloc.h>
 
@@ -24,13 +36,21 @@ public:
     physical_device = p_physical_device;
     window = p_window;
   }
-  void build(VkPresentModeKHR p_present_mode = VK_PRESENT_MODE_FIFO_KHR);
+  /**
+   unsupported present modes fall back through MAILBOX, IMMEDIATE and FIFO,
+   present_mode holds the one that got picked. A previous swapchain is
+   handed over to the new one, its image views and handle are destroyed
+   through p_retire_queue or right away without one.
+   */
+  bool build(VkPresentModeKHR p_present_mode = VK_PRESENT_MODE_FIFO_KHR,
+             ExecutionQueuer *p_retire_queue = nullptr);
   void clear();
   VkSwapchainKHR swapchain = VK_NULL_HANDLE;
   std::vector<VkImage> images;
   std::vector<VkImageView> views;
   VkFormat format;
   VkExtent2D extent;
+  VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
 
 private:
   VkSurfaceKHR surface;
@@ -39,18 +59,71 @@ private:
   CuWindow *window = nullptr;
 };
 
+// frames in flight are a device option, per frame arrays may be sized by
+// the maximum and only use the first get_frame_overlap() entries
+const uint32_t MAX_FRAME_OVERLAP = 3;
+
+struct RenderDeviceOptions {
+  // render into an offscreen target instead of a window's swapchain
+  bool headless = false;
+  // size of the offscreen target, only used when headless
+  VkExtent2D extent = {1280, 720};
+  // preferred present mode, see Swapchain::build()
+  VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+  // frames the CPU may record ahead of the GPU, 1 to MAX_FRAME_OVERLAP. One
+  // has the lowest latency, more keep the GPU busy
+  uint32_t frame_overlap = 2;
+  // seconds between memory reports in the log, 0 turns them off
+  double memory_report_seconds = 0.0;
+};
+
+/**
+what an allocation is used for, the device keeps a tally per category.
+ */
+enum MemoryCategory : uint32_t {
+  MEMORY_OTHER,
+  // vertex and index buffers
+  MEMORY_GEOMETRY,
+  // per instance data, culling results and indirect draws
+  MEMORY_INSTANCES,
+  MEMORY_UNIFORMS,
+  // host memory uploads are copied from
+  MEMORY_STAGING,
+  // host memory textures are copied back into
+  MEMORY_READBACK,
+  MEMORY_RENDER_TARGETS,
+  MEMORY_CATEGORY_COUNT,
+};
+
+struct MemoryCategoryUsage {
+  VkDeviceSize bytes = 0;
+  uint32_t allocation_count = 0;
+};
+
 struct RenderPipeline {
   VkPipelineLayout layout = VK_NULL_HANDLE;
   VkPipeline pipeline = VK_NULL_HANDLE;
+  VkPipelineBindPoint bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  // frame_overlap copies of every set, stored frame by frame.
   std::vector<VkDescriptorSet> sets = {};
+  uint32_t frame_overlap = 1;
+  /**
+   returns the descriptor set of p_index that belongs to frame p_frame.
+   */
+  VkDescriptorSet get_set(uint32_t p_frame, uint32_t p_index) const {
+    const size_t set_count = sets.size() / frame_overlap;
+    if (p_index >= set_count || p_frame >= frame_overlap) {
+      return VK_NULL_HANDLE;
+    }
+    return sets[set_count * p_frame + p_index];
+  }
   void clear(VkDevice p_device) {
     if (pipeline != VK_NULL_HANDLE) {
       vkDestroyPipeline(p_device, pipeline, nullptr);
     }
-
-    if (layout != VK_NULL_HANDLE) {
-      vkDestroyPipelineLayout(p_device, layout, nullptr);
-    }
+    // layouts are shared between pipelines, LayoutAllocator destroys them
+    pipeline = VK_NULL_HANDLE;
+    layout = VK_NULL_HANDLE;
     sets.clear();
   }
 };
@@ -89,15 +162,58 @@ struct PipelineLayoutInfo {
   std::vector<VkVertexInputBindingDescription> vertex_bindings = {};
 };
 
+/**
+command pool of one recording thread and the secondary command buffers it
+handed out. Buffers are reused once the pool gets reset.
+ */
+struct RecordingContext {
+  VkCommandPool cmp = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> cmbs = {};
+  uint32_t used = 0;
+};
+
+/**
+texture copy that waits for its frame's fence before it gets handed out.
+ */
+struct PendingReadback {
+  Buffer buffer = {};
+  VkExtent3D extent = {};
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  std::shared_ptr<std::promise<TextureReadback>> promise;
+};
+
 struct FrameData {
   VkCommandPool cmp;
+  // when the input this frame reacts to was sampled and when it was handed
+  // to the presentation engine
+  std::chrono::steady_clock::time_point input_time = {};
+  std::chrono::steady_clock::time_point present_time = {};
+  bool latency_pending = false;
   VkCommandBuffer cmb;
+  // copies recorded into this frame, delivered once its fence signals
+  std::vector<PendingReadback> readbacks;
+  // indexed by CuThreadPool::get_thread_index()
+  std::vector<RecordingContext> recording_contexts;
   VkSemaphore swapchain_semaphore, render_semaphore;
   VkFence render_fence;
+  // flushed once the frame's fence signals, retire resources through it.
   ExecutionQueuer deletion_queue = ExecutionQueuer(true);
   DescriptorAllocator descriptor_allocator;
 };
-const int FRAME_OVERLAP = 2;
+
+const uint32_t FRAME_LATENCY_HISTORY = 64;
+
+/**
+time from sampling input to presenting the frame that reacts to it. The GPU
+side is taken when the CPU finds the frame's fence signalled, so it's an
+upper bound that gets tight once the CPU waits on the GPU.
+ */
+struct FrameLatency {
+  // until vkQueuePresentKHR returned
+  double input_to_present_milliseconds = 0.0;
+  // until the GPU finished rendering the frame
+  double input_to_completion_milliseconds = 0.0;
+};
 
 enum ImageType {
   COLOR,
@@ -112,6 +228,18 @@ struct CuRenderAttachemnts {
   std::array<float, 4> background_color;
 };
 
+/**
+attachments with their views, layouts and load/store ops already filled in.
+A depth_format of VK_FORMAT_UNDEFINED renders without depth.
+ */
+struct RenderingDescription {
+  std::vector<VkRenderingAttachmentInfo> color_attachments = {};
+  std::vector<VkFormat> color_formats = {};
+  VkRenderingAttachmentInfo depth_attachment = {};
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {};
+};
+
 class CuRenderAttachmentBuilder {
 public:
   void add_color_attachment(std::array<float, 4> p_background_color = {
@@ -125,15 +253,103 @@ private:
   CuRenderAttachemnts result;
 };
 
+/**
+Reflects pipeline layouts from SPIR-V. Set layouts and pipeline layouts are
+cached by their content, so pipelines with the same interface share them
+and stay compatible for descriptor binding.
+ */
 class LayoutAllocator {
 public:
-  const PipelineLayoutInfo
-  generate_pipeline_info(VkDevice p_device,
-                         const std::vector<CompiledShaderInfo> &p_shader_infos);
+  /**
+   p_vertex_formats replace the reflected formats of the vertex inputs in
+   location order, for inputs the shader reads as floats but the vertex
+   buffer stores packed. p_push_constants are added to the reflected
+   ranges, so pipelines whose shaders use fewer of them can share a layout.
+   */
+  const PipelineLayoutInfo generate_pipeline_info(
+      VkDevice p_device, const std::vector<CompiledShaderInfo> &p_shader_infos,
+      const std::vector<VkFormat> &p_vertex_formats = {},
+      const std::vector<VkPushConstantRange> &p_push_constants = {});
+  /**
+   shaders declaring set BINDLESS_SET get p_layout for it instead of a
+   reflected one. The layout isn't owned.
+   */
+  void set_bindless_layout(VkDescriptorSetLayout p_layout) {
+    bindless_layout = p_layout;
+  }
+  /**
+   returns the layout of p_info's set layouts and push constants. It's
+   shared with every pipeline that has the same ones, don't destroy it.
+   */
+  VkPipelineLayout get_pipeline_layout(VkDevice p_device,
+                                       const PipelineLayoutInfo &p_info);
+  uint32_t get_set_layout_count();
+  uint32_t get_pipeline_layout_count();
   void clear();
 
 private:
-  std::vector<VkDescriptorSetLayout> descriptor_layouts;
+  /**
+   what generate_pipeline_info() needs from one shader stage.
+   */
+  struct ShaderReflection {
+    VkShaderStageFlagBits stage = VK_SHADER_STAGE_VERTEX_BIT;
+    // vertex inputs sorted by location, without offsets
+    std::vector<VkVertexInputAttributeDescription> vertex_inputs = {};
+    std::vector<VkPushConstantRange> push_constants = {};
+    // set number and its bindings
+    std::vector<std::pair<uint32_t, std::vector<VkDescriptorSetLayoutBinding>>>
+        sets = {};
+  };
+  struct CachedReflection {
+    // recompiled shaders keep their path but not their code
+    size_t spirv_hash = 0;
+    std::shared_ptr<const ShaderReflection> reflection = nullptr;
+  };
+  struct CachedSetLayout {
+    std::vector<VkDescriptorSetLayoutBinding> bindings = {};
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+  };
+  struct CachedPipelineLayout {
+    std::vector<VkDescriptorSetLayout> set_layouts = {};
+    std::vector<VkPushConstantRange> push_constants = {};
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+  };
+
+  /**
+   p_bindings have to be sorted by binding number.
+   */
+  VkDescriptorSetLayout
+  get_set_layout(VkDevice p_device,
+                 const std::vector<VkDescriptorSetLayoutBinding> &p_bindings);
+  /**
+   reflects p_shader_info once per shader path, later pipelines using the
+   same shader get the cached result.
+   */
+  std::shared_ptr<const ShaderReflection>
+  reflect(const CompiledShaderInfo &p_shader_info);
+
+  VkDescriptorSetLayout bindless_layout = VK_NULL_HANDLE;
+  // keyed by a hash of the content, collisions share a bucket
+  std::unordered_multimap<size_t, CachedSetLayout> set_layouts;
+  std::unordered_multimap<size_t, CachedPipelineLayout> pipeline_layouts;
+  std::unordered_map<std::string, CachedReflection> reflections;
+  std::mutex mutex;
+};
+
+/**
+Everything needed to build a graphics pipeline off the main thread.
+Shaders listed in shaders are compiled by the worker that builds it.
+ */
+struct RenderPipelineDescription {
+  std::vector<std::string> shaders = {};
+  std::vector<CompiledShaderInfo> shader_infos = {};
+  VkBool32 depth_write_test = VK_TRUE;
+  VkCompareOp depth_compare_op = VK_COMPARE_OP_LESS_OR_EQUAL;
+  std::vector<Texture> color_textures = {};
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+  // see LayoutAllocator::generate_pipeline_info()
+  std::vector<VkFormat> vertex_formats = {};
+  std::vector<VkPushConstantRange> push_constants = {};
 };
 /**
 an Abstraction layer that handles calls to APIs such as Vulkan, DX12 etc.
@@ -142,14 +358,69 @@ Currently only Vulkan supported.
 class CuRenderDevice {
 public:
   CuRenderDevice();
-  bool init(CuWindow *p_window);
+  /**
+   p_window may be nullptr in headless mode. Headless devices don't need
+   surface support, frames end up in get_offscreen_target() and presenting
+   is replaced by the frame's fence.
+   */
+  bool init(CuWindow *p_window, const RenderDeviceOptions &p_options = {});
   VkExtent2D get_swapchain_size() const { return swapchain.extent; }
+  /**
+   the swapchain gets rebuilt with p_present_mode before the next frame.
+   */
+  void set_present_mode(VkPresentModeKHR p_present_mode);
+  /**
+   the mode frames are presented with, which may differ from the requested
+   one when the surface doesn't support it.
+   */
+  VkPresentModeKHR get_present_mode() const { return swapchain.present_mode; }
   bool create_texture(VkFormat p_format, VkExtent3D p_extent,
                       VkImageUsageFlags p_image_usage,
-                      VmaMemoryUsage p_memory_usage, Texture &p_out_texture);
+                      VmaMemoryUsage p_memory_usage, Texture &p_out_texture,
+                      MemoryCategory p_category = MEMORY_RENDER_TARGETS);
+  /**
+   creates the image of p_out_texture without memory or view, see
+   bind_texture_memory(). Lets textures that are never used at the same time
+   share memory.
+   */
+  bool create_unbound_texture(VkFormat p_format, VkExtent3D p_extent,
+                              VkImageUsageFlags p_image_usage,
+                              Texture &p_out_texture,
+                              VkMemoryRequirements &out_requirements);
+  /**
+   device local memory for bind_texture_memory(), free it with
+   free_memory() once no texture bound to it is in use.
+   */
+  VmaAllocation
+  allocate_memory(const VkMemoryRequirements &p_requirements,
+                  MemoryCategory p_category = MEMORY_RENDER_TARGETS);
+  void free_memory(VmaAllocation p_allocation);
+  /**
+   binds p_memory at p_offset and creates the view. The texture doesn't own
+   the memory, clear_texture() only destroys the image and view.
+   */
+  bool bind_texture_memory(Texture &p_texture, VmaAllocation p_memory,
+                           VkDeviceSize p_offset = 0);
   Buffer create_buffer(size_t p_size, VkBufferUsageFlags p_usage,
-                       VmaMemoryUsage p_memory_usage);
-  void write_buffer(void *p_data, size_t p_size, Buffer &buffer);
+                       VmaMemoryUsage p_memory_usage,
+                       MemoryCategory p_category = MEMORY_OTHER);
+  /**
+   copies p_size bytes into the buffer starting at p_offset. Host visible
+   buffers are written through their persistent mapping.
+   */
+  void write_buffer(void *p_data, size_t p_size, Buffer &buffer,
+                    size_t p_offset = 0);
+  /**
+   returns the persistent mapping of a host visible buffer so data can be
+   built in place. Call flush_buffer() on the written range afterwards.
+   */
+  void *map_buffer(Buffer &p_buffer);
+  /**
+   makes host writes visible to the GPU. Only non-coherent memory needs it,
+   for coherent memory this is a no-op.
+   */
+  void flush_buffer(const Buffer &p_buffer, VkDeviceSize p_offset = 0,
+                    VkDeviceSize p_size = VK_WHOLE_SIZE);
   // use this function inside immediate_submit.
   void copy_buffer(const Buffer &p_source, const Buffer &p_destination,
                    VkDeviceSize p_size, VkDeviceSize p_source_offset,
@@ -157,19 +428,86 @@ public:
   void clear_buffer(Buffer p_buffer);
   void clear_texture(Texture &p_texture);
   void immediate_submit(std::function<void()> &&p_function);
+  /**
+   submits to p_queue. Queue access is serialised so any thread may call it.
+   */
+  void queue_submit(VkQueue p_queue, const VkSubmitInfo2KHR &p_submit_info,
+                    VkFence p_fence);
+  /**
+   asynchronous buffer uploads. Every frame waits for the uploads that were
+   flushed before it got submitted.
+   */
+  UploadManager &get_upload_manager() { return upload_manager; }
+  PipelineCache &get_pipeline_cache() { return pipeline_cache; }
+  /**
+   global descriptor set of bindless resources, see supports_bindless().
+   */
+  BindlessHeap &get_bindless_heap() { return bindless_heap; }
+  /**
+   queues p_function to run once the GPU has finished the frame that is
+   being recorded. Use it to destroy resources that may still be in use.
+   */
+  void queue_frame_deletion(std::function<void()> &&p_function);
   RenderPipeline
   create_render_pipeline(const std::vector<CompiledShaderInfo> &p_shader_infos,
                          const VkBool32 p_depth_write_test,
                          const VkCompareOp p_depth_compare_op,
                          const std::vector<Texture> p_color_textures = {},
-                         const VkFormat p_depth_format = VK_FORMAT_UNDEFINED);
-  void begin_recording();
+                         const VkFormat p_depth_format = VK_FORMAT_UNDEFINED,
+                         const std::vector<VkFormat> &p_vertex_formats = {},
+                         const std::vector<VkPushConstantRange>
+                             &p_push_constants = {});
+  /**
+   builds the pipeline on the thread pool. Any number of builds can run in
+   parallel, they share the pipeline cache. Without a thread pool the
+   pipeline is built right away.
+   */
+  std::future<RenderPipeline>
+  create_render_pipeline_async(const RenderPipelineDescription &p_description);
+  /**
+   descriptor sets and push constants are reflected from the shader the
+   same way as for render pipelines.
+   */
+  RenderPipeline
+  create_compute_pipeline(const CompiledShaderInfo &p_shader_info);
+  /**
+   returns false if the frame has to be skipped, for example while the
+   window is minimised. Nothing may be recorded then and finish_recording()
+   must not be called.
+   */
+  bool begin_recording();
+  /**
+   begins rendering into the given textures. With p_secondary the pass has to
+   record its commands through record_parallel().
+   */
   void prepare_image(CuRenderAttachemnts &p_render_attachments,
                      const Texture *p_color_texture,
-                     const Texture *p_depth_texture = nullptr);
+                     const Texture *p_depth_texture = nullptr,
+                     bool p_secondary = false);
+  /**
+   begins rendering without any layout transitions or clears of its own,
+   the attachments have to be in the layouts p_description names.
+   */
+  void begin_rendering(const RenderingDescription &p_description,
+                       bool p_secondary = false);
+  void end_rendering();
+  /**
+   records p_task_count tasks into secondary command buffers on the thread
+   pool and executes them in task order. Every bind and draw call made by a
+   task goes into its own buffer, so tasks have to bind their pipeline and
+   descriptors themselves. Tasks can't begin or end rendering.
+   */
+  void record_parallel(uint32_t p_task_count,
+                       const std::function<void(uint32_t)> &p_task);
   void bind_pipeline(const RenderPipeline &p_pipeline);
+  void bind_compute_pipeline(const RenderPipeline &p_pipeline);
   void bind_descriptor(const RenderPipeline &p_pipeline,
                        const uint32_t p_index);
+  /**
+   binds the bindless heap at BINDLESS_SET. It stays bound across pipeline
+   changes as long as the layouts stay compatible.
+   */
+  void bind_bindless_heap(const RenderPipeline &p_pipeline);
   void bind_push_constant(const RenderPipeline &p_pipeline,
                           VkShaderStageFlags p_shaderStages, uint32_t p_offset,
                           uint32_t p_size, void *p_data);
@@ -183,12 +521,141 @@ public:
   void draw_indexed(uint32_t p_index_count, uint32_t p_instance_count,
                     uint32_t p_first_index, int32_t p_vertex_offset,
                     uint32_t p_first_instance);
+  void draw_indexed_indirect(const Buffer &p_buffer, VkDeviceSize p_offset,
+                             uint32_t p_draw_count,
+                             uint32_t p_stride =
+                                 sizeof(VkDrawIndexedIndirectCommand));
+  /**
+   draws the number of commands read from p_count_buffer, at most
+   p_max_draw_count. Without drawIndirectCount support all p_max_draw_count
+   commands are drawn, unused ones need an instanceCount of 0.
+   */
+  void draw_indexed_indirect_count(const Buffer &p_buffer,
+                                   VkDeviceSize p_offset,
+                                   const Buffer &p_count_buffer,
+                                   VkDeviceSize p_count_offset,
+                                   uint32_t p_max_draw_count,
+                                   uint32_t p_stride =
+                                       sizeof(VkDrawIndexedIndirectCommand));
+  /**
+   records an inline buffer update, at most 65536 bytes. Can't be used while
+   rendering.
+   */
+  void update_buffer(const Buffer &p_buffer, const void *p_data, size_t p_size,
+                     VkDeviceSize p_offset = 0);
+  void dispatch(uint32_t p_group_count_x, uint32_t p_group_count_y = 1,
+                uint32_t p_group_count_z = 1);
+  /**
+   p_buffer holds a VkDispatchIndirectCommand at p_offset.
+   */
+  void dispatch_indirect(const Buffer &p_buffer, VkDeviceSize p_offset = 0);
+  void buffer_barrier(const Buffer &p_buffer, VkPipelineStageFlags2 p_src_stage,
+                      VkAccessFlags2 p_src_access,
+                      VkPipelineStageFlags2 p_dst_stage,
+                      VkAccessFlags2 p_dst_access);
+  void image_barrier(const Texture &p_texture, VkImageLayout p_old_layout,
+                     VkImageLayout p_new_layout,
+                     VkPipelineStageFlags2 p_src_stage,
+                     VkAccessFlags2 p_src_access,
+                     VkPipelineStageFlags2 p_dst_stage,
+                     VkAccessFlags2 p_dst_access);
+  /**
+   records all of p_barriers with a single vkCmdPipelineBarrier2.
+   */
+  void image_barriers(const std::vector<VkImageMemoryBarrier2> &p_barriers);
   void submit_image(Texture &p_from, Texture *p_to = nullptr);
+  /**
+   copies p_from, which has to be in TRANSFER_SRC_OPTIMAL layout, into the
+   frame's swapchain image or p_to and leaves the image ready to present.
+   */
+  void blit_to_swapchain(const Texture &p_from, Texture *p_to = nullptr);
+  /**
+   fills the frame's swapchain image with p_color and leaves it ready to
+   present, for frames that have nothing to blit into it.
+   */
+  void clear_swapchain(VkClearColorValue p_color = {{0.0f, 0.0f, 0.0f, 1.0f}});
+  /**
+   copies p_texture into host memory at the end of the frame being recorded
+   (the next one outside of recording). The future is ready once that frame's
+   fence signalled, usually get_frame_overlap() frames later. p_layout is the
+   texture's layout at the end of the frame, it's kept. Call it from the
+   thread that records frames. Readbacks that fail or are still pending at
+   shutdown complete with an empty TextureReadback.
+   */
+  std::future<TextureReadback>
+  read_texture(const Texture &p_texture,
+               VkImageLayout p_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  /**
+   GPU timestamps around the commands recorded in between. Has to be called
+   outside of rendering that was begun for secondary command buffers.
+   */
+  uint32_t begin_gpu_zone(const std::string &p_name);
+  void end_gpu_zone(uint32_t p_zone);
+  /**
+   timings of the GPU zones, a frame or two behind the recorded frame.
+   */
+  const std::vector<GpuZoneTiming> &get_gpu_timings() const {
+    return gpu_profiler.get_timings();
+  }
+  double get_gpu_time(const std::string &p_name) const {
+    return gpu_profiler.get_time(p_name);
+  }
+  /**
+   bytes and allocations currently held by p_category.
+   */
+  MemoryCategoryUsage get_memory_usage(MemoryCategory p_category) const;
+  /**
+   logs every category's usage and how close each heap is to its budget.
+   Budgets come from VK_EXT_memory_budget where the device has it and are
+   estimated from the heap sizes otherwise.
+   */
+  void report_memory();
+  /**
+   VMA's statistics as JSON, see vmaBuildStatsString(). Allocations are
+   named after their category.
+   */
+  std::string get_memory_stats_json(bool p_detailed = true);
+  bool dump_memory_stats(const std::string &p_path);
   void finish_recording();
   void stop_rendering();
   void clear();
 
   VkDevice get_raw_device() { return device; }
+  /**
+   how many threads can record at once, record_parallel() doesn't gain
+   anything from more tasks than that.
+   */
+  uint32_t get_recording_thread_count() const;
+  /**
+   index of the frame that is currently being recorded. Use it to pick
+   per-frame resources that the GPU isn't reading from.
+   */
+  int get_current_frame_index() const { return current_frame_idx; }
+  int get_frame_count() const { return frame_count; }
+  /**
+   number of frames in flight, per frame resources need this many copies.
+   */
+  uint32_t get_frame_overlap() const { return frame_data.size(); }
+  /**
+   input to present latency, averaged over the frames the GPU finished
+   most recently.
+   */
+  const FrameLatency &get_latency() const { return latency; }
+  bool is_headless() const { return options.headless; }
+  bool supports_draw_indirect_count() const {
+    return draw_indirect_count_supported;
+  }
+  bool supports_memory_budget() const { return memory_budget_supported; }
+  /**
+   whether the device has the descriptor indexing features the bindless
+   heap needs and the heap got created.
+   */
+  bool supports_bindless() const { return bindless_heap.is_ready(); }
+  /**
+   the image frames get presented to in headless mode. It stays in
+   TRANSFER_SRC_OPTIMAL layout between frames.
+   */
+  const Texture &get_offscreen_target() const { return offscreen_target; }
 
   static CuRenderDevice *get_singleton();
 
@@ -199,6 +666,9 @@ private:
   VkDevice device;
   VkQueue graphics_queue;
   uint32_t graphics_queue_family;
+  VkQueue transfer_queue;
+  uint32_t transfer_queue_family;
+  std::mutex queue_mutex;
   VkSurfaceKHR surface;
   VmaAllocator allocator;
 
@@ -206,20 +676,90 @@ private:
   VkCommandPool imm_cpool;
   VkFence imm_fence;
 
+  UploadManager upload_manager;
+  BindlessHeap bindless_heap;
+  // descriptor pools aren't thread safe, pipelines may be built in parallel
+  std::mutex descriptor_mutex;
+
   CuWindow *window = nullptr;
+  bool draw_indirect_count_supported = false;
+  bool bindless_supported = false;
+  bool memory_budget_supported = false;
 
   Swapchain swapchain;
-  FrameData frame_data[FRAME_OVERLAP];
+  RenderDeviceOptions options;
+  bool present_mode_changed = false;
+  // acquire or present reported that the swapchain doesn't match the surface
+  bool swapchain_outdated = false;
+  /**
+   rebuilds the swapchain after resizes without waiting for the device.
+   */
+  bool update_swapchain();
+
+  struct ReadbackRequest {
+    VkImage image = VK_NULL_HANDLE;
+    VkExtent3D extent = {};
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    std::shared_ptr<std::promise<TextureReadback>> promise;
+  };
+  std::vector<ReadbackRequest> readback_requests;
+  // host buffers of delivered readbacks, reused by later ones
+  std::vector<Buffer> free_readback_buffers;
+  void record_readbacks(VkCommandBuffer p_cmb);
+  void allocate_pipeline_sets(
+      RenderPipeline &p_pipeline,
+      const std::vector<VkDescriptorSetLayout> &p_descriptor_layouts);
+  void deliver_readbacks(FrameData &p_frame);
+  Texture offscreen_target;
+  std::vector<FrameData> frame_data;
+  FrameLatency latency = {};
+  std::array<FrameLatency, FRAME_LATENCY_HISTORY> latency_history = {};
+  uint32_t latency_sample_count = 0;
+  void resolve_latency(FrameData &p_frame);
 
   ExecutionQueuer main_deletion_queue = ExecutionQueuer(true);
 
+  // allocations may be made and freed from any thread
+  std::array<std::atomic<uint64_t>, MEMORY_CATEGORY_COUNT> category_bytes;
+  std::array<std::atomic<uint32_t>, MEMORY_CATEGORY_COUNT> category_counts;
+  std::chrono::steady_clock::time_point last_memory_report = {};
+  /**
+   counts p_allocation towards the category it was created with.
+   */
+  void track_allocation(VmaAllocation p_allocation, bool p_freed = false);
+  /**
+   warns when p_size more bytes in p_memory_type's heap exceed its budget,
+   before the allocation is attempted.
+   */
+  void check_budget(uint32_t p_memory_type, VkDeviceSize p_size,
+                    MemoryCategory p_category);
+
   LayoutAllocator main_layout_allocator;
+  PipelineCache pipeline_cache;
+  GpuProfiler gpu_profiler;
 
   int current_frame_idx = 0;
   int frame_count = 0;
 
   uint32_t swapchain_img_index = 0;
 
+  // the rendering begun by begin_rendering(), secondaries inherit it
+  struct ActiveRendering {
+    bool active = false;
+    bool secondary = false;
+    std::vector<VkFormat> color_formats = {};
+    VkFormat depth_format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent = {};
+  } active_rendering;
+
+  /**
+   the buffer commands of the calling thread go into. That's the secondary
+   of a record_parallel() task or the frame's primary buffer.
+   */
+  VkCommandBuffer get_command_buffer();
+  VkCommandBuffer begin_secondary(RecordingContext &p_context);
+
   static CuRenderDevice *singleton;
 };
 
@@ -1,41 +1,144 @@
 #include "render_device.h"
+#include "profiler.h"
+#include "thread_pool.h"
 #include "window.h"
 #include <VkBootstrap.h>
+#include <chrono>
+#include <fstream>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 CuRenderDevice *CuRenderDevice::singleton = nullptr;
+// set while a record_parallel() task records on this thread
+thread_local VkCommandBuffer recording_cmb = VK_NULL_HANDLE;
 
-void Swapchain::build(
-    VkPresentModeKHR p_present_mode /*= VK_PRESENT_MODE_FIFO_KHR*/) {
-  clear();
+const char *MEMORY_CATEGORY_NAMES[MEMORY_CATEGORY_COUNT] = {
+    "other",   "geometry",  "instances",     "uniforms",
+    "staging", "readbacks", "render targets"};
+
+static double to_mebibytes(VkDeviceSize p_bytes) {
+  return p_bytes / (1024.0 * 1024.0);
+}
+
+static VkPresentModeKHR
+select_present_mode(VkPresentModeKHR p_present_mode,
+                    const std::vector<VkPresentModeKHR> &p_supported) {
+  const VkPresentModeKHR fallbacks[] = {VK_PRESENT_MODE_MAILBOX_KHR,
+                                        VK_PRESENT_MODE_IMMEDIATE_KHR};
+  auto is_supported = [&](VkPresentModeKHR p_mode) {
+    return std::find(p_supported.begin(), p_supported.end(), p_mode) !=
+           p_supported.end();
+  };
+  if (is_supported(p_present_mode)) {
+    return p_present_mode;
+  }
+  // FIFO is the only mode every surface has to support
+  if (p_present_mode == VK_PRESENT_MODE_FIFO_KHR) {
+    return VK_PRESENT_MODE_FIFO_KHR;
+  }
+  // asking for IMMEDIATE skips MAILBOX, anything else tries both
+  const VkPresentModeKHR *start =
+      p_present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR ? fallbacks + 1
+                                                      : fallbacks;
+  for (const VkPresentModeKHR *mode = start; mode != std::end(fallbacks);
+       ++mode) {
+    if (is_supported(*mode)) {
+      return *mode;
+    }
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+static const char *get_present_mode_name(VkPresentModeKHR p_present_mode) {
+  switch (p_present_mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "IMMEDIATE";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "MAILBOX";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "FIFO";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "FIFO_RELAXED";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+static VkImageAspectFlags get_aspect_flags(VkImageUsageFlags p_image_usage) {
+  if (p_image_usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+    // For now we only support depth aspect.
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  }
+  return VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+bool Swapchain::build(
+    VkPresentModeKHR p_present_mode /*= VK_PRESENT_MODE_FIFO_KHR*/,
+    ExecutionQueuer *p_retire_queue /*= nullptr*/) {
+  uint32_t mode_count = 0;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface,
+                                            &mode_count, nullptr);
+  std::vector<VkPresentModeKHR> supported_modes(mode_count);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface,
+                                            &mode_count,
+                                            supported_modes.data());
+  present_mode = select_present_mode(p_present_mode, supported_modes);
+
+  // the old swapchain hands its resources over and stays valid for the
+  // presents that are still queued
   vkb::SwapchainBuilder swapchain_builder{physical_device, device, surface};
-  vkb::Swapchain vkb_swapchain =
+  vkb::Result<vkb::Swapchain> swapchain_ret =
       swapchain_builder.use_default_format_selection()
           .set_desired_extent(window->width, window->height)
-          .set_desired_present_mode(p_present_mode)
+          .set_desired_present_mode(present_mode)
           .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
-          .build()
-          .value();
+          .set_old_swapchain(swapchain)
+          .build();
+
+  // the old swapchain is retired even if building failed
+  std::function<void()> retire = [device = device, old_swapchain = swapchain,
+                                  old_views = views]() {
+    for (VkImageView view : old_views) {
+      vkDestroyImageView(device, view, nullptr);
+    }
+    if (old_swapchain != VK_NULL_HANDLE) {
+      vkDestroySwapchainKHR(device, old_swapchain, nullptr);
+    }
+  };
+  if (p_retire_queue) {
+    p_retire_queue->push_function(std::move(retire));
+  } else {
+    retire();
+  }
+  swapchain = VK_NULL_HANDLE;
+  images.clear();
+  views.clear();
+
+  if (!swapchain_ret) {
+    ENGINE_ERROR("Failed to build swapchain. Error: {}",
+                 swapchain_ret.error().message());
+    return false;
+  }
+  vkb::Swapchain vkb_swapchain = swapchain_ret.value();
   swapchain = vkb_swapchain.swapchain;
   images = vkb_swapchain.get_images().value();
   views = vkb_swapchain.get_image_views().value();
   format = vkb_swapchain.image_format;
   extent = vkb_swapchain.extent;
   window->resize = false;
+  return true;
 }
 
 void Swapchain::clear() {
-
-  if (views.size() > 0) {
-    for (int i = 0; i < images.size(); ++i) {
-      vkDestroyImageView(device, views[i], nullptr);
-    }
+  for (VkImageView view : views) {
+    vkDestroyImageView(device, view, nullptr);
   }
-
   if (swapchain != VK_NULL_HANDLE) {
     vkDestroySwapchainKHR(device, swapchain, nullptr);
   }
+  swapchain = VK_NULL_HANDLE;
+  images.clear();
+  views.clear();
 }
 
 void CuRenderAttachmentBuilder::add_color_attachment(
@@ -80,12 +183,16 @@ CuRenderDevice::CuRenderDevice() { singleton = this; }
 
 CuRenderDevice *CuRenderDevice::get_singleton() { return singleton; }
 
-bool CuRenderDevice::init(CuWindow *p_window) {
-  if (!p_window) {
+bool CuRenderDevice::init(CuWindow *p_window,
+                          const RenderDeviceOptions &p_options /*= {}*/) {
+  if (!p_window && !p_options.headless) {
     ENGINE_ERROR("GLFWwindow must be provided");
     return false;
   }
   window = p_window;
+  options = p_options;
+  options.frame_overlap =
+      std::clamp<uint32_t>(options.frame_overlap, 1, MAX_FRAME_OVERLAP);
   VkResult volk_init = volkInitialize();
   if (volk_init != VK_SUCCESS) {
     ENGINE_ERROR("Failed to init volk");
@@ -96,6 +203,7 @@ bool CuRenderDevice::init(CuWindow *p_window) {
                                             .request_validation_layers()
                                             .require_api_version(1, 2)
                                             .use_default_debug_messenger()
+                                            .set_headless(options.headless)
                                             .build();
   if (!inst_ret) {
     ENGINE_ERROR("Failed to create Vulkan instance. Error: {}",
@@ -113,9 +221,12 @@ bool CuRenderDevice::init(CuWindow *p_window) {
     vkDestroyInstance(instance, VK_NULL_HANDLE);
   });
 
-  glfwCreateWindowSurface(instance, window->raw_window, nullptr, &surface);
-  main_deletion_queue.push_function(
-      [&]() { vkDestroySurfaceKHR(instance, surface, VK_NULL_HANDLE); });
+  surface = VK_NULL_HANDLE;
+  if (!options.headless) {
+    glfwCreateWindowSurface(instance, window->raw_window, nullptr, &surface);
+    main_deletion_queue.push_function(
+        [&]() { vkDestroySurfaceKHR(instance, surface, VK_NULL_HANDLE); });
+  }
 
   VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_extension = {};
   dynamic_rendering_extension.sType =
@@ -132,9 +243,11 @@ bool CuRenderDevice::init(CuWindow *p_window) {
   feats_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
   feats_12.bufferDeviceAddress = true;
   feats_12.descriptorIndexing = true;
+  feats_12.timelineSemaphore = true;
   vkb::PhysicalDeviceSelector selector{inst_ret.value()};
   vkb::Result<vkb::PhysicalDevice> phys_ret =
       selector.set_surface(surface)
+          .require_present(!options.headless)
           .set_minimum_version(1, 2) // require a vulkan 1.3 capable device
           .set_required_features_12(feats_12)
           .add_required_extensions({VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
@@ -148,6 +261,33 @@ bool CuRenderDevice::init(CuWindow *p_window) {
     return false;
   }
 
+  // GPU driven rendering falls back to plain indirect draws without it
+  VkPhysicalDeviceVulkan12Features indirect_count_features = {};
+  indirect_count_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  indirect_count_features.drawIndirectCount = VK_TRUE;
+  draw_indirect_count_supported =
+      phys_ret->enable_extension_features_if_present(indirect_count_features);
+
+  // descriptor indexing features of the bindless heap, passes keep their
+  // per-pipeline sets without them
+  VkPhysicalDeviceVulkan12Features bindless_features = {};
+  bindless_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  bindless_features.runtimeDescriptorArray = VK_TRUE;
+  bindless_features.descriptorBindingPartiallyBound = VK_TRUE;
+  bindless_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+  bindless_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+  bindless_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  bindless_features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+  bindless_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+  bindless_supported =
+      phys_ret->enable_extension_features_if_present(bindless_features);
+
+  // real heap budgets for VMA, otherwise it estimates them from heap sizes
+  memory_budget_supported = phys_ret->enable_extension_if_present(
+      VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
   physical_device = phys_ret->physical_device;
   VkPhysicalDeviceProperties device_properties = {};
   vkGetPhysicalDeviceProperties(physical_device, &device_properties);
@@ -173,6 +313,9 @@ bool CuRenderDevice::init(CuWindow *p_window) {
   main_deletion_queue.push_function(
       [&]() { vkDestroyDevice(device, VK_NULL_HANDLE); });
 
+  pipeline_cache.init(device, physical_device);
+  main_deletion_queue.push_function([&]() { pipeline_cache.clear(); });
+
   // Get the graphics queue with a helper function
   vkb::Result<VkQueue> graphics_queue_ret =
       vkb_device.get_queue(vkb::QueueType::graphics);
@@ -185,6 +328,18 @@ bool CuRenderDevice::init(CuWindow *p_window) {
   graphics_queue_family =
       vkb_device.get_queue_index(vkb::QueueType::graphics).value();
 
+  // uploads go through a dedicated transfer queue when the GPU has one
+  vkb::Result<VkQueue> transfer_queue_ret =
+      vkb_device.get_dedicated_queue(vkb::QueueType::transfer);
+  if (transfer_queue_ret) {
+    transfer_queue = transfer_queue_ret.value();
+    transfer_queue_family =
+        vkb_device.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+  } else {
+    transfer_queue = graphics_queue;
+    transfer_queue_family = graphics_queue_family;
+  }
+
   VmaVulkanFunctions vulkan_functions = {};
   vulkan_functions.vkGetDeviceProcAddr = vkGetDeviceProcAddr;
   vulkan_functions.vkGetInstanceProcAddr = vkGetInstanceProcAddr;
@@ -228,6 +383,9 @@ bool CuRenderDevice::init(CuWindow *p_window) {
 
   VmaAllocatorCreateInfo allocator_create_info = {};
   allocator_create_info.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+  if (memory_budget_supported) {
+    allocator_create_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+  }
   allocator_create_info.physicalDevice = physical_device;
   allocator_create_info.device = device;
   allocator_create_info.instance = instance;
@@ -238,10 +396,32 @@ bool CuRenderDevice::init(CuWindow *p_window) {
 
   main_deletion_queue.push_function([&]() { vmaDestroyAllocator(allocator); });
 
-  swapchain = Swapchain(surface, device, physical_device, window);
-  swapchain.build();
+  if (options.headless) {
+    // a single image stands in for the swapchain
+    create_texture(VK_FORMAT_B8G8R8A8_UNORM,
+                   {options.extent.width, options.extent.height, 1},
+                   VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                       VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                   VMA_MEMORY_USAGE_GPU_ONLY, offscreen_target);
+    swapchain.images = {offscreen_target.image};
+    swapchain.format = offscreen_target.format;
+    swapchain.extent = options.extent;
+    main_deletion_queue.push_function(
+        [&]() { clear_texture(offscreen_target); });
+    ENGINE_INFO("Rendering headless at {}x{}", options.extent.width,
+                options.extent.height);
+  } else {
+    swapchain = Swapchain(surface, device, physical_device, window);
+    if (!swapchain.build(options.present_mode)) {
+      return false;
+    }
+    ENGINE_INFO("Presenting with {} (requested {})",
+                get_present_mode_name(swapchain.present_mode),
+                get_present_mode_name(options.present_mode));
 
-  main_deletion_queue.push_function([&]() { swapchain.clear(); });
+    main_deletion_queue.push_function([&]() { swapchain.clear(); });
+  }
 
   // per frame resource allocation
   {
@@ -262,7 +442,9 @@ bool CuRenderDevice::init(CuWindow *p_window) {
     render_swapchain_semaphore_info.pNext = nullptr;
     render_swapchain_semaphore_info.flags = 0;
 
-    for (int i = 0; i < FRAME_OVERLAP; ++i) {
+    // the deletion queue keeps references, it's never resized after this
+    frame_data.resize(options.frame_overlap);
+    for (int i = 0; i < frame_data.size(); ++i) {
       FrameData &current_frame = frame_data[i];
       VK_CHECK(vkCreateCommandPool(device, &command_pool_info, nullptr,
                                    &current_frame.cmp));
@@ -277,6 +459,15 @@ bool CuRenderDevice::init(CuWindow *p_window) {
       VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_alloc_info,
                                         &current_frame.cmb));
 
+      // secondaries are recorded once and the whole pool is reset per frame
+      VkCommandPoolCreateInfo recording_pool_info = command_pool_info;
+      recording_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+      current_frame.recording_contexts.resize(get_recording_thread_count());
+      for (RecordingContext &context : current_frame.recording_contexts) {
+        VK_CHECK(vkCreateCommandPool(device, &recording_pool_info, nullptr,
+                                     &context.cmp));
+      }
+
       VK_CHECK(vkCreateSemaphore(device, &render_swapchain_semaphore_info,
                                  nullptr, &current_frame.swapchain_semaphore));
       VK_CHECK(vkCreateSemaphore(device, &render_swapchain_semaphore_info,
@@ -294,12 +485,15 @@ bool CuRenderDevice::init(CuWindow *p_window) {
 
       current_frame.descriptor_allocator.init(device, 1000, frame_sizes);
 
-      current_frame.deletion_queue.push_function([&]() {
+      main_deletion_queue.push_function([&]() {
         current_frame.descriptor_allocator.destroy_pools(device);
         vkDestroySemaphore(device, current_frame.swapchain_semaphore, nullptr);
         vkDestroySemaphore(device, current_frame.render_semaphore, nullptr);
         vkDestroyFence(device, current_frame.render_fence, nullptr);
         vkDestroyCommandPool(device, current_frame.cmp, nullptr);
+        for (RecordingContext &context : current_frame.recording_contexts) {
+          vkDestroyCommandPool(device, context.cmp, nullptr);
+        }
       });
     }
   }
@@ -339,38 +533,111 @@ bool CuRenderDevice::init(CuWindow *p_window) {
     });
   }
 
+  upload_manager.init(this, transfer_queue, transfer_queue_family,
+                      transfer_queue_family != graphics_queue_family);
+  main_deletion_queue.push_function([&]() { upload_manager.clear(); });
+
+  if (bindless_supported && bindless_heap.init(device, physical_device)) {
+    main_layout_allocator.set_bindless_layout(bindless_heap.get_layout());
+    main_deletion_queue.push_function([&]() { bindless_heap.clear(); });
+  }
+
+  gpu_profiler.init(device, physical_device, graphics_queue_family,
+                    options.frame_overlap);
+  main_deletion_queue.push_function([&]() { gpu_profiler.clear(); });
+
   return true;
 }
 
 Buffer CuRenderDevice::create_buffer(size_t p_size, VkBufferUsageFlags p_usage,
-                                     VmaMemoryUsage p_memory_usage) {
+                                     VmaMemoryUsage p_memory_usage,
+                                     MemoryCategory p_category /*= OTHER*/) {
   VkBufferCreateInfo buffer_info = {};
   buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   buffer_info.size = p_size;
   buffer_info.usage = p_usage;
 
+  // upload destinations are shared with the transfer queue so no ownership
+  // transfer is needed
+  std::array<uint32_t, 2> queue_families = {graphics_queue_family,
+                                            transfer_queue_family};
+  if ((p_usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+      graphics_queue_family != transfer_queue_family) {
+    buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    buffer_info.queueFamilyIndexCount = queue_families.size();
+    buffer_info.pQueueFamilyIndices = queue_families.data();
+  }
+
   VmaAllocationCreateInfo vma_alloc_info = {};
   vma_alloc_info.usage = p_memory_usage;
   vma_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+  vma_alloc_info.pUserData = reinterpret_cast<void *>(uintptr_t(p_category));
+
+  uint32_t memory_type = 0;
+  if (vmaFindMemoryTypeIndexForBufferInfo(allocator, &buffer_info,
+                                          &vma_alloc_info,
+                                          &memory_type) == VK_SUCCESS) {
+    check_budget(memory_type, p_size, p_category);
+  }
 
   Buffer out_buffer;
 
   VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &vma_alloc_info,
                            &out_buffer.buffer, &out_buffer.allocation,
                            &out_buffer.info));
+  track_allocation(out_buffer.allocation);
+  vmaGetAllocationMemoryProperties(allocator, out_buffer.allocation,
+                                   &out_buffer.memory_flags);
+  out_buffer.size = p_size;
 
   return out_buffer;
 }
 
-void CuRenderDevice::write_buffer(void *p_data, size_t p_size, Buffer &buffer) {
+void CuRenderDevice::write_buffer(void *p_data, size_t p_size, Buffer &buffer,
+                                  size_t p_offset /*= 0*/) {
   if (buffer.buffer == VK_NULL_HANDLE) {
     ENGINE_WARN("Can't write data to a buffer that isn't created");
     return;
   }
-  char *buffer_data;
-  vmaMapMemory(allocator, buffer.allocation, (void **)&buffer_data);
-  memcpy(buffer_data, p_data, p_size);
-  vmaUnmapMemory(allocator, buffer.allocation);
+  if (p_offset + p_size > buffer.size) {
+    ENGINE_WARN("Write of {} bytes at offset {} overflows buffer of {} bytes",
+                p_size, p_offset, buffer.size);
+    return;
+  }
+  if (buffer.info.pMappedData) {
+    memcpy(static_cast<char *>(buffer.info.pMappedData) + p_offset, p_data,
+           p_size);
+  } else {
+    char *buffer_data;
+    VK_CHECK(
+        vmaMapMemory(allocator, buffer.allocation, (void **)&buffer_data));
+    memcpy(buffer_data + p_offset, p_data, p_size);
+    vmaUnmapMemory(allocator, buffer.allocation);
+  }
+  flush_buffer(buffer, p_offset, p_size);
+}
+
+void *CuRenderDevice::map_buffer(Buffer &p_buffer) {
+  if (p_buffer.buffer == VK_NULL_HANDLE) {
+    ENGINE_WARN("Can't map a buffer that isn't created");
+    return nullptr;
+  }
+  if (!p_buffer.info.pMappedData) {
+    ENGINE_WARN("Buffer isn't host visible. Use write_buffer or a staging "
+                "buffer instead");
+  }
+  return p_buffer.info.pMappedData;
+}
+
+void CuRenderDevice::flush_buffer(const Buffer &p_buffer,
+                                  VkDeviceSize p_offset /*= 0*/,
+                                  VkDeviceSize p_size /*= VK_WHOLE_SIZE*/) {
+  if (p_buffer.buffer == VK_NULL_HANDLE ||
+      (p_buffer.memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    return;
+  }
+  VK_CHECK(
+      vmaFlushAllocation(allocator, p_buffer.allocation, p_offset, p_size));
 }
 
 void CuRenderDevice::copy_buffer(const Buffer &p_source,
@@ -390,13 +657,14 @@ void CuRenderDevice::copy_buffer(const Buffer &p_source,
 void CuRenderDevice::clear_buffer(Buffer p_buffer) {
   if (p_buffer.buffer == VK_NULL_HANDLE)
     return;
+  track_allocation(p_buffer.allocation, true);
   vmaDestroyBuffer(allocator, p_buffer.buffer, p_buffer.allocation);
 }
 
-bool CuRenderDevice::create_texture(VkFormat p_format, VkExtent3D p_extent,
-                                    VkImageUsageFlags p_image_usage,
-                                    VmaMemoryUsage p_memory_usage,
-                                    Texture &p_out_texture) {
+bool CuRenderDevice::create_texture(
+    VkFormat p_format, VkExtent3D p_extent, VkImageUsageFlags p_image_usage,
+    VmaMemoryUsage p_memory_usage, Texture &p_out_texture,
+    MemoryCategory p_category /*= MEMORY_RENDER_TARGETS*/) {
   p_out_texture.format = p_format;
   p_out_texture.extent = p_extent;
   VkImageCreateInfo image_info = image_create_info(
@@ -405,19 +673,25 @@ bool CuRenderDevice::create_texture(VkFormat p_format, VkExtent3D p_extent,
   VmaAllocationCreateInfo img_alloc_info = {};
   img_alloc_info.usage = p_memory_usage;
   img_alloc_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  img_alloc_info.pUserData = reinterpret_cast<void *>(uintptr_t(p_category));
+
+  uint32_t memory_type = 0;
+  if (vmaFindMemoryTypeIndexForImageInfo(allocator, &image_info,
+                                         &img_alloc_info,
+                                         &memory_type) == VK_SUCCESS) {
+    // the exact size is only known once the image exists
+    check_budget(memory_type,
+                 VkDeviceSize(p_extent.width) * p_extent.height *
+                     p_extent.depth * get_format_size(p_format),
+                 p_category);
+  }
 
   VK_CHECK(vmaCreateImage(allocator, &image_info, &img_alloc_info,
                           &p_out_texture.image, &p_out_texture.allocation,
                           nullptr));
+  track_allocation(p_out_texture.allocation);
 
-  if ((p_image_usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)) {
-    p_out_texture.aspect_flags |= VK_IMAGE_ASPECT_COLOR_BIT;
-  }
-
-  if ((p_image_usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
-    // For now we only support depth aspect.
-    p_out_texture.aspect_flags |= VK_IMAGE_ASPECT_DEPTH_BIT;
-  }
+  p_out_texture.aspect_flags |= get_aspect_flags(p_image_usage);
   VkImageViewCreateInfo rview_info = imageview_create_info(
       p_out_texture.format, p_out_texture.image, p_out_texture.aspect_flags);
 
@@ -427,12 +701,175 @@ bool CuRenderDevice::create_texture(VkFormat p_format, VkExtent3D p_extent,
   return true;
 }
 
-void CuRenderDevice::clear_texture(Texture &p_texture) {
-  if (p_texture.view == VK_NULL_HANDLE)
+bool CuRenderDevice::create_unbound_texture(
+    VkFormat p_format, VkExtent3D p_extent, VkImageUsageFlags p_image_usage,
+    Texture &p_out_texture, VkMemoryRequirements &out_requirements) {
+  p_out_texture.format = p_format;
+  p_out_texture.extent = p_extent;
+  p_out_texture.allocation = VK_NULL_HANDLE;
+  p_out_texture.aspect_flags = get_aspect_flags(p_image_usage);
+  VkImageCreateInfo image_info = image_create_info(
+      p_out_texture.format, p_image_usage, p_out_texture.extent);
+  if (vkCreateImage(device, &image_info, nullptr, &p_out_texture.image) !=
+      VK_SUCCESS) {
+    ENGINE_ERROR("Failed to create a {} image", string_VkFormat(p_format));
+    return false;
+  }
+  vkGetImageMemoryRequirements(device, p_out_texture.image, &out_requirements);
+  return true;
+}
+
+VmaAllocation CuRenderDevice::allocate_memory(
+    const VkMemoryRequirements &p_requirements,
+    MemoryCategory p_category /*= MEMORY_RENDER_TARGETS*/) {
+  VmaAllocationCreateInfo allocation_info = {};
+  allocation_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  allocation_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  allocation_info.pUserData = reinterpret_cast<void *>(uintptr_t(p_category));
+
+  uint32_t memory_type = 0;
+  if (vmaFindMemoryTypeIndex(allocator, p_requirements.memoryTypeBits,
+                             &allocation_info, &memory_type) == VK_SUCCESS) {
+    check_budget(memory_type, p_requirements.size, p_category);
+  }
+
+  VmaAllocation allocation = VK_NULL_HANDLE;
+  if (vmaAllocateMemory(allocator, &p_requirements, &allocation_info,
+                        &allocation, nullptr) != VK_SUCCESS) {
+    ENGINE_ERROR("Failed to allocate {} bytes of device memory",
+                 p_requirements.size);
+    return VK_NULL_HANDLE;
+  }
+  track_allocation(allocation);
+  return allocation;
+}
+
+void CuRenderDevice::free_memory(VmaAllocation p_allocation) {
+  if (p_allocation == VK_NULL_HANDLE) {
+    return;
+  }
+  track_allocation(p_allocation, true);
+  vmaFreeMemory(allocator, p_allocation);
+}
+
+void CuRenderDevice::track_allocation(VmaAllocation p_allocation,
+                                      bool p_freed /*= false*/) {
+  VmaAllocationInfo info = {};
+  vmaGetAllocationInfo(allocator, p_allocation, &info);
+  const uintptr_t category = reinterpret_cast<uintptr_t>(info.pUserData);
+  if (category >= MEMORY_CATEGORY_COUNT) {
     return;
-  vkDestroyImageView(device, p_texture.view, nullptr);
+  }
+  if (p_freed) {
+    category_bytes[category] -= info.size;
+    category_counts[category]--;
+    return;
+  }
+  category_bytes[category] += info.size;
+  category_counts[category]++;
+  // shows up in the JSON statistics
+  vmaSetAllocationName(allocator, p_allocation,
+                       MEMORY_CATEGORY_NAMES[category]);
+}
+
+void CuRenderDevice::check_budget(uint32_t p_memory_type, VkDeviceSize p_size,
+                                  MemoryCategory p_category) {
+  const VkPhysicalDeviceMemoryProperties *memory_properties = nullptr;
+  vmaGetMemoryProperties(allocator, &memory_properties);
+  const uint32_t heap = memory_properties->memoryTypes[p_memory_type].heapIndex;
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+  vmaGetHeapBudgets(allocator, budgets);
+  if (budgets[heap].usage + p_size <= budgets[heap].budget) {
+    return;
+  }
+  ENGINE_WARN("Allocating {:.1f} MiB of {} memory exceeds the budget of heap "
+              "{}, {:.1f} of {:.1f} MiB are in use",
+              to_mebibytes(p_size), MEMORY_CATEGORY_NAMES[p_category], heap,
+              to_mebibytes(budgets[heap].usage),
+              to_mebibytes(budgets[heap].budget));
+}
+
+MemoryCategoryUsage
+CuRenderDevice::get_memory_usage(MemoryCategory p_category) const {
+  MemoryCategoryUsage usage = {};
+  usage.bytes = category_bytes[p_category];
+  usage.allocation_count = category_counts[p_category];
+  return usage;
+}
+
+void CuRenderDevice::report_memory() {
+  for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+    const MemoryCategoryUsage usage = get_memory_usage(MemoryCategory(i));
+    if (usage.allocation_count == 0) {
+      continue;
+    }
+    ENGINE_INFO("GPU memory for {}: {:.1f} MiB in {} allocations",
+                MEMORY_CATEGORY_NAMES[i], to_mebibytes(usage.bytes),
+                usage.allocation_count);
+  }
+  const VkPhysicalDeviceMemoryProperties *memory_properties = nullptr;
+  vmaGetMemoryProperties(allocator, &memory_properties);
+  VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+  vmaGetHeapBudgets(allocator, budgets);
+  for (uint32_t i = 0; i < memory_properties->memoryHeapCount; ++i) {
+    const bool device_local = memory_properties->memoryHeaps[i].flags &
+                              VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    ENGINE_INFO("Heap {}{}: {:.1f} of {:.1f} MiB budget used, {:.1f} MiB in "
+                "{} blocks allocated by the device",
+                i, device_local ? " (device local)" : "",
+                to_mebibytes(budgets[i].usage),
+                to_mebibytes(budgets[i].budget),
+                to_mebibytes(budgets[i].statistics.blockBytes),
+                budgets[i].statistics.blockCount);
+  }
+  if (!memory_budget_supported) {
+    ENGINE_INFO("Heap budgets are estimated, VK_EXT_memory_budget is missing");
+  }
+}
+
+std::string CuRenderDevice::get_memory_stats_json(bool p_detailed /*= true*/) {
+  char *stats = nullptr;
+  vmaBuildStatsString(allocator, &stats, p_detailed);
+  std::string result = stats ? stats : "";
+  vmaFreeStatsString(allocator, stats);
+  return result;
+}
+
+bool CuRenderDevice::dump_memory_stats(const std::string &p_path) {
+  std::ofstream file(p_path);
+  if (!file.is_open()) {
+    ENGINE_ERROR("Failed to open {} for the memory statistics", p_path);
+    return false;
+  }
+  file << get_memory_stats_json();
+  ENGINE_INFO("Wrote memory statistics to {}", p_path);
+  return true;
+}
+
+bool CuRenderDevice::bind_texture_memory(Texture &p_texture,
+                                         VmaAllocation p_memory,
+                                         VkDeviceSize p_offset /*= 0*/) {
+  if (vmaBindImageMemory2(allocator, p_memory, p_offset, p_texture.image,
+                          nullptr) != VK_SUCCESS) {
+    ENGINE_ERROR("Failed to bind texture memory");
+    return false;
+  }
+  VkImageViewCreateInfo view_info = imageview_create_info(
+      p_texture.format, p_texture.image, p_texture.aspect_flags);
+  VK_CHECK(vkCreateImageView(device, &view_info, nullptr, &p_texture.view));
+  return true;
+}
+
+void CuRenderDevice::clear_texture(Texture &p_texture) {
+  if (p_texture.view != VK_NULL_HANDLE) {
+    vkDestroyImageView(device, p_texture.view, nullptr);
+  }
   if (p_texture.image == VK_NULL_HANDLE)
     return;
+  if (p_texture.allocation != VK_NULL_HANDLE) {
+    track_allocation(p_texture.allocation, true);
+  }
+  // textures bound with bind_texture_memory() don't own their memory
   vmaDestroyImage(allocator, p_texture.image, p_texture.allocation);
 }
 
@@ -555,6 +992,9 @@ bool get_shader_stage(const CompiledShaderInfo p_shader_info,
   case FRAGMENT:
     p_out_shader_stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     break;
+  case COMPUTE:
+    p_out_shader_stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    break;
   default:
     ENGINE_ERROR("Not a supported shader stage");
     return false;
@@ -582,8 +1022,131 @@ struct BindingEqual {
   }
 };
 
+std::shared_ptr<const LayoutAllocator::ShaderReflection>
+LayoutAllocator::reflect(const CompiledShaderInfo &p_shader_info) {
+  const std::string_view spirv(
+      reinterpret_cast<const char *>(p_shader_info.buffer.data()),
+      p_shader_info.buffer.size() * sizeof(uint32_t));
+  const size_t spirv_hash = std::hash<std::string_view>{}(spirv);
+  if (!p_shader_info.path.empty()) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto cached = reflections.find(p_shader_info.path);
+    if (cached != reflections.end() &&
+        cached->second.spirv_hash == spirv_hash) {
+      return cached->second.reflection;
+    }
+  }
+
+  VkShaderStageFlagBits shader_stage;
+  if (!get_shader_stage(p_shader_info, shader_stage)) {
+    return nullptr;
+  }
+  SpvReflectShaderModule module;
+  if (spvReflectCreateShaderModule(spirv.size(), spirv.data(), &module) !=
+      SPV_REFLECT_RESULT_SUCCESS) {
+    ENGINE_ERROR("Failed to create reflect module");
+    return nullptr;
+  }
+  std::shared_ptr<ShaderReflection> reflection =
+      std::make_shared<ShaderReflection>();
+  reflection->stage = shader_stage;
+
+  // Reflect Vertex layout
+  if (module.shader_stage ==
+      static_cast<VkShaderStageFlags>(VK_SHADER_STAGE_VERTEX_BIT)) {
+    // Enumerate and extract shader's input variables
+    uint32_t varCount = 0;
+    SpvReflectResult result =
+        spvReflectEnumerateInputVariables(&module, &varCount, nullptr);
+    assert(result == SPV_REFLECT_RESULT_SUCCESS);
+    std::vector<SpvReflectInterfaceVariable *> inputVars(varCount);
+    result = spvReflectEnumerateInputVariables(&module, &varCount,
+                                               inputVars.data());
+    assert(result == SPV_REFLECT_RESULT_SUCCESS);
+
+    for (int i = 0; i < inputVars.size(); i++) {
+      const SpvReflectInterfaceVariable &refl_var = *(inputVars[i]);
+      if (refl_var.decoration_flags & SPV_REFLECT_DECORATION_BUILT_IN) {
+        continue;
+      }
+      VkVertexInputAttributeDescription attribute = {};
+      attribute.binding = 0;
+      attribute.location = refl_var.location;
+      attribute.format = static_cast<VkFormat>(refl_var.format);
+      attribute.offset = 0;
+      reflection->vertex_inputs.push_back(attribute);
+    }
+    std::sort(reflection->vertex_inputs.begin(),
+              reflection->vertex_inputs.end(),
+              [](const VkVertexInputAttributeDescription &a,
+                 const VkVertexInputAttributeDescription &b) {
+                return a.location < b.location;
+              });
+  }
+
+  // Reflect push constants
+  uint32_t count = 0;
+  SpvReflectResult result =
+      spvReflectEnumeratePushConstantBlocks(&module, &count, NULL);
+  assert(result == SPV_REFLECT_RESULT_SUCCESS);
+  std::vector<SpvReflectBlockVariable *> push_constants(count);
+  result = spvReflectEnumeratePushConstantBlocks(&module, &count,
+                                                 push_constants.data());
+  assert(result == SPV_REFLECT_RESULT_SUCCESS);
+  for (int i = 0; i < push_constants.size(); ++i) {
+    const SpvReflectBlockVariable &constant = *(push_constants[i]);
+    VkPushConstantRange push_constant_range = {};
+    push_constant_range.stageFlags =
+        static_cast<VkShaderStageFlagBits>(module.shader_stage);
+    push_constant_range.offset = constant.offset;
+    // the block's size is measured from the start of the push constants,
+    // ranges of blocks starting at an offset only cover their members
+    push_constant_range.size = constant.size - constant.offset;
+    reflection->push_constants.push_back(push_constant_range);
+  }
+
+  // Reflect descriptor sets
+  count = 0;
+  result = spvReflectEnumerateDescriptorSets(&module, &count, NULL);
+  assert(result == SPV_REFLECT_RESULT_SUCCESS);
+  std::vector<SpvReflectDescriptorSet *> sets(count);
+  result = spvReflectEnumerateDescriptorSets(&module, &count, sets.data());
+  assert(result == SPV_REFLECT_RESULT_SUCCESS);
+  for (int set_i = 0; set_i < sets.size(); ++set_i) {
+    const SpvReflectDescriptorSet &refl_set = *(sets[set_i]);
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (int binding_i = 0; binding_i < refl_set.binding_count; ++binding_i) {
+      const SpvReflectDescriptorBinding &refl_binding =
+          *(refl_set.bindings[binding_i]);
+      VkDescriptorSetLayoutBinding layout_binding = {};
+      layout_binding.binding = refl_binding.binding;
+      layout_binding.descriptorType =
+          static_cast<VkDescriptorType>(refl_binding.descriptor_type);
+      layout_binding.descriptorCount = 1;
+      layout_binding.stageFlags =
+          static_cast<VkShaderStageFlagBits>(module.shader_stage);
+      for (int dim_i = 0; dim_i < refl_binding.array.dims_count; ++dim_i) {
+        layout_binding.descriptorCount *= refl_binding.array.dims[dim_i];
+      }
+      bindings.push_back(layout_binding);
+    }
+    reflection->sets.emplace_back(refl_set.set, bindings);
+  }
+  spvReflectDestroyShaderModule(&module);
+
+  if (!p_shader_info.path.empty()) {
+    std::lock_guard<std::mutex> guard(mutex);
+    CachedReflection &cached = reflections[p_shader_info.path];
+    cached.spirv_hash = spirv_hash;
+    cached.reflection = reflection;
+  }
+  return reflection;
+}
+
 const PipelineLayoutInfo LayoutAllocator::generate_pipeline_info(
-    VkDevice p_device, const std::vector<CompiledShaderInfo> &p_shader_infos) {
+    VkDevice p_device, const std::vector<CompiledShaderInfo> &p_shader_infos,
+    const std::vector<VkFormat> &p_vertex_formats /*= {}*/,
+    const std::vector<VkPushConstantRange> &p_push_constants /*= {}*/) {
   std::vector<VkDescriptorSetLayout> out_layouts = {};
   std::vector<VkPushConstantRange> out_push_constant = {};
   std::vector<VkVertexInputAttributeDescription> vertex_attribute_descriptions =
@@ -594,200 +1157,140 @@ const PipelineLayoutInfo LayoutAllocator::generate_pipeline_info(
                      std::unordered_map<size_t, VkDescriptorSetLayoutBinding>>
       unique_bindings;
   std::unordered_map<size_t, VkPushConstantRange> unique_push_constants;
-  std::unordered_map<VkShaderStageFlagBits, SpvReflectShaderModule>
-      reflect_modules = {};
-
-  for (int i = 0; i < p_shader_infos.size(); ++i) {
-    const CompiledShaderInfo shader_info = p_shader_infos[i];
+  std::vector<std::shared_ptr<const ShaderReflection>> reflections = {};
+  VkShaderStageFlags stages = 0;
 
-    VkShaderStageFlagBits shader_stage;
-    if (!get_shader_stage(shader_info, shader_stage)) {
+  for (const CompiledShaderInfo &shader_info : p_shader_infos) {
+    std::shared_ptr<const ShaderReflection> reflection = reflect(shader_info);
+    if (!reflection) {
       continue;
     }
-    if (reflect_modules.find(shader_stage) != reflect_modules.end()) {
+    if (stages & reflection->stage) {
       ENGINE_WARN("This reflect shader stage already exists");
       continue;
     }
-
-    SpvReflectShaderModule module;
-    if (spvReflectCreateShaderModule(
-            shader_info.buffer.size() * sizeof(uint32_t),
-            shader_info.buffer.data(), &module) != SPV_REFLECT_RESULT_SUCCESS) {
-      ENGINE_ERROR("Failed to create reflect module");
-    }
-
-    reflect_modules[shader_stage] = module;
+    stages |= reflection->stage;
+    reflections.push_back(reflection);
   }
 
-  // Reflect Vertex layout
-  for (std::pair<VkShaderStageFlagBits, SpvReflectShaderModule> entry :
-       reflect_modules) {
-
-    SpvReflectShaderModule &module = entry.second;
-    if (module.shader_stage ==
-        static_cast<VkShaderStageFlags>(VK_SHADER_STAGE_VERTEX_BIT)) {
-      // Enumerate and extract shader's input variables
-      uint32_t varCount = 0;
-      SpvReflectResult result =
-          spvReflectEnumerateInputVariables(&module, &varCount, nullptr);
-      assert(result == SPV_REFLECT_RESULT_SUCCESS);
-      std::vector<SpvReflectInterfaceVariable *> inputVars(varCount);
-      result = spvReflectEnumerateInputVariables(&module, &varCount,
-                                                 inputVars.data());
-      assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-      VkVertexInputBindingDescription binding_description = {};
-      binding_description.binding = 0;
-      binding_description.stride = 0;
-      binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-      for (int i = 0; i < inputVars.size(); i++) {
-        const SpvReflectInterfaceVariable &refl_var = *(inputVars[i]);
-        if (refl_var.decoration_flags & SPV_REFLECT_DECORATION_BUILT_IN) {
-          continue;
-        }
-
-        VkVertexInputAttributeDescription attribute = {};
-        attribute.binding = binding_description.binding;
-        attribute.location = refl_var.location;
-        attribute.format = static_cast<VkFormat>(inputVars[i]->format);
-        attribute.offset = 0;
-        vertex_attribute_descriptions.push_back(attribute);
-      }
-
-      if (vertex_attribute_descriptions.size() == 0) {
-        break;
+  for (const std::shared_ptr<const ShaderReflection> &reflection :
+       reflections) {
+    if (reflection->stage != VK_SHADER_STAGE_VERTEX_BIT ||
+        reflection->vertex_inputs.empty()) {
+      continue;
+    }
+    vertex_attribute_descriptions = reflection->vertex_inputs;
+
+    VkVertexInputBindingDescription binding_description = {};
+    binding_description.binding = 0;
+    binding_description.stride = 0;
+    binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    if (!p_vertex_formats.empty()) {
+      if (p_vertex_formats.size() != vertex_attribute_descriptions.size()) {
+        ENGINE_ERROR("Vertex shader has {} inputs but {} formats are given",
+                     vertex_attribute_descriptions.size(),
+                     p_vertex_formats.size());
       }
-
-      std::sort(vertex_attribute_descriptions.begin(),
-                vertex_attribute_descriptions.end(),
-                [](const VkVertexInputAttributeDescription &a,
-                   const VkVertexInputAttributeDescription &b) {
-                  return a.location < b.location;
-                });
-
-      for (VkVertexInputAttributeDescription &attribute :
-           vertex_attribute_descriptions) {
-        attribute.offset = binding_description.stride;
-        binding_description.stride += get_format_size(attribute.format);
+      for (size_t i = 0; i < vertex_attribute_descriptions.size() &&
+                         i < p_vertex_formats.size();
+           ++i) {
+        vertex_attribute_descriptions[i].format = p_vertex_formats[i];
       }
-
-      vertex_binding_descriptions.push_back(binding_description);
     }
-  }
-  // Reflect push constants
-  for (std::pair<VkShaderStageFlagBits, SpvReflectShaderModule> entry :
-       reflect_modules) {
-    SpvReflectShaderModule &module = entry.second;
-
-    uint32_t count = 0;
-    SpvReflectResult result =
-        spvReflectEnumeratePushConstantBlocks(&module, &count, NULL);
-    assert(result == SPV_REFLECT_RESULT_SUCCESS);
 
-    std::vector<SpvReflectBlockVariable *> push_constants(count);
-    result = spvReflectEnumeratePushConstantBlocks(&module, &count,
-                                                   push_constants.data());
-    assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-    for (int i = 0; i < push_constants.size(); ++i) {
-      const SpvReflectBlockVariable &constant = *(push_constants[i]);
-
-      VkPushConstantRange push_constant_range = {};
-      push_constant_range.stageFlags =
-          static_cast<VkShaderStageFlagBits>(module.shader_stage);
-      push_constant_range.offset = constant.offset;
-      push_constant_range.size = constant.size;
+    for (VkVertexInputAttributeDescription &attribute :
+         vertex_attribute_descriptions) {
+      attribute.offset = binding_description.stride;
+      binding_description.stride += get_format_size(attribute.format);
+    }
 
-      size_t hash = std::hash<uint32_t>{}(push_constant_range.offset) ^
-                    std::hash<uint32_t>{}(push_constant_range.size);
+    vertex_binding_descriptions.push_back(binding_description);
+  }
 
-      if (unique_push_constants.find(hash) != unique_push_constants.end()) {
-        unique_push_constants[hash].stageFlags |=
-            push_constant_range.stageFlags;
-      } else {
-        unique_push_constants[hash] = push_constant_range;
-      }
+  std::vector<VkPushConstantRange> push_constant_ranges = p_push_constants;
+  for (const std::shared_ptr<const ShaderReflection> &reflection :
+       reflections) {
+    push_constant_ranges.insert(push_constant_ranges.end(),
+                                reflection->push_constants.begin(),
+                                reflection->push_constants.end());
+  }
+  for (const VkPushConstantRange &push_constant_range : push_constant_ranges) {
+    size_t hash = std::hash<uint32_t>{}(push_constant_range.offset) ^
+                  std::hash<uint32_t>{}(push_constant_range.size);
+    if (unique_push_constants.find(hash) != unique_push_constants.end()) {
+      unique_push_constants[hash].stageFlags |= push_constant_range.stageFlags;
+    } else {
+      unique_push_constants[hash] = push_constant_range;
     }
   }
-  // Reflect descriptor sets
-  for (std::pair<VkShaderStageFlagBits, SpvReflectShaderModule> entry :
-       reflect_modules) {
-    SpvReflectShaderModule &module = entry.second;
 
-    uint32_t count = 0;
-    SpvReflectResult result =
-        spvReflectEnumerateDescriptorSets(&module, &count, NULL);
-    assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-    std::vector<SpvReflectDescriptorSet *> sets(count);
-    result = spvReflectEnumerateDescriptorSets(&module, &count, sets.data());
-    assert(result == SPV_REFLECT_RESULT_SUCCESS);
-
-    for (int set_i = 0; set_i < sets.size(); ++set_i) {
-      const SpvReflectDescriptorSet &refl_set = *(sets[set_i]);
-      std::unordered_map<size_t, VkDescriptorSetLayoutBinding> bindings;
-      for (int binding_i = 0; binding_i < refl_set.binding_count; ++binding_i) {
-        const SpvReflectDescriptorBinding &refl_binding =
-            *(refl_set.bindings[binding_i]);
-        VkDescriptorSetLayoutBinding layout_binding = {};
-        layout_binding.binding = refl_binding.binding;
-        layout_binding.descriptorType =
-            static_cast<VkDescriptorType>(refl_binding.descriptor_type);
-        layout_binding.descriptorCount = 1;
-        layout_binding.stageFlags =
-            static_cast<VkShaderStageFlagBits>(module.shader_stage);
-        for (int dim_i = 0; dim_i < refl_binding.array.dims_count; ++dim_i) {
-          layout_binding.descriptorCount *= refl_binding.array.dims[dim_i];
-        }
-        size_t binding_hash = BindingHash{}(layout_binding);
-        if (bindings.find(binding_hash) != bindings.end()) {
-          bindings[binding_hash].stageFlags |= layout_binding.stageFlags;
+  for (const std::shared_ptr<const ShaderReflection> &reflection :
+       reflections) {
+    for (const auto &[set, bindings] : reflection->sets) {
+      for (const VkDescriptorSetLayoutBinding &binding : bindings) {
+        size_t binding_hash = BindingHash{}(binding);
+        if (unique_bindings[set].find(binding_hash) !=
+            unique_bindings[set].end()) {
+          unique_bindings[set][binding_hash].stageFlags |= binding.stageFlags;
         } else {
-          bindings[binding_hash] = layout_binding;
-        }
-      }
-
-      // Merge stages if the layout already exists
-      if (unique_bindings.find(refl_set.set) != unique_bindings.end()) {
-        for (auto &[hash, binding] : bindings) {
-          if (unique_bindings[refl_set.set].find(hash) !=
-              unique_bindings[refl_set.set].end()) {
-            unique_bindings[refl_set.set][hash].stageFlags |=
-                binding.stageFlags;
-          } else {
-            unique_bindings[refl_set.set][hash] = binding;
-          }
+          unique_bindings[set][binding_hash] = binding;
         }
-      } else {
-        // Store unique bindings
-        unique_bindings[refl_set.set] = bindings;
       }
     }
   }
 
-  // Create Vulkan descriptor set layouts from the unique layout infos
+  // Create Vulkan descriptor set layouts from the unique layout infos, in
+  // set order. Sets the shaders skip get an empty layout
+  uint32_t set_count = 0;
   for (const auto &set_entry : unique_bindings) {
+    set_count = std::max(set_count, set_entry.first + 1);
+  }
+  for (uint32_t set_i = 0; set_i < set_count; ++set_i) {
+    if (set_i == BINDLESS_SET && bindless_layout != VK_NULL_HANDLE &&
+        unique_bindings.find(set_i) != unique_bindings.end()) {
+      out_layouts.push_back(bindless_layout);
+      continue;
+    }
     std::vector<VkDescriptorSetLayoutBinding> bindings;
-    for (const auto &binding_entry : set_entry.second) {
-      bindings.push_back(binding_entry.second);
+    if (unique_bindings.find(set_i) != unique_bindings.end()) {
+      for (const auto &binding_entry : unique_bindings[set_i]) {
+        bindings.push_back(binding_entry.second);
+      }
     }
-
-    VkDescriptorSetLayoutCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    info.bindingCount = bindings.size();
-    info.pBindings = bindings.data();
-
-    VkDescriptorSetLayout layout;
-    VK_CHECK(vkCreateDescriptorSetLayout(p_device, &info, nullptr, &layout));
-
-    out_layouts.push_back(layout);
-    descriptor_layouts.push_back(layout);
+    // a canonical order lets equal sets share their layout
+    std::sort(bindings.begin(), bindings.end(),
+              [](const VkDescriptorSetLayoutBinding &a,
+                 const VkDescriptorSetLayoutBinding &b) {
+                return a.binding < b.binding;
+              });
+    // stages declaring the same binding differently end up next to each
+    // other, they get merged into one
+    for (size_t i = 1; i < bindings.size();) {
+      if (bindings[i].binding != bindings[i - 1].binding) {
+        ++i;
+        continue;
+      }
+      if (bindings[i].descriptorType != bindings[i - 1].descriptorType) {
+        ENGINE_ERROR("Binding {} of set {} has different types across stages",
+                     bindings[i].binding, set_i);
+      }
+      bindings[i - 1].stageFlags |= bindings[i].stageFlags;
+      bindings[i - 1].descriptorCount = std::max(
+          bindings[i - 1].descriptorCount, bindings[i].descriptorCount);
+      bindings.erase(bindings.begin() + i);
+    }
+    out_layouts.push_back(get_set_layout(p_device, bindings));
   }
 
   for (const auto &entry : unique_push_constants) {
     out_push_constant.push_back(entry.second);
   }
+  std::sort(out_push_constant.begin(), out_push_constant.end(),
+            [](const VkPushConstantRange &a, const VkPushConstantRange &b) {
+              return a.offset < b.offset ||
+                     (a.offset == b.offset && a.stageFlags < b.stageFlags);
+            });
 
   PipelineLayoutInfo info = {};
   info.descriptor_layouts = out_layouts;
@@ -798,6 +1301,104 @@ const PipelineLayoutInfo LayoutAllocator::generate_pipeline_info(
   return info;
 }
 
+static void hash_combine(size_t &p_seed, uint64_t p_value) {
+  p_seed ^= std::hash<uint64_t>{}(p_value) + 0x9e3779b97f4a7c15ull +
+            (p_seed << 6) + (p_seed >> 2);
+}
+
+VkDescriptorSetLayout LayoutAllocator::get_set_layout(
+    VkDevice p_device,
+    const std::vector<VkDescriptorSetLayoutBinding> &p_bindings) {
+  size_t hash = p_bindings.size();
+  for (const VkDescriptorSetLayoutBinding &binding : p_bindings) {
+    hash_combine(hash, binding.binding);
+    hash_combine(hash, binding.descriptorType);
+    hash_combine(hash, binding.descriptorCount);
+    hash_combine(hash, binding.stageFlags);
+  }
+
+  // creation happens under the lock so parallel builds can't both miss
+  std::lock_guard<std::mutex> guard(mutex);
+  auto range = set_layouts.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const std::vector<VkDescriptorSetLayoutBinding> &bindings =
+        it->second.bindings;
+    if (std::equal(bindings.begin(), bindings.end(), p_bindings.begin(),
+                   p_bindings.end(), BindingEqual{})) {
+      return it->second.layout;
+    }
+  }
+
+  VkDescriptorSetLayoutCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  info.bindingCount = p_bindings.size();
+  info.pBindings = p_bindings.data();
+
+  CachedSetLayout cached = {};
+  cached.bindings = p_bindings;
+  VK_CHECK(
+      vkCreateDescriptorSetLayout(p_device, &info, nullptr, &cached.layout));
+  set_layouts.emplace(hash, cached);
+  return cached.layout;
+}
+
+VkPipelineLayout
+LayoutAllocator::get_pipeline_layout(VkDevice p_device,
+                                     const PipelineLayoutInfo &p_info) {
+  size_t hash = p_info.descriptor_layouts.size();
+  for (VkDescriptorSetLayout set_layout : p_info.descriptor_layouts) {
+    hash_combine(hash, reinterpret_cast<uint64_t>(set_layout));
+  }
+  for (const VkPushConstantRange &range : p_info.push_constants) {
+    hash_combine(hash, range.stageFlags);
+    hash_combine(hash, range.offset);
+    hash_combine(hash, range.size);
+  }
+
+  std::lock_guard<std::mutex> guard(mutex);
+  auto range = pipeline_layouts.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const CachedPipelineLayout &cached = it->second;
+    const bool same_push_constants = std::equal(
+        cached.push_constants.begin(), cached.push_constants.end(),
+        p_info.push_constants.begin(), p_info.push_constants.end(),
+        [](const VkPushConstantRange &a, const VkPushConstantRange &b) {
+          return a.stageFlags == b.stageFlags && a.offset == b.offset &&
+                 a.size == b.size;
+        });
+    if (same_push_constants &&
+        cached.set_layouts == p_info.descriptor_layouts) {
+      return cached.layout;
+    }
+  }
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.flags = 0;
+  layout_info.pPushConstantRanges = p_info.push_constants.data();
+  layout_info.pushConstantRangeCount = p_info.push_constants.size();
+  layout_info.pSetLayouts = p_info.descriptor_layouts.data();
+  layout_info.setLayoutCount = p_info.descriptor_layouts.size();
+
+  CachedPipelineLayout cached = {};
+  cached.set_layouts = p_info.descriptor_layouts;
+  cached.push_constants = p_info.push_constants;
+  VK_CHECK(
+      vkCreatePipelineLayout(p_device, &layout_info, nullptr, &cached.layout));
+  pipeline_layouts.emplace(hash, cached);
+  return cached.layout;
+}
+
+uint32_t LayoutAllocator::get_set_layout_count() {
+  std::lock_guard<std::mutex> guard(mutex);
+  return set_layouts.size();
+}
+
+uint32_t LayoutAllocator::get_pipeline_layout_count() {
+  std::lock_guard<std::mutex> guard(mutex);
+  return pipeline_layouts.size();
+}
+
 void LayoutAllocator::clear() {
   CuRenderDevice *device = CuRenderDevice::get_singleton();
   if (!device) {
@@ -805,10 +1406,21 @@ void LayoutAllocator::clear() {
     return;
   }
 
-  for (int i = 0; i < descriptor_layouts.size(); ++i) {
-    vkDestroyDescriptorSetLayout(device->get_raw_device(),
-                                 descriptor_layouts[i], nullptr);
+  std::lock_guard<std::mutex> guard(mutex);
+  if (!pipeline_layouts.empty()) {
+    ENGINE_INFO("Pipelines shared {} set layouts and {} pipeline layouts",
+                set_layouts.size(), pipeline_layouts.size());
+  }
+  for (auto &[hash, cached] : pipeline_layouts) {
+    vkDestroyPipelineLayout(device->get_raw_device(), cached.layout, nullptr);
+  }
+  for (auto &[hash, cached] : set_layouts) {
+    vkDestroyDescriptorSetLayout(device->get_raw_device(), cached.layout,
+                                 nullptr);
   }
+  pipeline_layouts.clear();
+  set_layouts.clear();
+  reflections.clear();
 }
 
 void CuRenderDevice::immediate_submit(std::function<void()> &&p_function) {
@@ -843,16 +1455,32 @@ void CuRenderDevice::immediate_submit(std::function<void()> &&p_function) {
   submit_info.commandBufferInfoCount = 1;
   submit_info.pCommandBufferInfos = &cmb_submit_info;
 
-  VK_CHECK(vkQueueSubmit2KHR(graphics_queue, 1, &submit_info, imm_fence));
+  queue_submit(graphics_queue, submit_info, imm_fence);
 
+  CU_PROFILE_SCOPE("Wait for immediate submit");
   VK_CHECK(vkWaitForFences(device, 1, &imm_fence, true, 9999999999));
 }
 
+void CuRenderDevice::queue_submit(VkQueue p_queue,
+                                  const VkSubmitInfo2KHR &p_submit_info,
+                                  VkFence p_fence) {
+  std::lock_guard<std::mutex> guard(queue_mutex);
+  VK_CHECK(vkQueueSubmit2KHR(p_queue, 1, &p_submit_info, p_fence));
+}
+
+void CuRenderDevice::queue_frame_deletion(
+    std::function<void()> &&p_function) {
+  frame_data[current_frame_idx].deletion_queue.push_function(
+      std::move(p_function));
+}
+
 RenderPipeline CuRenderDevice::create_render_pipeline(
     const std::vector<CompiledShaderInfo> &p_shader_infos,
     const VkBool32 p_depth_write_test, const VkCompareOp p_depth_compare_op,
     const std::vector<Texture> p_color_textures /*= {}*/,
-    const VkFormat p_depth_format /*= VK_FORMAT_UNDEFINED*/) {
+    const VkFormat p_depth_format /*= VK_FORMAT_UNDEFINED*/,
+    const std::vector<VkFormat> &p_vertex_formats /*= {}*/,
+    const std::vector<VkPushConstantRange> &p_push_constants /*= {}*/) {
   std::unordered_map<VkShaderStageFlagBits, VkShaderModule> shader_modules = {};
   std::vector<VkPipelineShaderStageCreateInfo> shader_stages = {};
 
@@ -888,19 +1516,11 @@ RenderPipeline CuRenderDevice::create_render_pipeline(
   }
 
   PipelineLayoutInfo pipeline_layout_info =
-      main_layout_allocator.generate_pipeline_info(device, p_shader_infos);
+      main_layout_allocator.generate_pipeline_info(
+          device, p_shader_infos, p_vertex_formats, p_push_constants);
 
-  VkPipelineLayoutCreateInfo layout_info = {};
-  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  layout_info.flags = 0;
-  layout_info.pPushConstantRanges = pipeline_layout_info.push_constants.data();
-  layout_info.pushConstantRangeCount =
-      pipeline_layout_info.push_constants.size();
-  layout_info.pSetLayouts = pipeline_layout_info.descriptor_layouts.data();
-  layout_info.setLayoutCount = pipeline_layout_info.descriptor_layouts.size();
-
-  VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr,
-                                  &out_pipeline.layout));
+  out_pipeline.layout =
+      main_layout_allocator.get_pipeline_layout(device, pipeline_layout_info);
 
   VkPipelineInputAssemblyStateCreateInfo input_assembly_info{};
   input_assembly_info.sType =
@@ -1021,34 +1641,137 @@ RenderPipeline CuRenderDevice::create_render_pipeline(
   pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
   pipeline_info.basePipelineIndex = 0;
 
-  VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
-                                     nullptr, &out_pipeline.pipeline));
+  auto build_start = std::chrono::high_resolution_clock::now();
+  VK_CHECK(vkCreateGraphicsPipelines(device, pipeline_cache.get(), 1,
+                                     &pipeline_info, nullptr,
+                                     &out_pipeline.pipeline));
+  auto build_end = std::chrono::high_resolution_clock::now();
+  const double build_time =
+      std::chrono::duration<double, std::milli>(build_end - build_start)
+          .count();
+  pipeline_cache.record_build(build_time);
+  ENGINE_INFO("Graphics pipeline created in {:.2f} ms ({} pipeline cache)",
+              build_time, pipeline_cache.is_warm() ? "warm" : "cold");
 
   for (std::pair<const VkShaderStageFlagBits, VkShaderModule> &element :
        shader_modules) {
     vkDestroyShaderModule(device, element.second, nullptr);
   }
 
-  std::vector<VkDescriptorSet> descriptor_sets = {};
+  allocate_pipeline_sets(out_pipeline, pipeline_layout_info.descriptor_layouts);
+
+  return out_pipeline;
+}
+
+void CuRenderDevice::allocate_pipeline_sets(
+    RenderPipeline &p_pipeline,
+    const std::vector<VkDescriptorSetLayout> &p_descriptor_layouts) {
   int index = 0;
-  out_pipeline.sets.resize(FRAME_OVERLAP *
-                           pipeline_layout_info.descriptor_layouts.size());
-  for (int i = 0; i < FRAME_OVERLAP; ++i) {
+  p_pipeline.frame_overlap = frame_data.size();
+  p_pipeline.sets.resize(frame_data.size() * p_descriptor_layouts.size());
+  std::lock_guard<std::mutex> guard(descriptor_mutex);
+  for (int i = 0; i < frame_data.size(); ++i) {
     FrameData &current_frame = frame_data[i];
-    for (int j = 0; j < pipeline_layout_info.descriptor_layouts.size(); ++j) {
-      VkDescriptorSet set = current_frame.descriptor_allocator.allocate(
-          device, pipeline_layout_info.descriptor_layouts[j]);
-      out_pipeline.sets[index] = set;
+    for (int j = 0; j < p_descriptor_layouts.size(); ++j) {
+      // the heap is a single set that gets bound by bind_bindless_heap()
+      VkDescriptorSet set = VK_NULL_HANDLE;
+      if (p_descriptor_layouts[j] != bindless_heap.get_layout()) {
+        set = current_frame.descriptor_allocator.allocate(
+            device, p_descriptor_layouts[j]);
+      }
+      p_pipeline.sets[index] = set;
       ++index;
     }
   }
+}
+
+RenderPipeline CuRenderDevice::create_compute_pipeline(
+    const CompiledShaderInfo &p_shader_info) {
+  RenderPipeline out_pipeline = {};
+  out_pipeline.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+  if (p_shader_info.stage != COMPUTE) {
+    ENGINE_ERROR("Compute pipelines need a compute shader");
+    return out_pipeline;
+  }
+
+  PipelineLayoutInfo pipeline_layout_info =
+      main_layout_allocator.generate_pipeline_info(device, {p_shader_info});
+
+  out_pipeline.layout =
+      main_layout_allocator.get_pipeline_layout(device, pipeline_layout_info);
+
+  VkShaderModuleCreateInfo module_info = {};
+  module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  module_info.pNext = nullptr;
+  module_info.flags = 0;
+  module_info.codeSize = p_shader_info.buffer.size() * sizeof(uint32_t);
+  module_info.pCode = p_shader_info.buffer.data();
+  VkShaderModule module;
+  VK_CHECK(vkCreateShaderModule(device, &module_info, nullptr, &module));
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.layout = out_pipeline.layout;
+  pipeline_info.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = module;
+  pipeline_info.stage.pName = "main";
+
+  auto build_start = std::chrono::high_resolution_clock::now();
+  VK_CHECK(vkCreateComputePipelines(device, pipeline_cache.get(), 1,
+                                    &pipeline_info, nullptr,
+                                    &out_pipeline.pipeline));
+  auto build_end = std::chrono::high_resolution_clock::now();
+  const double build_time =
+      std::chrono::duration<double, std::milli>(build_end - build_start)
+          .count();
+  pipeline_cache.record_build(build_time);
+  ENGINE_INFO("Compute pipeline created in {:.2f} ms ({} pipeline cache)",
+              build_time, pipeline_cache.is_warm() ? "warm" : "cold");
+
+  vkDestroyShaderModule(device, module, nullptr);
+
+  allocate_pipeline_sets(out_pipeline, pipeline_layout_info.descriptor_layouts);
 
   return out_pipeline;
 }
 
+std::future<RenderPipeline> CuRenderDevice::create_render_pipeline_async(
+    const RenderPipelineDescription &p_description) {
+  std::function<RenderPipeline()> build = [this, p_description]() {
+    std::vector<CompiledShaderInfo> shader_infos = p_description.shader_infos;
+    ShaderCompiler *shader_compiler = ShaderCompiler::get_singleton();
+    for (const std::string &shader : p_description.shaders) {
+      CompiledShaderInfo shader_info = {};
+      if (!shader_compiler ||
+          !shader_compiler->compile_shader(shader, &shader_info)) {
+        ENGINE_ERROR("Can't build pipeline, {} failed to compile", shader);
+        return RenderPipeline{};
+      }
+      shader_infos.push_back(shader_info);
+    }
+    return create_render_pipeline(
+        shader_infos, p_description.depth_write_test,
+        p_description.depth_compare_op, p_description.color_textures,
+        p_description.depth_format, p_description.vertex_formats,
+        p_description.push_constants);
+  };
+
+  CuThreadPool *thread_pool = CuThreadPool::get_singleton();
+  if (thread_pool) {
+    return thread_pool->submit(std::move(build));
+  }
+  std::promise<RenderPipeline> result;
+  result.set_value(build());
+  return result.get_future();
+}
+
 void CuRenderDevice::prepare_image(
     CuRenderAttachemnts &p_render_attachments, const Texture *p_color_texture,
-    const Texture *p_depth_texture /*= nullptr*/) {
+    const Texture *p_depth_texture /*= nullptr*/,
+    bool p_secondary /*= false*/) {
   if (p_render_attachments.color_attachments.size() == 0) {
     ENGINE_ERROR("No render attachments provided for this pass");
     return;
@@ -1079,40 +1802,66 @@ void CuRenderDevice::prepare_image(
   transition_image(cmb, p_color_texture->image, VK_IMAGE_LAYOUT_GENERAL,
                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-  for (int i = 0; i < p_render_attachments.color_attachments.size(); ++i) {
-    p_render_attachments.color_attachments[i].imageView = p_color_texture->view;
+  RenderingDescription description = {};
+  description.color_attachments = p_render_attachments.color_attachments;
+  for (VkRenderingAttachmentInfo &attachment : description.color_attachments) {
+    attachment.imageView = p_color_texture->view;
   }
+  description.color_formats.assign(description.color_attachments.size(),
+                                   p_color_texture->format);
 
   if (p_depth_texture) {
-    p_render_attachments.depth_attachment.imageView = p_depth_texture->view;
+    description.depth_attachment = p_render_attachments.depth_attachment;
+    description.depth_attachment.imageView = p_depth_texture->view;
+    description.depth_format = p_depth_texture->format;
 
     transition_image(cmb, p_depth_texture->image, VK_IMAGE_LAYOUT_UNDEFINED,
                      VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
   }
+  description.extent = {p_color_texture->extent.width,
+                        p_color_texture->extent.height};
+  begin_rendering(description, p_secondary);
+}
+
+void CuRenderDevice::begin_rendering(const RenderingDescription &p_description,
+                                     bool p_secondary /*= false*/) {
+  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
 
   VkRenderingInfo rendering_info = {};
   rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
   rendering_info.pNext = nullptr;
-  rendering_info.renderArea =
-      VkRect2D{VkOffset2D{0, 0}, VkExtent2D{p_color_texture->extent.width,
-                                            p_color_texture->extent.height}};
-  rendering_info.pColorAttachments =
-      p_render_attachments.color_attachments.data();
-  rendering_info.colorAttachmentCount =
-      p_render_attachments.color_attachments.size();
+  rendering_info.renderArea = VkRect2D{VkOffset2D{0, 0}, p_description.extent};
+  rendering_info.pColorAttachments = p_description.color_attachments.data();
+  rendering_info.colorAttachmentCount = p_description.color_attachments.size();
   rendering_info.pDepthAttachment =
-      p_depth_texture ? &p_render_attachments.depth_attachment : nullptr;
+      p_description.depth_format != VK_FORMAT_UNDEFINED
+          ? &p_description.depth_attachment
+          : nullptr;
   rendering_info.pStencilAttachment = nullptr;
   rendering_info.layerCount = 1;
+  if (p_secondary) {
+    rendering_info.flags =
+        VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
+  }
 
   vkCmdBeginRenderingKHR(cmb, &rendering_info);
 
+  active_rendering.active = true;
+  active_rendering.secondary = p_secondary;
+  active_rendering.color_formats = p_description.color_formats;
+  active_rendering.depth_format = p_description.depth_format;
+  active_rendering.extent = p_description.extent;
+  if (p_secondary) {
+    // dynamic state isn't inherited, every secondary sets its own
+    return;
+  }
+
   // set dynamic viewport and scissor
   VkViewport viewport = {};
   viewport.x = 0;
   viewport.y = 0;
-  viewport.width = p_color_texture->extent.width;
-  viewport.height = p_color_texture->extent.height;
+  viewport.width = p_description.extent.width;
+  viewport.height = p_description.extent.height;
   viewport.minDepth = 0.f;
   viewport.maxDepth = 1.f;
 
@@ -1121,30 +1870,116 @@ void CuRenderDevice::prepare_image(
   VkRect2D scissor = {};
   scissor.offset.x = 0;
   scissor.offset.y = 0;
-  scissor.extent.width = p_color_texture->extent.width;
-  scissor.extent.height = p_color_texture->extent.height;
+  scissor.extent = p_description.extent;
 
   vkCmdSetScissor(cmb, 0, 1, &scissor);
 }
 
-void CuRenderDevice::begin_recording() {
-  if (window->resize) {
-    vkDeviceWaitIdle(device);
-    swapchain.build();
+void CuRenderDevice::end_rendering() {
+  if (!active_rendering.active) {
+    return;
+  }
+  vkCmdEndRenderingKHR(frame_data[current_frame_idx].cmb);
+  active_rendering.active = false;
+}
+
+void CuRenderDevice::set_present_mode(VkPresentModeKHR p_present_mode) {
+  if (p_present_mode == options.present_mode) {
+    return;
+  }
+  options.present_mode = p_present_mode;
+  present_mode_changed = true;
+}
+
+bool CuRenderDevice::update_swapchain() {
+  if (!window->resize && !present_mode_changed && !swapchain_outdated) {
+    return true;
+  }
+  // minimised windows have nothing to present to, sleep until they're
+  // restored instead of skipping frames as fast as the loop runs
+  while ((window->width == 0 || window->height == 0) &&
+         !window->should_close()) {
+    window->wait_events();
+  }
+  if (window->width == 0 || window->height == 0) {
+    return false;
   }
+  CU_PROFILE_SCOPE("Rebuild swapchain");
+  // frames in flight may still present the old images. The current frame's
+  // fence just signalled, so its queue is flushed after all of them finished
   FrameData &current_frame = frame_data[current_frame_idx];
-  VK_CHECK(vkWaitForFences(device, 1, &current_frame.render_fence, true,
-                           1000000000));
+  if (!swapchain.build(options.present_mode, &current_frame.deletion_queue)) {
+    return false;
+  }
+  if (present_mode_changed) {
+    ENGINE_INFO("Presenting with {} (requested {})",
+                get_present_mode_name(swapchain.present_mode),
+                get_present_mode_name(options.present_mode));
+  }
+  present_mode_changed = false;
+  swapchain_outdated = false;
+  return true;
+}
 
-  VkResult next_img_result = vkAcquireNextImageKHR(
-      device, swapchain.swapchain, 1000000000,
-      current_frame.swapchain_semaphore, nullptr, &swapchain_img_index);
+bool CuRenderDevice::begin_recording() {
+  FrameData &current_frame = frame_data[current_frame_idx];
+  {
+    CU_PROFILE_SCOPE("Wait for frame fence");
+    VK_CHECK(vkWaitForFences(device, 1, &current_frame.render_fence, true,
+                             1000000000));
+  }
+  resolve_latency(current_frame);
+  current_frame.deletion_queue.flush();
+  deliver_readbacks(current_frame);
+  for (RecordingContext &context : current_frame.recording_contexts) {
+    VK_CHECK(vkResetCommandPool(device, context.cmp, 0));
+    context.used = 0;
+  }
+  // VMA refreshes its heap budgets once per frame index
+  vmaSetCurrentFrameIndex(allocator, frame_count);
+  if (options.memory_report_seconds > 0.0) {
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (now - last_memory_report >=
+        std::chrono::duration<double>(options.memory_report_seconds)) {
+      report_memory();
+      last_memory_report = now;
+    }
+  }
+  if (!options.headless && !update_swapchain()) {
+    return false;
+  }
+
+  VkResult next_img_result = VK_SUCCESS;
+  swapchain_img_index = 0;
+  if (!options.headless) {
+    CU_PROFILE_SCOPE("vkAcquireNextImageKHR");
+    next_img_result = vkAcquireNextImageKHR(
+        device, swapchain.swapchain, 1000000000,
+        current_frame.swapchain_semaphore, nullptr, &swapchain_img_index);
+  }
 
   if (next_img_result == VK_ERROR_OUT_OF_DATE_KHR) {
-    return;
+    // nothing got acquired, the frame is skipped and the fence stays signalled
+    swapchain_outdated = true;
+    return false;
+  }
+  if (next_img_result == VK_SUBOPTIMAL_KHR) {
+    // the image is still presentable, the swapchain gets rebuilt next frame
+    swapchain_outdated = true;
+  } else if (next_img_result != VK_SUCCESS) {
+    ENGINE_ERROR("Failed to acquire a swapchain image");
+    return false;
   }
 
+  // only frames that go on to reset their queries read them back, skipped
+  // frames would count the same zones again next time
+  gpu_profiler.resolve(current_frame_idx);
   VK_CHECK(vkResetFences(device, 1, &current_frame.render_fence));
+  // without a window the frame reacts to whatever was current right now
+  current_frame.input_time = window && !options.headless
+                                 ? window->get_input_time()
+                                 : std::chrono::steady_clock::now();
 
   VkCommandBuffer cmb = current_frame.cmb;
 
@@ -1157,42 +1992,168 @@ void CuRenderDevice::begin_recording() {
   main_cmb_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
   VK_CHECK(vkBeginCommandBuffer(cmb, &main_cmb_begin_info));
+  gpu_profiler.reset(cmb, current_frame_idx);
+  return true;
+}
+
+uint32_t CuRenderDevice::get_recording_thread_count() const {
+  CuThreadPool *thread_pool = CuThreadPool::get_singleton();
+  return thread_pool ? thread_pool->get_worker_count() + 1 : 1;
+}
+
+VkCommandBuffer CuRenderDevice::get_command_buffer() {
+  if (recording_cmb != VK_NULL_HANDLE) {
+    return recording_cmb;
+  }
+  return frame_data[current_frame_idx].cmb;
+}
+
+VkCommandBuffer CuRenderDevice::begin_secondary(RecordingContext &p_context) {
+  if (p_context.used == p_context.cmbs.size()) {
+    VkCommandBufferAllocateInfo command_buffer_alloc_info = {};
+    command_buffer_alloc_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_alloc_info.commandPool = p_context.cmp;
+    command_buffer_alloc_info.pNext = nullptr;
+    command_buffer_alloc_info.commandBufferCount = 1;
+    command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    VkCommandBuffer new_cmb;
+    VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_alloc_info,
+                                      &new_cmb));
+    p_context.cmbs.push_back(new_cmb);
+  }
+  VkCommandBuffer cmb = p_context.cmbs[p_context.used++];
+
+  VkCommandBufferInheritanceRenderingInfoKHR rendering_inheritance = {};
+  rendering_inheritance.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+  rendering_inheritance.pNext = nullptr;
+  rendering_inheritance.colorAttachmentCount =
+      active_rendering.color_formats.size();
+  rendering_inheritance.pColorAttachmentFormats =
+      active_rendering.color_formats.data();
+  rendering_inheritance.depthAttachmentFormat = active_rendering.depth_format;
+  rendering_inheritance.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+  rendering_inheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkCommandBufferInheritanceInfo inheritance_info = {};
+  inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritance_info.pNext =
+      active_rendering.active ? &rendering_inheritance : nullptr;
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.pInheritanceInfo = &inheritance_info;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (active_rendering.active) {
+    begin_info.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  }
+  VK_CHECK(vkBeginCommandBuffer(cmb, &begin_info));
+
+  if (active_rendering.active) {
+    VkViewport viewport = {};
+    viewport.width = active_rendering.extent.width;
+    viewport.height = active_rendering.extent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+    vkCmdSetViewport(cmb, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.extent = active_rendering.extent;
+    vkCmdSetScissor(cmb, 0, 1, &scissor);
+  }
+  return cmb;
+}
+
+void CuRenderDevice::record_parallel(
+    uint32_t p_task_count, const std::function<void(uint32_t)> &p_task) {
+  if (p_task_count == 0) {
+    return;
+  }
+  // a rendering begun for inline contents can't execute secondaries
+  if (active_rendering.active && !active_rendering.secondary) {
+    for (uint32_t i = 0; i < p_task_count; ++i) {
+      p_task(i);
+    }
+    return;
+  }
+
+  FrameData &current_frame = frame_data[current_frame_idx];
+  std::vector<VkCommandBuffer> secondaries(p_task_count);
+  std::function<void(size_t, size_t)> record = [&](size_t p_begin,
+                                                   size_t p_end) {
+    RecordingContext &context =
+        current_frame.recording_contexts[CuThreadPool::get_thread_index()];
+    for (size_t i = p_begin; i < p_end; ++i) {
+      VkCommandBuffer cmb = begin_secondary(context);
+      recording_cmb = cmb;
+      p_task(i);
+      recording_cmb = VK_NULL_HANDLE;
+      VK_CHECK(vkEndCommandBuffer(cmb));
+      secondaries[i] = cmb;
+    }
+  };
+
+  CuThreadPool *thread_pool = CuThreadPool::get_singleton();
+  if (thread_pool && p_task_count > 1) {
+    thread_pool->parallel_for(p_task_count, record);
+  } else {
+    record(0, p_task_count);
+  }
+
+  vkCmdExecuteCommands(current_frame.cmb, secondaries.size(),
+                       secondaries.data());
 }
 
 void CuRenderDevice::bind_pipeline(const RenderPipeline &p_pipeline) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   if (p_pipeline.pipeline == VK_NULL_HANDLE) {
     ENGINE_WARN("Render pipeline not allocated. Fix it.");
     return;
   }
-  vkCmdBindPipeline(cmb, VK_PIPELINE_BIND_POINT_GRAPHICS, p_pipeline.pipeline);
+  vkCmdBindPipeline(cmb, p_pipeline.bind_point, p_pipeline.pipeline);
+}
+
+void CuRenderDevice::bind_compute_pipeline(const RenderPipeline &p_pipeline) {
+  if (p_pipeline.bind_point != VK_PIPELINE_BIND_POINT_COMPUTE) {
+    ENGINE_WARN("Not a compute pipeline");
+    return;
+  }
+  bind_pipeline(p_pipeline);
 }
 
 void CuRenderDevice::bind_descriptor(const RenderPipeline &p_pipeline,
                                      const uint32_t p_index) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   if (p_pipeline.pipeline == VK_NULL_HANDLE) {
     return;
   }
-  int set_count = p_pipeline.sets.size() / FRAME_OVERLAP;
-  if (p_index >= set_count) {
+  VkDescriptorSet set = p_pipeline.get_set(current_frame_idx, p_index);
+  if (set == VK_NULL_HANDLE) {
     ENGINE_WARN("Cannot bind set: {}. Not that many sets have been allocated",
                 p_index);
     return;
   }
-  VkDescriptorSet set =
-      set_count > 1
-          ? p_pipeline.sets[FRAME_OVERLAP * current_frame_idx + p_index]
-          : p_pipeline.sets[current_frame_idx];
-  vkCmdBindDescriptorSets(cmb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          p_pipeline.layout, p_index, 1, &set, 0, 0);
+  vkCmdBindDescriptorSets(cmb, p_pipeline.bind_point, p_pipeline.layout,
+                          p_index, 1, &set, 0, 0);
+}
+
+void CuRenderDevice::bind_bindless_heap(const RenderPipeline &p_pipeline) {
+  VkCommandBuffer cmb = get_command_buffer();
+  if (p_pipeline.pipeline == VK_NULL_HANDLE || !bindless_heap.is_ready()) {
+    return;
+  }
+  VkDescriptorSet set = bindless_heap.get_set();
+  vkCmdBindDescriptorSets(cmb, p_pipeline.bind_point, p_pipeline.layout,
+                          BINDLESS_SET, 1, &set, 0, 0);
 }
 
 void CuRenderDevice::bind_push_constant(const RenderPipeline &p_pipeline,
                                         VkShaderStageFlags p_shaderStages,
                                         uint32_t p_offset, uint32_t p_size,
                                         void *p_data) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   vkCmdPushConstants(cmb, p_pipeline.layout, p_shaderStages, p_offset, p_size,
                      p_data);
 }
@@ -1201,7 +2162,7 @@ void CuRenderDevice::bind_vertex_buffer(uint32_t p_first_binding,
                                         uint32_t p_binding_count,
                                         std::vector<Buffer> p_buffers,
                                         std::vector<VkDeviceSize> p_offsets) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   std::vector<VkBuffer> raw_buffers(p_buffers.size());
   for (int i = 0; i < p_buffers.size(); ++i) {
     raw_buffers[i] = p_buffers[i].buffer;
@@ -1213,14 +2174,14 @@ void CuRenderDevice::bind_vertex_buffer(uint32_t p_first_binding,
 void CuRenderDevice::bind_index_buffer(const Buffer &p_buffer,
                                        VkDeviceSize p_offset,
                                        bool p_u32 /*= false*/) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   vkCmdBindIndexBuffer(cmb, p_buffer.buffer, p_offset,
                        p_u32 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
 }
 
 void CuRenderDevice::draw(uint32_t p_vertex_count, uint32_t p_instance_count,
                           uint32_t p_first_vertex, uint32_t p_first_instance) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   vkCmdDraw(cmb, p_vertex_count, p_instance_count, p_first_vertex,
             p_first_instance);
 }
@@ -1230,21 +2191,114 @@ void CuRenderDevice::draw_indexed(uint32_t p_index_count,
                                   uint32_t p_first_index,
                                   int32_t p_vertex_offset,
                                   uint32_t p_first_instance) {
-  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkCommandBuffer cmb = get_command_buffer();
   vkCmdDrawIndexed(cmb, p_index_count, p_instance_count, p_first_index,
                    p_vertex_offset, p_first_instance);
 }
 
+void CuRenderDevice::draw_indexed_indirect(
+    const Buffer &p_buffer, VkDeviceSize p_offset, uint32_t p_draw_count,
+    uint32_t p_stride /*= sizeof(VkDrawIndexedIndirectCommand)*/) {
+  VkCommandBuffer cmb = get_command_buffer();
+  // drawing several commands at once needs multiDrawIndirect
+  for (uint32_t i = 0; i < p_draw_count; ++i) {
+    vkCmdDrawIndexedIndirect(cmb, p_buffer.buffer, p_offset + i * p_stride, 1,
+                             p_stride);
+  }
+}
+
+void CuRenderDevice::draw_indexed_indirect_count(
+    const Buffer &p_buffer, VkDeviceSize p_offset, const Buffer &p_count_buffer,
+    VkDeviceSize p_count_offset, uint32_t p_max_draw_count,
+    uint32_t p_stride /*= sizeof(VkDrawIndexedIndirectCommand)*/) {
+  if (!draw_indirect_count_supported) {
+    draw_indexed_indirect(p_buffer, p_offset, p_max_draw_count, p_stride);
+    return;
+  }
+  VkCommandBuffer cmb = get_command_buffer();
+  vkCmdDrawIndexedIndirectCount(cmb, p_buffer.buffer, p_offset,
+                                p_count_buffer.buffer, p_count_offset,
+                                p_max_draw_count, p_stride);
+}
+
+void CuRenderDevice::update_buffer(const Buffer &p_buffer, const void *p_data,
+                                   size_t p_size,
+                                   VkDeviceSize p_offset /*= 0*/) {
+  if (active_rendering.active) {
+    ENGINE_WARN("Buffers can't be updated while rendering");
+    return;
+  }
+  VkCommandBuffer cmb = get_command_buffer();
+  vkCmdUpdateBuffer(cmb, p_buffer.buffer, p_offset, p_size, p_data);
+}
+
+void CuRenderDevice::dispatch(uint32_t p_group_count_x,
+                              uint32_t p_group_count_y /*= 1*/,
+                              uint32_t p_group_count_z /*= 1*/) {
+  VkCommandBuffer cmb = get_command_buffer();
+  vkCmdDispatch(cmb, p_group_count_x, p_group_count_y, p_group_count_z);
+}
+
+void CuRenderDevice::dispatch_indirect(const Buffer &p_buffer,
+                                       VkDeviceSize p_offset /*= 0*/) {
+  VkCommandBuffer cmb = get_command_buffer();
+  vkCmdDispatchIndirect(cmb, p_buffer.buffer, p_offset);
+}
+
+void CuRenderDevice::buffer_barrier(const Buffer &p_buffer,
+                                    VkPipelineStageFlags2 p_src_stage,
+                                    VkAccessFlags2 p_src_access,
+                                    VkPipelineStageFlags2 p_dst_stage,
+                                    VkAccessFlags2 p_dst_access) {
+  ::buffer_barrier(get_command_buffer(), p_buffer.buffer, p_src_stage,
+                   p_src_access, p_dst_stage, p_dst_access);
+}
+
+void CuRenderDevice::image_barrier(const Texture &p_texture,
+                                   VkImageLayout p_old_layout,
+                                   VkImageLayout p_new_layout,
+                                   VkPipelineStageFlags2 p_src_stage,
+                                   VkAccessFlags2 p_src_access,
+                                   VkPipelineStageFlags2 p_dst_stage,
+                                   VkAccessFlags2 p_dst_access) {
+  ::image_barrier(get_command_buffer(), p_texture.image,
+                  p_texture.aspect_flags ? p_texture.aspect_flags
+                                         : VK_IMAGE_ASPECT_COLOR_BIT,
+                  p_old_layout, p_new_layout, p_src_stage, p_src_access,
+                  p_dst_stage, p_dst_access);
+}
+
+void CuRenderDevice::image_barriers(
+    const std::vector<VkImageMemoryBarrier2> &p_barriers) {
+  if (p_barriers.empty()) {
+    return;
+  }
+  VkDependencyInfo dep_info = {};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dep_info.imageMemoryBarrierCount = p_barriers.size();
+  dep_info.pImageMemoryBarriers = p_barriers.data();
+  vkCmdPipelineBarrier2KHR(get_command_buffer(), &dep_info);
+}
+
 void CuRenderDevice::submit_image(Texture &p_from,
                                   Texture *p_to /*= nullptr*/) {
   FrameData &current_frame = frame_data[current_frame_idx];
 
   VkCommandBuffer cmb = current_frame.cmb;
 
-  vkCmdEndRenderingKHR(cmb);
+  end_rendering();
+
+  const uint32_t blit_zone = begin_gpu_zone("Present blit");
 
   transition_image(cmb, p_from.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  blit_to_swapchain(p_from, p_to);
+  end_gpu_zone(blit_zone);
+}
+
+void CuRenderDevice::blit_to_swapchain(const Texture &p_from,
+                                       Texture *p_to /*= nullptr*/) {
+  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
 
   transition_image(cmb, swapchain.images[swapchain_img_index],
                    VK_IMAGE_LAYOUT_UNDEFINED,
@@ -1262,9 +2316,147 @@ void CuRenderDevice::submit_image(Texture &p_from,
                            : swapchain.images[swapchain_img_index],
                       p_from.extent, destination_extent);
 
+  // there's no presentation engine to hand the offscreen target to
   transition_image(cmb, swapchain.images[swapchain_img_index],
                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                   VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+                   options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                    : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+}
+
+void CuRenderDevice::clear_swapchain(
+    VkClearColorValue p_color /*= {{0.0f, 0.0f, 0.0f, 1.0f}}*/) {
+  VkCommandBuffer cmb = frame_data[current_frame_idx].cmb;
+  VkImage image = swapchain.images[swapchain_img_index];
+
+  transition_image(cmb, image, VK_IMAGE_LAYOUT_UNDEFINED,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  const VkImageSubresourceRange range =
+      image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+  vkCmdClearColorImage(cmb, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       &p_color, 1, &range);
+  transition_image(cmb, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                    : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+}
+
+std::future<TextureReadback>
+CuRenderDevice::read_texture(const Texture &p_texture,
+                             VkImageLayout p_layout /*= TRANSFER_SRC*/) {
+  ReadbackRequest request = {};
+  request.image = p_texture.image;
+  request.extent = p_texture.extent;
+  request.format = p_texture.format;
+  request.layout = p_layout;
+  request.promise = std::make_shared<std::promise<TextureReadback>>();
+  std::future<TextureReadback> result = request.promise->get_future();
+  if (get_format_size(p_texture.format) == 0 ||
+      p_texture.image == VK_NULL_HANDLE) {
+    ENGINE_ERROR("Can't read back texture with format {}",
+                 string_VkFormat(p_texture.format));
+    request.promise->set_value(TextureReadback{});
+    return result;
+  }
+  readback_requests.push_back(request);
+  return result;
+}
+
+void CuRenderDevice::record_readbacks(VkCommandBuffer p_cmb) {
+  if (readback_requests.empty()) {
+    return;
+  }
+  FrameData &current_frame = frame_data[current_frame_idx];
+  for (ReadbackRequest &request : readback_requests) {
+    const VkDeviceSize size = (VkDeviceSize)request.extent.width *
+                              request.extent.height * request.extent.depth *
+                              get_format_size(request.format);
+    PendingReadback readback = {};
+    // first free buffer that is big enough
+    for (size_t i = 0; i < free_readback_buffers.size(); ++i) {
+      if (free_readback_buffers[i].size >= size) {
+        readback.buffer = free_readback_buffers[i];
+        free_readback_buffers.erase(free_readback_buffers.begin() + i);
+        break;
+      }
+    }
+    if (readback.buffer.buffer == VK_NULL_HANDLE) {
+      readback.buffer =
+          create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VMA_MEMORY_USAGE_GPU_TO_CPU, MEMORY_READBACK);
+    }
+    readback.extent = request.extent;
+    readback.format = request.format;
+    readback.promise = request.promise;
+
+    if (request.layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+      transition_image(p_cmb, request.image, request.layout,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    }
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = request.extent;
+    vkCmdCopyImageToBuffer(p_cmb, request.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readback.buffer.buffer, 1, &region);
+    if (request.layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+      transition_image(p_cmb, request.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, request.layout);
+    }
+    current_frame.readbacks.push_back(readback);
+  }
+  readback_requests.clear();
+
+  // the copies have to be visible to the host once the fence signals
+  VkMemoryBarrier2 host_barrier = {};
+  host_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+  host_barrier.pNext = nullptr;
+  host_barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+  host_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  host_barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+  host_barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+  VkDependencyInfo dep_info = {};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dep_info.pNext = nullptr;
+  dep_info.memoryBarrierCount = 1;
+  dep_info.pMemoryBarriers = &host_barrier;
+  vkCmdPipelineBarrier2KHR(p_cmb, &dep_info);
+}
+
+void CuRenderDevice::deliver_readbacks(FrameData &p_frame) {
+  for (PendingReadback &readback : p_frame.readbacks) {
+    TextureReadback result = {};
+    result.extent = readback.extent;
+    result.format = readback.format;
+    result.pixels.resize((size_t)readback.extent.width *
+                         readback.extent.height * readback.extent.depth *
+                         get_format_size(readback.format));
+    if (!(readback.buffer.memory_flags &
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+      vmaInvalidateAllocation(allocator, readback.buffer.allocation, 0,
+                              VK_WHOLE_SIZE);
+    }
+    memcpy(result.pixels.data(), readback.buffer.info.pMappedData,
+           result.pixels.size());
+    readback.promise->set_value(std::move(result));
+    free_readback_buffers.push_back(readback.buffer);
+  }
+  p_frame.readbacks.clear();
+}
+
+uint32_t CuRenderDevice::begin_gpu_zone(const std::string &p_name) {
+  return gpu_profiler.begin_zone(frame_data[current_frame_idx].cmb,
+                                 current_frame_idx, p_name);
+}
+
+void CuRenderDevice::end_gpu_zone(uint32_t p_zone) {
+  gpu_profiler.end_zone(frame_data[current_frame_idx].cmb, current_frame_idx,
+                        p_zone);
 }
 
 void CuRenderDevice::finish_recording() {
@@ -1272,6 +2464,7 @@ void CuRenderDevice::finish_recording() {
 
   VkCommandBuffer cmb = current_frame.cmb;
 
+  record_readbacks(cmb);
   VK_CHECK(vkEndCommandBuffer(cmb));
 
   VkCommandBufferSubmitInfo cmb_submit_info = {};
@@ -1280,7 +2473,8 @@ void CuRenderDevice::finish_recording() {
   cmb_submit_info.commandBuffer = cmb;
   cmb_submit_info.deviceMask = 0;
 
-  VkSemaphoreSubmitInfo wait_info = {};
+  std::array<VkSemaphoreSubmitInfo, 2> wait_infos = {};
+  VkSemaphoreSubmitInfo &wait_info = wait_infos[0];
   wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
   wait_info.pNext = nullptr;
   wait_info.semaphore = current_frame.swapchain_semaphore;
@@ -1288,6 +2482,15 @@ void CuRenderDevice::finish_recording() {
   wait_info.deviceIndex = 0;
   wait_info.value = 1;
 
+  // the frame may read anything that got uploaded up to now
+  VkSemaphoreSubmitInfo &upload_wait_info = wait_infos[1];
+  upload_wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  upload_wait_info.pNext = nullptr;
+  upload_wait_info.semaphore = upload_manager.get_semaphore();
+  upload_wait_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  upload_wait_info.deviceIndex = 0;
+  upload_wait_info.value = upload_manager.flush();
+
   VkSemaphoreSubmitInfo signal_info = {};
   signal_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
   signal_info.pNext = nullptr;
@@ -1299,15 +2502,29 @@ void CuRenderDevice::finish_recording() {
   VkSubmitInfo2KHR submit_info = {};
   submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2_KHR;
   submit_info.pNext = nullptr;
-  submit_info.waitSemaphoreInfoCount = 1;
-  submit_info.pWaitSemaphoreInfos = &wait_info;
+  submit_info.waitSemaphoreInfoCount = wait_infos.size();
+  submit_info.pWaitSemaphoreInfos = wait_infos.data();
   submit_info.signalSemaphoreInfoCount = 1;
   submit_info.pSignalSemaphoreInfos = &signal_info;
   submit_info.commandBufferInfoCount = 1;
   submit_info.pCommandBufferInfos = &cmb_submit_info;
+  if (options.headless) {
+    // nothing got acquired or will be presented, the fence is all we need
+    submit_info.waitSemaphoreInfoCount = 1;
+    submit_info.pWaitSemaphoreInfos = &upload_wait_info;
+    submit_info.signalSemaphoreInfoCount = 0;
+    submit_info.pSignalSemaphoreInfos = nullptr;
+  }
 
-  VK_CHECK(vkQueueSubmit2KHR(graphics_queue, 1, &submit_info,
-                             current_frame.render_fence));
+  queue_submit(graphics_queue, submit_info, current_frame.render_fence);
+
+  if (options.headless) {
+    current_frame.present_time = std::chrono::steady_clock::now();
+    current_frame.latency_pending = true;
+    current_frame_idx = (current_frame_idx + 1) % frame_data.size();
+    frame_count++;
+    return;
+  }
 
   VkPresentInfoKHR present_info = {};
   present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1318,26 +2535,70 @@ void CuRenderDevice::finish_recording() {
   present_info.waitSemaphoreCount = 1;
   present_info.pImageIndices = &swapchain_img_index;
 
-  VkResult result = vkQueuePresentKHR(graphics_queue, &present_info);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || window->resize) {
-    return;
+  VkResult result;
+  {
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    result = vkQueuePresentKHR(graphics_queue, &present_info);
+  }
+  current_frame.present_time = std::chrono::steady_clock::now();
+  current_frame.latency_pending = true;
+  // the present still waits on the render semaphore when it gets rejected,
+  // so the frame is done either way
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    swapchain_outdated = true;
   } else if (result != VK_SUCCESS) {
     ENGINE_ERROR("Failed to present graphics queue");
-    return;
   }
 
-  current_frame_idx = (current_frame_idx + 1) % FRAME_OVERLAP;
+  current_frame_idx = (current_frame_idx + 1) % frame_data.size();
   frame_count++;
 }
 
+void CuRenderDevice::resolve_latency(FrameData &p_frame) {
+  if (!p_frame.latency_pending) {
+    return;
+  }
+  p_frame.latency_pending = false;
+  auto to_milliseconds = [&](std::chrono::steady_clock::time_point p_time) {
+    return std::chrono::duration<double, std::milli>(p_time -
+                                                     p_frame.input_time)
+        .count();
+  };
+  FrameLatency sample = {};
+  sample.input_to_present_milliseconds = to_milliseconds(p_frame.present_time);
+  sample.input_to_completion_milliseconds =
+      to_milliseconds(std::chrono::steady_clock::now());
+  latency_history[latency_sample_count % FRAME_LATENCY_HISTORY] = sample;
+  latency_sample_count++;
+
+  const uint32_t count =
+      std::min<uint32_t>(latency_sample_count, FRAME_LATENCY_HISTORY);
+  latency = {};
+  for (uint32_t i = 0; i < count; ++i) {
+    latency.input_to_present_milliseconds +=
+        latency_history[i].input_to_present_milliseconds / count;
+    latency.input_to_completion_milliseconds +=
+        latency_history[i].input_to_completion_milliseconds / count;
+  }
+}
+
 void CuRenderDevice::stop_rendering() { vkDeviceWaitIdle(device); }
 
 void CuRenderDevice::clear() {
-  for (int i = 0; i < FRAME_OVERLAP; ++i) {
-    FrameData &current_frame = frame_data[i];
-    current_frame.deletion_queue.execute();
-    current_frame.descriptor_allocator.destroy_pools(device);
+  for (int i = 0; i < frame_data.size(); ++i) {
+    frame_data[i].deletion_queue.flush();
+    // the device is idle, whatever got copied is complete
+    deliver_readbacks(frame_data[i]);
+  }
+  for (Buffer &buffer : free_readback_buffers) {
+    clear_buffer(buffer);
+  }
+  free_readback_buffers.clear();
+  // requests that never got recorded still owe their futures a value
+  for (ReadbackRequest &request : readback_requests) {
+    request.promise->set_value(TextureReadback{});
   }
+  readback_requests.clear();
   main_layout_allocator.clear();
   main_deletion_queue.execute();
 }
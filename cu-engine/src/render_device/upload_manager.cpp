@@ -0,0 +1,367 @@
+#include "upload_manager.h"
+#include "render_device.h"
+#include "profiler.h"
+#include <thread>
+
+const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void UploadManager::init(CuRenderDevice *p_device, VkQueue p_queue,
+                         uint32_t p_queue_family, bool p_dedicated_queue,
+                         VkDeviceSize p_ring_size /*= 32 * 1024 * 1024*/) {
+  render_device = p_device;
+  device = p_device->get_raw_device();
+  queue = p_queue;
+  queue_family = p_queue_family;
+  dedicated_queue = p_dedicated_queue;
+
+  VkCommandPoolCreateInfo command_pool_info = {};
+  command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  command_pool_info.queueFamilyIndex = queue_family;
+  command_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                            VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  command_pool_info.pNext = nullptr;
+  VK_CHECK(
+      vkCreateCommandPool(device, &command_pool_info, nullptr, &command_pool));
+
+  VkSemaphoreTypeCreateInfo timeline_info = {};
+  timeline_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  timeline_info.pNext = nullptr;
+  timeline_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timeline_info.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphore_info = {};
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphore_info.pNext = &timeline_info;
+  semaphore_info.flags = 0;
+  VK_CHECK(vkCreateSemaphore(device, &semaphore_info, nullptr, &timeline));
+
+  ring_size = p_ring_size;
+  ring = render_device->create_buffer(ring_size,
+                                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                     VMA_MEMORY_USAGE_CPU_ONLY, MEMORY_STAGING);
+  head = 0;
+  used = 0;
+  pending_bytes = 0;
+  submitted_value = 0;
+
+  ENGINE_INFO("Upload manager ready. {} KiB staging ring on {} queue",
+              ring_size / 1024,
+              dedicated_queue ? "a dedicated transfer" : "the graphics");
+}
+
+uint64_t UploadManager::upload(const void *p_data, VkDeviceSize p_size,
+                               const Buffer &p_destination,
+                               VkDeviceSize p_destination_offset /*= 0*/) {
+  StagingRegion region = reserve(p_size);
+  if (!region.data) {
+    return submitted_value;
+  }
+  memcpy(region.data, p_data, p_size);
+  return commit(region, p_destination, p_destination_offset);
+}
+
+StagingRegion UploadManager::reserve(VkDeviceSize p_size) {
+  std::lock_guard<std::mutex> guard(mutex);
+  StagingRegion region = {};
+  region.size = p_size;
+  if (p_size == 0 || ring.buffer == VK_NULL_HANDLE) {
+    return region;
+  }
+  reclaim();
+
+  VkDeviceSize offset = 0;
+  bool in_ring = false;
+  if (p_size <= ring_size) {
+    while (!(in_ring = allocate_from_ring(p_size, offset))) {
+      if (!in_flight.empty()) {
+        // the ring is full, make room by waiting for the oldest batch
+        uint64_t value = in_flight.front().value;
+        VkSemaphoreWaitInfo wait_info = {};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &timeline;
+        wait_info.pValues = &value;
+        VK_CHECK(vkWaitSemaphores(device, &wait_info, UINT64_MAX));
+        reclaim();
+      } else if (!pending_copies.empty() && open_regions == 0) {
+        flush_locked();
+      } else {
+        break;
+      }
+    }
+  }
+
+  if (in_ring) {
+    region.source = ring.buffer;
+    region.offset = offset;
+    region.data = static_cast<char *>(ring.info.pMappedData) + offset;
+  } else {
+    // too big for the ring or the ring is held by open regions
+    region.dedicated = render_device->create_buffer(
+        p_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+        MEMORY_STAGING);
+    region.source = region.dedicated.buffer;
+    region.offset = 0;
+    region.data = region.dedicated.info.pMappedData;
+  }
+  open_regions++;
+  return region;
+}
+
+uint64_t UploadManager::commit(StagingRegion &p_region,
+                               const Buffer &p_destination,
+                               VkDeviceSize p_destination_offset /*= 0*/) {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (p_region.source == VK_NULL_HANDLE) {
+    return submitted_value;
+  }
+  open_regions--;
+
+  if (p_region.dedicated.buffer != VK_NULL_HANDLE) {
+    render_device->flush_buffer(p_region.dedicated);
+    pending_dedicated.push_back(p_region.dedicated);
+  } else {
+    render_device->flush_buffer(ring, p_region.offset, p_region.size);
+  }
+
+  PendingCopy copy = {};
+  copy.source = p_region.source;
+  copy.destination = p_destination.buffer;
+  copy.region.srcOffset = p_region.offset;
+  copy.region.dstOffset = p_destination_offset;
+  copy.region.size = p_region.size;
+  pending_copies.push_back(copy);
+
+  p_region = {};
+  return submitted_value + 1;
+}
+
+void UploadManager::cancel(StagingRegion &p_region) {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (p_region.source == VK_NULL_HANDLE) {
+    return;
+  }
+  open_regions--;
+
+  if (p_region.dedicated.buffer != VK_NULL_HANDLE) {
+    render_device->clear_buffer(p_region.dedicated);
+  } else if (pending_copies.empty() && open_regions == 0) {
+    // nothing else was handed out since the last batch, rewind the ring
+    head = (head + ring_size - pending_bytes) % ring_size;
+    used -= pending_bytes;
+    pending_bytes = 0;
+  }
+  // otherwise the ring bytes are given back with the next batch
+  p_region = {};
+}
+
+uint64_t UploadManager::copy(const Buffer &p_source,
+                             const Buffer &p_destination,
+                             VkDeviceSize p_size) {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (p_size == 0 || p_source.buffer == VK_NULL_HANDLE ||
+      p_destination.buffer == VK_NULL_HANDLE) {
+    return submitted_value;
+  }
+  PendingCopy copy = {};
+  copy.source = p_source.buffer;
+  copy.destination = p_destination.buffer;
+  copy.region.srcOffset = 0;
+  copy.region.dstOffset = 0;
+  copy.region.size = p_size;
+  copy.wait_for_writes = true;
+  pending_copies.push_back(copy);
+  return submitted_value + 1;
+}
+
+uint64_t UploadManager::flush() {
+  std::lock_guard<std::mutex> guard(mutex);
+  reclaim();
+  if (open_regions > 0) {
+    // the ring bytes of open regions belong to this batch, try again later
+    return submitted_value;
+  }
+  return flush_locked();
+}
+
+bool UploadManager::is_complete(uint64_t p_value) {
+  uint64_t value = 0;
+  VK_CHECK(vkGetSemaphoreCounterValue(device, timeline, &value));
+  return value >= p_value;
+}
+
+void UploadManager::wait(uint64_t p_value) {
+  uint64_t flushed = flush();
+  while (flushed < p_value) {
+    if (p_value > flushed + 1) {
+      ENGINE_WARN("Upload {} was never queued, can't wait for it", p_value);
+      return;
+    }
+    // regions that are still being written hold the batch back
+    std::this_thread::yield();
+    flushed = flush();
+  }
+  VkSemaphoreWaitInfo wait_info = {};
+  wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &timeline;
+  wait_info.pValues = &p_value;
+  CU_PROFILE_SCOPE("Wait for upload");
+  VK_CHECK(vkWaitSemaphores(device, &wait_info, UINT64_MAX));
+}
+
+void UploadManager::clear() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+  wait(submitted_value);
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    reclaim();
+    for (Buffer &buffer : pending_dedicated) {
+      render_device->clear_buffer(buffer);
+    }
+    pending_dedicated.clear();
+    pending_copies.clear();
+  }
+  render_device->clear_buffer(ring);
+  ring = {};
+  vkDestroySemaphore(device, timeline, nullptr);
+  vkDestroyCommandPool(device, command_pool, nullptr);
+  free_command_buffers.clear();
+  device = VK_NULL_HANDLE;
+}
+
+bool UploadManager::allocate_from_ring(VkDeviceSize p_size,
+                                       VkDeviceSize &p_out_offset) {
+  const VkDeviceSize size =
+      (p_size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+  if (used == 0) {
+    head = 0;
+  }
+  if (used >= ring_size || size > ring_size) {
+    return false;
+  }
+  const VkDeviceSize tail = (head + ring_size - used) % ring_size;
+  VkDeviceSize consumed = 0;
+  if (head >= tail) {
+    // free space is [head, end) followed by [0, tail)
+    if (ring_size - head >= size) {
+      p_out_offset = head;
+      consumed = size;
+    } else if (tail >= size) {
+      p_out_offset = 0;
+      consumed = ring_size - head + size;
+    } else {
+      return false;
+    }
+  } else if (tail - head >= size) {
+    p_out_offset = head;
+    consumed = size;
+  } else {
+    return false;
+  }
+  head = (p_out_offset + size) % ring_size;
+  used += consumed;
+  pending_bytes += consumed;
+  return true;
+}
+
+void UploadManager::reclaim() {
+  uint64_t completed = 0;
+  VK_CHECK(vkGetSemaphoreCounterValue(device, timeline, &completed));
+  while (!in_flight.empty() && in_flight.front().value <= completed) {
+    InFlightBatch &batch = in_flight.front();
+    used -= batch.bytes;
+    free_command_buffers.push_back(batch.cmb);
+    for (Buffer &buffer : batch.dedicated) {
+      render_device->clear_buffer(buffer);
+    }
+    in_flight.pop_front();
+  }
+}
+
+uint64_t UploadManager::flush_locked() {
+  if (pending_copies.empty()) {
+    return submitted_value;
+  }
+  VkCommandBuffer cmb = get_command_buffer();
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.pInheritanceInfo = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VK_CHECK(vkBeginCommandBuffer(cmb, &begin_info));
+
+  for (const PendingCopy &copy : pending_copies) {
+    if (copy.wait_for_writes) {
+      // earlier batches are covered too, they were submitted to this queue
+      buffer_barrier(cmb, copy.source, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                     VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                     VK_ACCESS_2_TRANSFER_READ_BIT);
+    }
+    vkCmdCopyBuffer(cmb, copy.source, copy.destination, 1, &copy.region);
+  }
+
+  VK_CHECK(vkEndCommandBuffer(cmb));
+
+  InFlightBatch batch = {};
+  batch.value = submitted_value + 1;
+  batch.cmb = cmb;
+  batch.bytes = pending_bytes;
+  batch.dedicated = std::move(pending_dedicated);
+
+  VkCommandBufferSubmitInfo cmb_submit_info = {};
+  cmb_submit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+  cmb_submit_info.pNext = nullptr;
+  cmb_submit_info.commandBuffer = cmb;
+  cmb_submit_info.deviceMask = 0;
+
+  VkSemaphoreSubmitInfo signal_info = {};
+  signal_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  signal_info.pNext = nullptr;
+  signal_info.semaphore = timeline;
+  signal_info.stageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  signal_info.deviceIndex = 0;
+  signal_info.value = batch.value;
+
+  VkSubmitInfo2KHR submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2_KHR;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreInfoCount = 0;
+  submit_info.pWaitSemaphoreInfos = nullptr;
+  submit_info.signalSemaphoreInfoCount = 1;
+  submit_info.pSignalSemaphoreInfos = &signal_info;
+  submit_info.commandBufferInfoCount = 1;
+  submit_info.pCommandBufferInfos = &cmb_submit_info;
+
+  render_device->queue_submit(queue, submit_info, VK_NULL_HANDLE);
+
+  submitted_value = batch.value;
+  in_flight.push_back(std::move(batch));
+  pending_copies.clear();
+  pending_dedicated.clear();
+  pending_bytes = 0;
+  return submitted_value;
+}
+
+VkCommandBuffer UploadManager::get_command_buffer() {
+  if (!free_command_buffers.empty()) {
+    VkCommandBuffer cmb = free_command_buffers.back();
+    free_command_buffers.pop_back();
+    VK_CHECK(vkResetCommandBuffer(cmb, 0));
+    return cmb;
+  }
+  VkCommandBufferAllocateInfo command_buffer_alloc_info = {};
+  command_buffer_alloc_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  command_buffer_alloc_info.commandPool = command_pool;
+  command_buffer_alloc_info.pNext = nullptr;
+  command_buffer_alloc_info.commandBufferCount = 1;
+  command_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  VkCommandBuffer cmb;
+  VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_alloc_info, &cmb));
+  return cmb;
+}
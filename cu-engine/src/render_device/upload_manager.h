@@ -0,0 +1,120 @@
+#pragma once
+
+#define VK_NO_PROTOTYPES
+#include <volk.h>
+#include "utils.h"
+#include <deque>
+#include <mutex>
+#include <vector>
+
+class CuRenderDevice;
+
+/**
+Memory handed out by UploadManager::reserve(). Write p_size bytes into data
+and hand it back through UploadManager::commit().
+ */
+struct StagingRegion {
+  void *data = nullptr;
+  VkDeviceSize size = 0;
+  VkDeviceSize offset = 0;
+  VkBuffer source = VK_NULL_HANDLE;
+  // only used when the request didn't fit into the staging ring
+  Buffer dedicated = {};
+};
+
+/**
+Batches buffer uploads through a persistently mapped staging ring and submits
+them on the transfer queue (the graphics queue when the GPU has no dedicated
+one). Completion is signalled through a timeline semaphore, every upload
+returns the value that marks it as done.
+upload(), reserve() and commit() can be called from any thread.
+ */
+class UploadManager {
+public:
+  void init(CuRenderDevice *p_device, VkQueue p_queue, uint32_t p_queue_family,
+            bool p_dedicated_queue,
+            VkDeviceSize p_ring_size = 32 * 1024 * 1024);
+  /**
+   copies p_data into staging memory and queues a copy into p_destination.
+   */
+  uint64_t upload(const void *p_data, VkDeviceSize p_size,
+                  const Buffer &p_destination,
+                  VkDeviceSize p_destination_offset = 0);
+  /**
+   hands out staging memory so data can be written in place. Keep the time
+   between reserve() and commit() short, batches aren't submitted while a
+   region is open.
+   */
+  StagingRegion reserve(VkDeviceSize p_size);
+  uint64_t commit(StagingRegion &p_region, const Buffer &p_destination,
+                  VkDeviceSize p_destination_offset = 0);
+  /**
+   gives back a reserved region without uploading it.
+   */
+  void cancel(StagingRegion &p_region);
+  /**
+   queues a copy of p_size bytes between two device buffers. It runs after
+   every upload committed before it, so p_source can still be receiving
+   data.
+   */
+  uint64_t copy(const Buffer &p_source, const Buffer &p_destination,
+                VkDeviceSize p_size);
+  /**
+   submits every committed copy in one command buffer. Returns the timeline
+   value that signals once all of them are done.
+   */
+  uint64_t flush();
+  bool is_complete(uint64_t p_value);
+  /**
+   blocks until p_value is signalled. Flushes first if needed.
+   */
+  void wait(uint64_t p_value);
+  void clear();
+
+  VkSemaphore get_semaphore() const { return timeline; }
+  uint64_t get_submitted_value() const { return submitted_value; }
+  bool is_dedicated_queue() const { return dedicated_queue; }
+
+private:
+  struct PendingCopy {
+    VkBuffer source;
+    VkBuffer destination;
+    VkBufferCopy region;
+    // the source is written by earlier copies of the batch
+    bool wait_for_writes = false;
+  };
+
+  struct InFlightBatch {
+    uint64_t value;
+    VkCommandBuffer cmb;
+    VkDeviceSize bytes;
+    std::vector<Buffer> dedicated;
+  };
+
+  bool allocate_from_ring(VkDeviceSize p_size, VkDeviceSize &p_out_offset);
+  void reclaim();
+  uint64_t flush_locked();
+  VkCommandBuffer get_command_buffer();
+
+  CuRenderDevice *render_device = nullptr;
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  uint32_t queue_family = 0;
+  bool dedicated_queue = false;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> free_command_buffers;
+  VkSemaphore timeline = VK_NULL_HANDLE;
+  uint64_t submitted_value = 0;
+
+  Buffer ring;
+  VkDeviceSize ring_size = 0;
+  VkDeviceSize head = 0;
+  VkDeviceSize used = 0;
+  VkDeviceSize pending_bytes = 0;
+  int open_regions = 0;
+
+  std::vector<PendingCopy> pending_copies;
+  std::vector<Buffer> pending_dedicated;
+  std::deque<InFlightBatch> in_flight;
+  std::mutex mutex;
+};
@@ -66,6 +66,55 @@ void copy_image_to_image(VkCommandBuffer command_buffer, VkImage source, VkImage
 	vkCmdBlitImage2KHR(command_buffer, &blitInfo);
 }
 
+void buffer_barrier(VkCommandBuffer command_buffer, VkBuffer buffer, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access, VkDeviceSize offset, VkDeviceSize size) {
+    VkBufferMemoryBarrier2 buffer_barrier = {};
+    buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    buffer_barrier.pNext = nullptr;
+    buffer_barrier.srcStageMask = src_stage;
+    buffer_barrier.srcAccessMask = src_access;
+    buffer_barrier.dstStageMask = dst_stage;
+    buffer_barrier.dstAccessMask = dst_access;
+    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.buffer = buffer;
+    buffer_barrier.offset = offset;
+    buffer_barrier.size = size;
+
+    VkDependencyInfo dep_info = {};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dep_info.pNext = nullptr;
+
+    dep_info.bufferMemoryBarrierCount = 1;
+    dep_info.pBufferMemoryBarriers = &buffer_barrier;
+
+    vkCmdPipelineBarrier2KHR(command_buffer, &dep_info);
+}
+
+void image_barrier(VkCommandBuffer command_buffer, VkImage image, VkImageAspectFlags aspect_mask, VkImageLayout old_layout, VkImageLayout new_layout, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access) {
+    VkImageMemoryBarrier2 image_barrier = {};
+    image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    image_barrier.pNext = nullptr;
+    image_barrier.srcStageMask = src_stage;
+    image_barrier.srcAccessMask = src_access;
+    image_barrier.dstStageMask = dst_stage;
+    image_barrier.dstAccessMask = dst_access;
+    image_barrier.oldLayout = old_layout;
+    image_barrier.newLayout = new_layout;
+    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.subresourceRange = image_subresource_range(aspect_mask);
+    image_barrier.image = image;
+
+    VkDependencyInfo dep_info = {};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dep_info.pNext = nullptr;
+
+    dep_info.imageMemoryBarrierCount = 1;
+    dep_info.pImageMemoryBarriers = &image_barrier;
+
+    vkCmdPipelineBarrier2KHR(command_buffer, &dep_info);
+}
+
 VkImageSubresourceRange image_subresource_range(VkImageAspectFlags aspect_mask) {
     VkImageSubresourceRange sub_image = {};
     sub_image.aspectMask = aspect_mask;
@@ -31,6 +31,12 @@ public:
     }
   }
 
+  // executes and forgets the queued functors so the queue can be reused.
+  void flush() {
+    execute();
+    queue.clear();
+  }
+
 private:
   bool reverse = false;
   std::deque<std::function<void()>> queue;
@@ -49,6 +55,9 @@ struct Buffer {
   VkBuffer buffer = VK_NULL_HANDLE;
   VmaAllocation allocation;
   VmaAllocationInfo info;
+  VkMemoryPropertyFlags memory_flags = 0;
+  // what was asked for, info.size is the allocation and can be bigger
+  VkDeviceSize size = 0;
 };
 
 void transition_image(VkCommandBuffer command_buffer, VkImage image,
@@ -57,6 +66,25 @@ void copy_image_to_image(VkCommandBuffer command_buffer, VkImage source,
                          VkImage destination, VkExtent3D src_size,
                          VkExtent3D dst_size);
 
+/**
+makes size bytes of buffer from offset on, written in the source stages,
+available to the destination stages.
+ */
+void buffer_barrier(VkCommandBuffer command_buffer, VkBuffer buffer,
+                    VkPipelineStageFlags2 src_stage,
+                    VkAccessFlags2 src_access,
+                    VkPipelineStageFlags2 dst_stage,
+                    VkAccessFlags2 dst_access, VkDeviceSize offset = 0,
+                    VkDeviceSize size = VK_WHOLE_SIZE);
+/**
+like transition_image() but limited to the given stages and accesses.
+ */
+void image_barrier(VkCommandBuffer command_buffer, VkImage image,
+                   VkImageAspectFlags aspect_mask, VkImageLayout old_layout,
+                   VkImageLayout new_layout, VkPipelineStageFlags2 src_stage,
+                   VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage,
+                   VkAccessFlags2 dst_access);
+
 VkImageSubresourceRange image_subresource_range(VkImageAspectFlags aspect_mask);
 
 VkImageCreateInfo image_create_info(VkFormat format,
@@ -1,149 +1,527 @@
 #include "geometry_pass.h"
 #include "camera.h"
 #include "item.h"
+#include "profiler.h"
+#include "render_device/instance_buffer.h"
 #include "render_device/render_device.h"
-#include "shader_compiler.h"
-#include <array>
+#include "render_graph.h"
+#include <algorithm>
+#include <cstdlib>
+#include <future>
 
 #include <vector>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <gtx/transform.hpp>
 
-Texture color_texture;
-Texture depth_texture;
-RenderPipeline triangle_pipeline;
-Buffer test_buffer;
-Buffer transform_buffer;
+const VkFormat COLOR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+const VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+// graph textures, the depth buffer is transient and never stored
+uint32_t scene_color = RenderGraph::INVALID_TEXTURE;
+uint32_t scene_depth = RenderGraph::INVALID_TEXTURE;
+// one pipeline per vertex format of CuMeshRegistry
+RenderPipeline triangle_pipelines[VERTEX_FORMAT_COUNT];
+const char *VERTEX_SHADERS[VERTEX_FORMAT_COUNT] = {
+    "assets/shaders/test.vert", "assets/shaders/test_compressed.vert"};
+// one copy per frame in flight so the CPU never writes into a buffer that
+// the GPU is still reading from.
+Buffer test_buffers[MAX_FRAME_OVERLAP];
+// CU_BINDLESS=1 reads the material from the bindless heap through an index
+// pushed per draw instead of binding 1 of set 1
+bool bindless = false;
+uint32_t material_indices[MAX_FRAME_OVERLAP] = {};
+// follows the vertex stage's MeshBoundsConstants
+const uint32_t MATERIAL_INDEX_OFFSET = sizeof(MeshBoundsConstants);
+InstanceBuffer transform_buffer;
+// frame copies that still hold outdated transforms.
+bool stale_transforms[MAX_FRAME_OVERLAP] = {};
 
 DescriptorWriter geometry_descriptor_writer = {};
+// below this many draws per thread recording in parallel doesn't pay off,
+// every secondary command buffer binds the pipelines and sets again
+const uint32_t BATCHES_PER_CHUNK = 64;
 
-void GeometryPass::init() {
-  device = CuRenderDevice::get_singleton();
-  camera_manager = CameraManager::get_singleton();
-  if (!device || !camera_manager) {
-    return;
-  }
+// GPU driven path, a compute pass culls the instances and writes the draws
+RenderPipeline cull_pipeline;
+RenderPipeline indirect_pipelines[VERTEX_FORMAT_COUNT];
+const char *INDIRECT_VERTEX_SHADERS[VERTEX_FORMAT_COUNT] = {
+    "assets/shaders/indirect.vert", "assets/shaders/indirect_compressed.vert"};
+// indices of the instances that passed culling, only the GPU writes them
+InstanceBuffer visible_buffer;
+// draw count followed by one draw command per mesh batch
+Buffer indirect_buffers[MAX_FRAME_OVERLAP];
+// local bounding sphere of every batch's mesh
+Buffer batch_bounds_buffers[MAX_FRAME_OVERLAP];
+bool gpu_culling = false;
+// items in the order their instance data is written, sorted by mesh. The
+// CPU path only keeps the ones the item tree found visible.
+std::vector<CuItem *> draw_list;
+// what update() prepared for the graph pass to draw
+bool draw_indirect = false;
 
-  VkExtent2D extent = device->get_swapchain_size();
+const uint32_t CULL_GROUP_SIZE = 64;
+// the command templates get written with vkCmdUpdateBuffer, which is
+// limited to 64 KiB
+const uint32_t MAX_GPU_BATCHES = 1024;
 
-  VkImageUsageFlags draw_image_usage_flags = {};
-  draw_image_usage_flags |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-  draw_image_usage_flags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-  draw_image_usage_flags |= VK_IMAGE_USAGE_STORAGE_BIT;
-  draw_image_usage_flags |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-  device->create_texture(
-      VK_FORMAT_R16G16B16A16_SFLOAT, {extent.width, extent.height, 1},
-      draw_image_usage_flags, VMA_MEMORY_USAGE_GPU_ONLY, color_texture);
+struct CullConstants {
+  glm::vec4 planes[6];
+  uint32_t instance_count;
+  uint32_t batch_count;
+};
 
-  device->create_texture(VK_FORMAT_D32_SFLOAT, {extent.width, extent.height, 1},
-                         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-                         VMA_MEMORY_USAGE_GPU_ONLY, depth_texture);
+struct DrawCountHeader {
+  uint32_t draw_count;
+  uint32_t padding[3];
+};
 
-  std::array<std::string, 2> shaders = {"assets/shaders/test.vert",
-                                        "assets/shaders/test.frag"};
-  std::vector<CompiledShaderInfo> shader_infos(shaders.size());
-  for (int i = 0; i < shader_infos.size(); ++i) {
-    ShaderCompiler *shader_compiler = ShaderCompiler::get_singleton();
-    if (!shader_compiler) {
-      break;
-    }
-    if (!shader_compiler->compile_shader(shaders[i], &shader_infos[i])) {
-      return;
-    }
-  }
+const VkDeviceSize DRAW_COMMANDS_OFFSET = sizeof(DrawCountHeader);
+const VkDeviceSize INDIRECT_BUFFER_SIZE =
+    sizeof(DrawCountHeader) +
+    sizeof(VkDrawIndexedIndirectCommand) * MAX_GPU_BATCHES;
 
-  triangle_pipeline = device->create_render_pipeline(
-      shader_infos, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL, {color_texture},
-      depth_texture.format);
-  {
+static void write_geometry_sets(const RenderPipeline &p_pipeline,
+                                CameraManager *p_camera_manager) {
+  for (uint32_t i = 0; i < p_pipeline.frame_overlap; ++i) {
     // set 0
     geometry_descriptor_writer.write_buffer(
-        0, camera_manager->get_camera_buffer(), 0, sizeof(glm::mat4) * 2,
+        0, p_camera_manager->get_camera_buffer(), 0, sizeof(glm::mat4) * 2,
         VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-    geometry_descriptor_writer.update_set(triangle_pipeline.sets[0]);
-    geometry_descriptor_writer.update_set(triangle_pipeline.sets[2]);
+    geometry_descriptor_writer.update_set(p_pipeline.get_set(i, 0));
     geometry_descriptor_writer.clear();
-  }
-  {
+
+    if (bindless) {
+      continue;
+    }
     // set 1
-    transform_buffer = device->create_buffer(sizeof(glm::mat4) * 1000,
-                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                             VMA_MEMORY_USAGE_CPU_TO_GPU);
-    test_buffer = device->create_buffer(sizeof(float) * 4,
-                                        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                        VMA_MEMORY_USAGE_CPU_TO_GPU);
-    geometry_descriptor_writer.write_buffer(0, transform_buffer, 0,
-                                            sizeof(glm::mat4) * 1000,
-                                            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-
-    geometry_descriptor_writer.write_buffer(1, test_buffer, 0,
+    geometry_descriptor_writer.write_buffer(1, test_buffers[i], 0,
                                             sizeof(float) * 4,
                                             VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-    geometry_descriptor_writer.update_set(triangle_pipeline.sets[1]);
-    geometry_descriptor_writer.update_set(triangle_pipeline.sets[3]);
+    geometry_descriptor_writer.update_set(p_pipeline.get_set(i, 1));
+    geometry_descriptor_writer.clear();
+  }
+}
+
+/**
+binds the descriptors of p_pipeline and the material of the current frame.
+The pipelines of all vertex formats share their layout, so once per command
+buffer is enough unless p_bound_layout says otherwise.
+ */
+static void bind_geometry_sets(CuRenderDevice *p_device,
+                               const RenderPipeline &p_pipeline,
+                               VkPipelineLayout &p_bound_layout) {
+  if (p_bound_layout == p_pipeline.layout) {
+    return;
+  }
+  p_bound_layout = p_pipeline.layout;
+  p_device->bind_descriptor(p_pipeline, 0);
+  p_device->bind_descriptor(p_pipeline, 1);
+  if (bindless) {
+    p_device->bind_bindless_heap(p_pipeline);
+    p_device->bind_push_constant(
+        p_pipeline, VK_SHADER_STAGE_FRAGMENT_BIT, MATERIAL_INDEX_OFFSET,
+        sizeof(uint32_t),
+        &material_indices[p_device->get_current_frame_index()]);
+  }
+}
+
+/**
+p_indirect_futures holds one pipeline per vertex format.
+ */
+static bool init_gpu_culling(CuRenderDevice *p_device,
+                             std::future<RenderPipeline> *p_indirect_futures) {
+  bool pipelines_ready = true;
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+    indirect_pipelines[i] = p_indirect_futures[i].get();
+    pipelines_ready &= indirect_pipelines[i].pipeline != VK_NULL_HANDLE;
+  }
+  CompiledShaderInfo cull_shader = {};
+  ShaderCompiler *shader_compiler = ShaderCompiler::get_singleton();
+  if (!shader_compiler ||
+      !shader_compiler->compile_shader("assets/shaders/cull.comp",
+                                       &cull_shader)) {
+    ENGINE_WARN("Culling shader failed to compile, drawing on the CPU");
+    return false;
+  }
+  cull_pipeline = p_device->create_compute_pipeline(cull_shader);
+  if (cull_pipeline.pipeline == VK_NULL_HANDLE || !pipelines_ready) {
+    return false;
+  }
+
+  visible_buffer.init(sizeof(uint32_t), 1024,
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VMA_MEMORY_USAGE_GPU_ONLY);
+  for (uint32_t i = 0; i < p_device->get_frame_overlap(); ++i) {
+    indirect_buffers[i] = p_device->create_buffer(
+        INDIRECT_BUFFER_SIZE,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, MEMORY_INSTANCES);
+    batch_bounds_buffers[i] = p_device->create_buffer(
+        sizeof(glm::vec4) * MAX_GPU_BATCHES,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+        MEMORY_INSTANCES);
+    geometry_descriptor_writer.write_buffer(
+        2, indirect_buffers[i], 0, INDIRECT_BUFFER_SIZE,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    geometry_descriptor_writer.write_buffer(
+        3, batch_bounds_buffers[i], 0, sizeof(glm::vec4) * MAX_GPU_BATCHES,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    geometry_descriptor_writer.update_set(cull_pipeline.get_set(i, 0));
     geometry_descriptor_writer.clear();
   }
+  transform_buffer.bind_to(cull_pipeline, 0, 0);
+  visible_buffer.bind_to(cull_pipeline, 0, 1);
+  for (RenderPipeline &indirect_pipeline : indirect_pipelines) {
+    transform_buffer.bind_to(indirect_pipeline, 1, 0);
+    visible_buffer.bind_to(indirect_pipeline, 1, 2);
+  }
+  return true;
+}
+
+/**
+writes a draw command per mesh batch with an instance count of 0 and culls
+p_instance_count instances into them. Every frame has its own buffers and
+the previous user of them finished before its fence signalled, so only the
+hand-offs inside the frame need barriers.
+ */
+static void record_culling(CuRenderDevice *p_device,
+                           CameraManager *p_camera_manager,
+                           CuItemManager *p_item_manager,
+                           uint32_t p_instance_count) {
+  const int frame_idx = p_device->get_current_frame_index();
+  Buffer &indirect_buffer = indirect_buffers[frame_idx];
+  const std::vector<MeshBatch> &batches = p_item_manager->get_batches();
+  CuMeshRegistry &mesh_registry = p_item_manager->get_mesh_registry();
+
+  std::vector<VkDrawIndexedIndirectCommand> commands(batches.size());
+  std::vector<glm::vec4> bounds(batches.size());
+  for (size_t i = 0; i < batches.size(); ++i) {
+    const MeshInfo &mesh = mesh_registry.get_mesh(batches[i].mesh_id);
+    commands[i].indexCount = mesh.index_count;
+    commands[i].instanceCount = 0;
+    commands[i].firstIndex = mesh.first_index;
+    commands[i].vertexOffset = mesh.first_vertex;
+    // culled instances get compacted into the batch's own range
+    commands[i].firstInstance = batches[i].first_instance;
+    const glm::vec3 center = (mesh.bounds.min + mesh.bounds.max) * 0.5f;
+    bounds[i] = glm::vec4(center, glm::length(mesh.bounds.max - center));
+  }
+  DrawCountHeader header = {};
+  p_device->update_buffer(indirect_buffer, &header, sizeof(header));
+  if (!commands.empty()) {
+    p_device->update_buffer(
+        indirect_buffer, commands.data(),
+        sizeof(VkDrawIndexedIndirectCommand) * commands.size(),
+        DRAW_COMMANDS_OFFSET);
+    p_device->write_buffer(bounds.data(), sizeof(glm::vec4) * bounds.size(),
+                           batch_bounds_buffers[frame_idx]);
+  }
+  p_device->buffer_barrier(
+      indirect_buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+          VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  Camera *camera = p_camera_manager->get_active_camera();
+  if (camera && p_instance_count > 0 && !batches.empty()) {
+    CullConstants constants = {};
+    const std::array<glm::vec4, 6> planes = camera->get_frustum_planes();
+    std::copy(planes.begin(), planes.end(), constants.planes);
+    constants.instance_count = p_instance_count;
+    constants.batch_count = batches.size();
+
+    p_device->bind_compute_pipeline(cull_pipeline);
+    p_device->bind_descriptor(cull_pipeline, 0);
+    p_device->bind_push_constant(cull_pipeline, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                 sizeof(constants), &constants);
+    p_device->dispatch((p_instance_count + CULL_GROUP_SIZE - 1) /
+                       CULL_GROUP_SIZE);
+  }
+
+  p_device->buffer_barrier(
+      indirect_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+  p_device->buffer_barrier(visible_buffer.get_buffer(frame_idx),
+                           VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                           VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                           VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                           VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+}
+
+/**
+draws the mesh batches in the range with the pipeline of each vertex format
+they include.
+ */
+static void draw_batch_range(CuItemManager *p_item_manager,
+                             uint32_t p_first_batch, uint32_t p_batch_count) {
+  CuRenderDevice *device = CuRenderDevice::get_singleton();
+  VkPipelineLayout bound_layout = VK_NULL_HANDLE;
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+    if (!p_item_manager->has_batches(p_first_batch, p_batch_count,
+                                     VertexFormat(i))) {
+      continue;
+    }
+    device->bind_pipeline(triangle_pipelines[i]);
+    bind_geometry_sets(device, triangle_pipelines[i], bound_layout);
+    p_item_manager->draw_batch_range(p_first_batch, p_batch_count,
+                                     VertexFormat(i), triangle_pipelines[i]);
+  }
+}
+
+/**
+records the draws update() prepared into the graph's targets.
+ */
+static void record_geometry(RenderGraphContext &p_context) {
+  CuRenderDevice *device = p_context.get_device();
+  CuItemManager *item_manager = CuItemManager::get_singleton();
+  if (item_manager && draw_indirect) {
+    p_context.begin_rendering();
+    const Buffer &indirect_buffer =
+        indirect_buffers[device->get_current_frame_index()];
+    VkPipelineLayout bound_layout = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+      if (item_manager->get_batch_count(VertexFormat(i)) == 0) {
+        continue;
+      }
+      device->bind_pipeline(indirect_pipelines[i]);
+      bind_geometry_sets(device, indirect_pipelines[i], bound_layout);
+      item_manager->draw_items_indirect(indirect_buffer, DRAW_COMMANDS_OFFSET,
+                                        indirect_buffer, 0, VertexFormat(i),
+                                        indirect_pipelines[i]);
+    }
+    item_manager->reset_dirty_states();
+    return;
+  }
+
+  // each batch is one draw call, that's the recording work to split
+  const uint32_t batch_count =
+      item_manager ? item_manager->get_batches().size() : 0;
+  const uint32_t chunk_count =
+      std::min(device->get_recording_thread_count(),
+               batch_count / BATCHES_PER_CHUNK);
+  if (!item_manager || chunk_count <= 1) {
+    p_context.begin_rendering();
+    if (item_manager) {
+      draw_batch_range(item_manager, 0, batch_count);
+      item_manager->reset_dirty_states();
+    }
+    return;
+  }
+  // scenes with many different meshes get their draws split across the
+  // recording threads
+  p_context.begin_rendering(true);
+  const uint32_t chunk_size = (batch_count + chunk_count - 1) / chunk_count;
+  device->record_parallel(chunk_count, [&](uint32_t p_chunk) {
+    const uint32_t first = p_chunk * chunk_size;
+    if (first < batch_count) {
+      draw_batch_range(item_manager, first,
+                       std::min(chunk_size, batch_count - first));
+    }
+  });
+  item_manager->reset_dirty_states();
+}
+
+void GeometryPass::init() {
+  device = CuRenderDevice::get_singleton();
+  camera_manager = CameraManager::get_singleton();
+  if (!device || !camera_manager) {
+    return;
+  }
+
+  const char *bindless_env = std::getenv("CU_BINDLESS");
+  bindless = bindless_env && std::string(bindless_env) == "1";
+  if (bindless && !device->supports_bindless()) {
+    ENGINE_WARN("Bindless descriptors aren't supported, using regular sets");
+    bindless = false;
+  }
+  const char *fragment_shader = bindless ? "assets/shaders/test_bindless.frag"
+                                         : "assets/shaders/test.frag";
+
+  // the pipelines get built on workers while the buffers are created
+  RenderPipelineDescription pipeline_description = {};
+  // only the format of the color target matters to the pipeline
+  Texture color_target = {};
+  color_target.format = COLOR_FORMAT;
+  pipeline_description.color_textures = {color_target};
+  pipeline_description.depth_format = DEPTH_FORMAT;
+  // float vertices don't push mesh bounds, declaring them anyway gives every
+  // vertex format the same layout so the sets stay bound across formats
+  pipeline_description.push_constants = {
+      {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshBoundsConstants)}};
+  std::future<RenderPipeline> pipeline_futures[VERTEX_FORMAT_COUNT];
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+    pipeline_description.shaders = {VERTEX_SHADERS[i], fragment_shader};
+    pipeline_description.vertex_formats =
+        CuMeshRegistry::get_vertex_input_formats(VertexFormat(i));
+    pipeline_futures[i] =
+        device->create_render_pipeline_async(pipeline_description);
+  }
+
+  // CU_GPU_CULLING=0 keeps culling and draw submission on the CPU
+  const char *gpu_culling_env = std::getenv("CU_GPU_CULLING");
+  gpu_culling = !gpu_culling_env || std::string(gpu_culling_env) != "0";
+  std::future<RenderPipeline> indirect_futures[VERTEX_FORMAT_COUNT];
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT && gpu_culling; ++i) {
+    pipeline_description.shaders = {INDIRECT_VERTEX_SHADERS[i],
+                                    fragment_shader};
+    pipeline_description.vertex_formats =
+        CuMeshRegistry::get_vertex_input_formats(VertexFormat(i));
+    indirect_futures[i] =
+        device->create_render_pipeline_async(pipeline_description);
+  }
+
+  transform_buffer.init(sizeof(InstanceTransform));
+  for (uint32_t i = 0; i < device->get_frame_overlap(); ++i) {
+    test_buffers[i] = device->create_buffer(
+        sizeof(float) * 4,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU, MEMORY_UNIFORMS);
+    if (bindless) {
+      material_indices[i] = device->get_bindless_heap().add_buffer(
+          test_buffers[i], 0, sizeof(float) * 4);
+    }
+  }
+
+  bool pipelines_ready = true;
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+    triangle_pipelines[i] = pipeline_futures[i].get();
+    pipelines_ready &= triangle_pipelines[i].pipeline != VK_NULL_HANDLE;
+  }
+  if (!pipelines_ready) {
+    return;
+  }
+  std::fill(std::begin(stale_transforms), std::end(stale_transforms), true);
+  for (RenderPipeline &triangle_pipeline : triangle_pipelines) {
+    write_geometry_sets(triangle_pipeline, camera_manager);
+    // binding 0 of set 1 follows the instance buffer when it grows
+    transform_buffer.bind_to(triangle_pipeline, 1, 0);
+  }
+
+  if (gpu_culling) {
+    gpu_culling = init_gpu_culling(device, indirect_futures);
+    for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT && gpu_culling; ++i) {
+      write_geometry_sets(indirect_pipelines[i], camera_manager);
+    }
+  }
 };
 
+void GeometryPass::setup_graph(RenderGraph &p_graph) {
+  if (!device) {
+    return;
+  }
+  scene_color = p_graph.create_texture("scene_color", {COLOR_FORMAT});
+  scene_depth = p_graph.create_texture("scene_depth", {DEPTH_FORMAT});
+  RenderGraphPass &pass = p_graph.add_pass("Geometry");
+  pass.clear_color(scene_color);
+  pass.clear_depth(scene_depth);
+  pass.execute = [](RenderGraphContext &p_context) {
+    record_geometry(p_context);
+  };
+  p_graph.present(scene_color);
+}
+
 int frame_number = 0;
 void GeometryPass::update() {
+  CU_PROFILE_SCOPE("GeometryPass::update");
   if (!device) {
     return;
   }
   CuItemManager *item_manager = CuItemManager::get_singleton();
   frame_number++;
+  const int frame_idx = device->get_current_frame_index();
 
   float color[4] = {1.0f, 1.0f, 1.0f, 1.0f};
   if (item_manager) {
     std::vector<std::shared_ptr<CuItem>> renderables =
         item_manager->get_items_by_type(CuItemType::RENDERABLE);
 
-    const int count = renderables.size();
-    bool update_transforms = false;
-    for (int i = 0; i < count; ++i) {
-      if (renderables[i]->get_dirty_state()) {
-        update_transforms = true;
-        break;
+    Camera *camera = camera_manager->get_active_camera();
+    const bool cpu_culling = !gpu_culling && camera;
+    if (cpu_culling) {
+      item_manager->cull_items(renderables, camera->get_frustum_planes(),
+                               draw_list);
+    } else {
+      draw_list.resize(renderables.size());
+      for (size_t i = 0; i < renderables.size(); ++i) {
+        draw_list[i] = renderables[i].get();
       }
     }
+    item_manager->prepare_batches(draw_list);
 
-    std::vector<glm::mat4> transforms = {};
-    transforms.resize(count);
-    if (update_transforms) {
+    const int count = draw_list.size();
+    if (cpu_culling) {
+      // the visible set changes with the camera, so it's rewritten every frame
+      transform_buffer.reserve(count);
+      InstanceTransform *transforms =
+          static_cast<InstanceTransform *>(transform_buffer.map());
+      if (transforms) {
+        for (int i = 0; i < count; ++i) {
+          transforms[i] = draw_list[i]->get_instance_transform();
+        }
+        transform_buffer.flush(count);
+      }
+    } else {
       for (int i = 0; i < count; ++i) {
-        transforms[i] = renderables[i]->get_transform();
+        if (draw_list[i]->get_dirty_state()) {
+          // every frame copy has to catch up with the new transforms
+          std::fill(std::begin(stale_transforms), std::end(stale_transforms),
+                    true);
+          break;
+        }
       }
 
-      device->write_buffer(transforms.data(), sizeof(glm::mat4) * count,
-                           transform_buffer);
+      if (transform_buffer.reserve(count)) {
+        stale_transforms[frame_idx] = true;
+      }
+      InstanceTransform *transforms =
+          static_cast<InstanceTransform *>(transform_buffer.map());
+      if (stale_transforms[frame_idx] && transforms) {
+        for (int i = 0; i < count; ++i) {
+          transforms[i] = draw_list[i]->get_instance_transform();
+        }
+
+        transform_buffer.flush(count);
+        stale_transforms[frame_idx] = false;
+      }
     }
   }
-  device->write_buffer(color, sizeof(float) * 4, test_buffer);
+  device->write_buffer(color, sizeof(float) * 4, test_buffers[frame_idx]);
 
-  CuRenderAttachmentBuilder builder;
-  builder.add_color_attachment({0.0, 0.0, 0.0, 1.0});
-  builder.add_depth_attachment();
-  CuRenderAttachemnts render_attachments = builder.build();
-  device->prepare_image(render_attachments, &color_texture, &depth_texture);
-  device->bind_pipeline(triangle_pipeline);
-  device->bind_descriptor(triangle_pipeline, 0);
-  device->bind_descriptor(triangle_pipeline, 1);
-  if (item_manager) {
-    item_manager->draw_items();
+  const uint32_t instance_count = transform_buffer.get_count();
+  draw_indirect = item_manager && gpu_culling &&
+                  item_manager->get_batches().size() <= MAX_GPU_BATCHES;
+  if (draw_indirect) {
+    // the visible indices are written on the GPU, only the size matters
+    visible_buffer.reserve(instance_count);
+    record_culling(device, camera_manager, item_manager, instance_count);
   }
-  device->submit_image(color_texture);
 }
 
 void GeometryPass::clear() {
   if (!device) {
     return;
   }
-  device->clear_buffer(test_buffer);
-  device->clear_buffer(transform_buffer);
-  device->clear_texture(color_texture);
-  device->clear_texture(depth_texture);
-  triangle_pipeline.clear(device->get_raw_device());
+  for (uint32_t i = 0; i < MAX_FRAME_OVERLAP; ++i) {
+    if (bindless && test_buffers[i].buffer != VK_NULL_HANDLE) {
+      device->get_bindless_heap().remove(BINDLESS_STORAGE_BUFFER,
+                                         material_indices[i]);
+    }
+    device->clear_buffer(test_buffers[i]);
+  }
+  transform_buffer.clear();
+  for (uint32_t i = 0; i < MAX_FRAME_OVERLAP; ++i) {
+    device->clear_buffer(indirect_buffers[i]);
+    device->clear_buffer(batch_bounds_buffers[i]);
+  }
+  visible_buffer.clear();
+  cull_pipeline.clear(device->get_raw_device());
+  for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; ++i) {
+    indirect_pipelines[i].clear(device->get_raw_device());
+    triangle_pipelines[i].clear(device->get_raw_device());
+  }
 };
\ No newline at end of file
@@ -10,6 +10,8 @@ public:
   void init() override;
   void update() override;
   void clear() override;
+  void setup_graph(RenderGraph &p_graph) override;
+  std::string get_name() const override { return "GeometryPass"; }
 
 private:
   CuRenderDevice *device = nullptr;
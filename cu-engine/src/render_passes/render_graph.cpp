@@ -0,0 +1,592 @@
+#include "render_graph.h"
+#include "logger.h"
+#include "profiler.h"
+#include <algorithm>
+
+struct UsageInfo {
+  VkImageLayout layout;
+  VkPipelineStageFlags2 stages;
+  VkAccessFlags2 read_access;
+  VkAccessFlags2 write_access;
+  VkImageUsageFlags image_usage;
+};
+
+const UsageInfo USAGE_INFOS[GRAPH_USAGE_COUNT] = {
+    // GRAPH_COLOR_ATTACHMENT
+    {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+     VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+     VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT,
+     VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+     VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT},
+    // GRAPH_DEPTH_ATTACHMENT
+    {VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+     VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+         VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+     VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+     VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT},
+    // GRAPH_SAMPLED
+    {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+     VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+         VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+     VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_ACCESS_2_NONE,
+     VK_IMAGE_USAGE_SAMPLED_BIT},
+    // GRAPH_STORAGE
+    {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+     VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+     VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_USAGE_STORAGE_BIT},
+    // GRAPH_TRANSFER_SRC
+    {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+     VK_ACCESS_2_TRANSFER_READ_BIT, VK_ACCESS_2_NONE,
+     VK_IMAGE_USAGE_TRANSFER_SRC_BIT},
+    // GRAPH_TRANSFER_DST
+    {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+     VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+     VK_IMAGE_USAGE_TRANSFER_DST_BIT},
+};
+
+static bool is_attachment(RenderGraphUsage p_usage) {
+  return p_usage == GRAPH_COLOR_ATTACHMENT ||
+         p_usage == GRAPH_DEPTH_ATTACHMENT;
+}
+
+const Texture &RenderGraphContext::get_texture(uint32_t p_texture) const {
+  return graph->get_texture(p_texture);
+}
+
+void RenderGraphContext::begin_rendering(bool p_secondary /*= false*/) {
+  if (rendering_begun) {
+    return;
+  }
+  if (rendering->color_attachments.empty() &&
+      rendering->depth_format == VK_FORMAT_UNDEFINED) {
+    ENGINE_ERROR("Render graph pass has no attachments to render into");
+    return;
+  }
+  device->begin_rendering(*rendering, p_secondary);
+  rendering_begun = true;
+}
+
+void RenderGraphPass::read(uint32_t p_texture, RenderGraphUsage p_usage) {
+  Access access = {};
+  access.texture = p_texture;
+  access.usage = p_usage;
+  add_access(access);
+}
+
+void RenderGraphPass::write(uint32_t p_texture, RenderGraphUsage p_usage) {
+  Access access = {};
+  access.texture = p_texture;
+  access.usage = p_usage;
+  access.write = true;
+  add_access(access);
+}
+
+void RenderGraphPass::clear_color(
+    uint32_t p_texture,
+    std::array<float, 4> p_color /*= {0.0f, 0.0f, 0.0f, 1.0f}*/) {
+  Access access = {};
+  access.texture = p_texture;
+  access.usage = GRAPH_COLOR_ATTACHMENT;
+  access.write = true;
+  access.clear = true;
+  std::copy(p_color.begin(), p_color.end(),
+            access.clear_value.color.float32);
+  add_access(access);
+}
+
+void RenderGraphPass::clear_depth(uint32_t p_texture,
+                                  float p_depth /*= 1.0f*/) {
+  Access access = {};
+  access.texture = p_texture;
+  access.usage = GRAPH_DEPTH_ATTACHMENT;
+  access.write = true;
+  access.clear = true;
+  access.clear_value.depthStencil.depth = p_depth;
+  add_access(access);
+}
+
+void RenderGraphPass::add_access(const Access &p_access) {
+  if (p_access.texture == RenderGraph::INVALID_TEXTURE) {
+    ENGINE_ERROR("Render graph pass {} uses an unknown texture", name);
+    return;
+  }
+  for (const Access &access : accesses) {
+    if (access.texture == p_access.texture) {
+      // one layout per pass, read-modify-write goes through write()
+      ENGINE_ERROR("Render graph pass {} uses a texture twice", name);
+      return;
+    }
+  }
+  accesses.push_back(p_access);
+}
+
+uint32_t RenderGraph::create_texture(
+    const std::string &p_name,
+    const RenderGraphTextureDescription &p_description) {
+  const uint32_t existing = find_texture(p_name);
+  if (existing != INVALID_TEXTURE) {
+    return existing;
+  }
+  GraphTexture texture = {};
+  texture.name = p_name;
+  texture.description = p_description;
+  textures.push_back(texture);
+  dirty = true;
+  return textures.size() - 1;
+}
+
+uint32_t RenderGraph::find_texture(const std::string &p_name) const {
+  for (size_t i = 0; i < textures.size(); ++i) {
+    if (textures[i].name == p_name) {
+      return i;
+    }
+  }
+  return INVALID_TEXTURE;
+}
+
+RenderGraphPass &RenderGraph::add_pass(const std::string &p_name) {
+  passes.emplace_back();
+  passes.back().name = p_name;
+  dirty = true;
+  return passes.back();
+}
+
+void RenderGraph::present(uint32_t p_texture) {
+  presents = true;
+  RenderGraphPass &pass = add_pass("Present blit");
+  pass.read(p_texture, GRAPH_TRANSFER_SRC);
+  pass.set_side_effects();
+  pass.execute = [p_texture](RenderGraphContext &p_context) {
+    p_context.get_device()->blit_to_swapchain(
+        p_context.get_texture(p_texture));
+  };
+}
+
+void RenderGraph::execute() {
+  device = CuRenderDevice::get_singleton();
+  if (!device) {
+    return;
+  }
+  if (dirty) {
+    compile();
+  }
+  if (dirty) {
+    if (presents) {
+      device->clear_swapchain();
+    }
+    return;
+  }
+  if (initial_transitions) {
+    // persistent textures start where the previous frame would leave them
+    std::vector<VkImageMemoryBarrier2> barriers;
+    for (const GraphTexture &texture : textures) {
+      if (!texture.description.persistent ||
+          texture.end_layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+        continue;
+      }
+      VkImageMemoryBarrier2 barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+      barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+      barrier.dstStageMask = texture.end_stages;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = texture.end_layout;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = texture.texture.image;
+      barrier.subresourceRange =
+          image_subresource_range(texture.texture.aspect_flags);
+      barriers.push_back(barrier);
+    }
+    device->image_barriers(barriers);
+    initial_transitions = false;
+  }
+
+  RenderGraphContext context;
+  context.graph = this;
+  context.device = device;
+  for (RenderGraphPass &pass : passes) {
+    if (pass.culled) {
+      continue;
+    }
+    CU_PROFILE_SCOPE_NAMED(pass.name);
+    const uint32_t zone = device->begin_gpu_zone(pass.name);
+    device->image_barriers(pass.barriers);
+    context.rendering = &pass.rendering;
+    context.rendering_begun = false;
+    if (pass.execute) {
+      pass.execute(context);
+    }
+    if (context.rendering_begun) {
+      device->end_rendering();
+    }
+    device->end_gpu_zone(zone);
+  }
+}
+
+void RenderGraph::on_resize(uint32_t p_width, uint32_t p_height) {
+  if (p_width != extent.width || p_height != extent.height) {
+    dirty = true;
+  }
+}
+
+void RenderGraph::clear() {
+  device = CuRenderDevice::get_singleton();
+  if (device) {
+    // only called once the device is idle
+    for (GraphTexture &texture : textures) {
+      device->clear_texture(texture.texture);
+    }
+    for (MemoryBlock &block : blocks) {
+      device->free_memory(block.memory);
+    }
+  }
+  textures.clear();
+  passes.clear();
+  blocks.clear();
+  dirty = true;
+  presents = false;
+  compile_failed = false;
+}
+
+void RenderGraph::compile() {
+  retire_resources();
+  extent = device->get_swapchain_size();
+  cull_passes();
+  if (!create_textures()) {
+    // drop what got created before the failure, dirty stays set so the
+    // next frame tries again
+    retire_resources();
+    initial_transitions = false;
+    for (RenderGraphPass &pass : passes) {
+      pass.culled = true;
+    }
+    if (!compile_failed) {
+      ENGINE_ERROR("Render graph failed to create its textures, frames are "
+                   "cleared until it succeeds");
+    }
+    compile_failed = true;
+    return;
+  }
+  compile_failed = false;
+  plan_barriers();
+  uint32_t culled_count = 0;
+  for (uint32_t i = 0; i < passes.size(); ++i) {
+    culled_count += passes[i].culled;
+    plan_rendering(passes[i], i);
+  }
+
+  VkDeviceSize texture_bytes = 0;
+  VkDeviceSize block_bytes = 0;
+  uint32_t transient_count = 0;
+  for (const MemoryBlock &block : blocks) {
+    block_bytes += block.requirements.size;
+    transient_count += block.textures.size();
+    for (uint32_t texture : block.textures) {
+      texture_bytes += textures[texture].size;
+    }
+  }
+  ENGINE_INFO("Render graph runs {} of {} passes, {} transient textures "
+              "share {} memory blocks ({:.1f} MiB instead of {:.1f} MiB)",
+              passes.size() - culled_count, passes.size(), transient_count,
+              blocks.size(), block_bytes / (1024.0 * 1024.0),
+              texture_bytes / (1024.0 * 1024.0));
+  dirty = false;
+}
+
+void RenderGraph::cull_passes() {
+  // textures whose current contents a later pass still reads
+  std::vector<bool> demanded(textures.size(), false);
+  for (size_t i = passes.size(); i-- > 0;) {
+    RenderGraphPass &pass = passes[i];
+    pass.culled = !pass.side_effects;
+    for (const RenderGraphPass::Access &access : pass.accesses) {
+      if (access.write && (demanded[access.texture] ||
+                           textures[access.texture].description.persistent)) {
+        pass.culled = false;
+      }
+    }
+    if (pass.culled) {
+      continue;
+    }
+    for (const RenderGraphPass::Access &access : pass.accesses) {
+      // cleared textures don't need what earlier passes left in them
+      demanded[access.texture] = !access.clear;
+    }
+  }
+
+  for (GraphTexture &texture : textures) {
+    texture.first_pass = UINT32_MAX;
+    texture.last_pass = 0;
+    texture.usage = 0;
+  }
+  for (uint32_t i = 0; i < passes.size(); ++i) {
+    if (passes[i].culled) {
+      continue;
+    }
+    for (const RenderGraphPass::Access &access : passes[i].accesses) {
+      GraphTexture &texture = textures[access.texture];
+      texture.first_pass = std::min(texture.first_pass, i);
+      texture.last_pass = std::max(texture.last_pass, i);
+      texture.usage |= USAGE_INFOS[access.usage].image_usage;
+      if (texture.first_pass == i && !access.write &&
+          !texture.description.persistent) {
+        ENGINE_WARN("Render graph texture {} is read before it's written",
+                    texture.name);
+      }
+    }
+  }
+}
+
+bool RenderGraph::create_textures() {
+  std::vector<uint32_t> transient;
+  std::vector<VkMemoryRequirements> requirements(textures.size());
+  for (uint32_t i = 0; i < textures.size(); ++i) {
+    GraphTexture &texture = textures[i];
+    texture.texture = {};
+    texture.block = UINT32_MAX;
+    texture.size = 0;
+    if (texture.first_pass == UINT32_MAX) {
+      continue;
+    }
+    const VkExtent3D texture_extent = {
+        texture.description.extent.width ? texture.description.extent.width
+                                         : extent.width,
+        texture.description.extent.height ? texture.description.extent.height
+                                          : extent.height,
+        1};
+    if (texture.description.persistent) {
+      device->create_texture(texture.description.format, texture_extent,
+                             texture.usage, VMA_MEMORY_USAGE_GPU_ONLY,
+                             texture.texture);
+      initial_transitions = true;
+      continue;
+    }
+    if (!device->create_unbound_texture(texture.description.format,
+                                        texture_extent, texture.usage,
+                                        texture.texture, requirements[i])) {
+      return false;
+    }
+    texture.size = requirements[i].size;
+    transient.push_back(i);
+  }
+
+  // textures whose lifetimes don't overlap go into the same block, the
+  // first block that is free again gets picked
+  std::sort(transient.begin(), transient.end(),
+            [&](uint32_t p_a, uint32_t p_b) {
+              return textures[p_a].first_pass < textures[p_b].first_pass;
+            });
+  for (uint32_t index : transient) {
+    GraphTexture &texture = textures[index];
+    const VkMemoryRequirements &texture_requirements = requirements[index];
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+      if (blocks[i].last_pass < texture.first_pass &&
+          (blocks[i].requirements.memoryTypeBits &
+           texture_requirements.memoryTypeBits)) {
+        texture.block = i;
+        break;
+      }
+    }
+    if (texture.block == UINT32_MAX) {
+      texture.block = blocks.size();
+      blocks.emplace_back();
+      blocks.back().requirements = texture_requirements;
+    }
+    MemoryBlock &block = blocks[texture.block];
+    block.requirements.size =
+        std::max(block.requirements.size, texture_requirements.size);
+    block.requirements.alignment =
+        std::max(block.requirements.alignment, texture_requirements.alignment);
+    block.requirements.memoryTypeBits &= texture_requirements.memoryTypeBits;
+    block.last_pass = texture.last_pass;
+    block.textures.push_back(index);
+  }
+
+  for (MemoryBlock &block : blocks) {
+    block.memory = device->allocate_memory(block.requirements);
+    if (block.memory == VK_NULL_HANDLE) {
+      return false;
+    }
+    for (uint32_t texture : block.textures) {
+      if (!device->bind_texture_memory(textures[texture].texture,
+                                       block.memory)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void RenderGraph::plan_barriers() {
+  // walk the frame once to find where every texture ends up, that's where
+  // the next frame finds persistent textures and aliased memory
+  std::vector<TextureState> end_states(textures.size());
+  std::vector<TextureState> states(textures.size());
+  for (int walk = 0; walk < 2; ++walk) {
+    for (uint32_t i = 0; i < textures.size(); ++i) {
+      const GraphTexture &texture = textures[i];
+      if (texture.description.persistent) {
+        states[i] = end_states[i];
+      } else if (texture.block != UINT32_MAX) {
+        // the previous user of the memory has to be done with it, for the
+        // first texture in a block that's the last one of the last frame
+        const std::vector<uint32_t> &block = blocks[texture.block].textures;
+        auto position = std::find(block.begin(), block.end(), i);
+        const uint32_t previous =
+            position == block.begin() ? block.back() : *(position - 1);
+        states[i] = {};
+        states[i].read_stages = end_states[previous].write_stages |
+                                end_states[previous].read_stages;
+        states[i].write_access = end_states[previous].write_access;
+      }
+    }
+
+    for (RenderGraphPass &pass : passes) {
+      pass.barriers.clear();
+      if (pass.culled) {
+        continue;
+      }
+      for (const RenderGraphPass::Access &access : pass.accesses) {
+        const UsageInfo &usage = USAGE_INFOS[access.usage];
+        TextureState &state = states[access.texture];
+        const bool layout_change = state.layout != usage.layout;
+        const bool after_write =
+            state.write_stages != VK_PIPELINE_STAGE_2_NONE &&
+            (usage.stages & ~state.visible_stages);
+        const bool after_access =
+            access.write && (state.write_stages | state.read_stages);
+
+        if (layout_change || after_write || after_access) {
+          VkImageMemoryBarrier2 barrier = {};
+          barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+          barrier.srcStageMask = state.write_stages;
+          if (layout_change || access.write) {
+            barrier.srcStageMask |= state.read_stages;
+          }
+          barrier.srcAccessMask = state.write_access;
+          barrier.dstStageMask = usage.stages;
+          barrier.dstAccessMask =
+              usage.read_access | (access.write ? usage.write_access : 0);
+          barrier.oldLayout = state.layout;
+          barrier.newLayout = usage.layout;
+          barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+          barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+          barrier.image = textures[access.texture].texture.image;
+          barrier.subresourceRange = image_subresource_range(
+              textures[access.texture].texture.aspect_flags);
+          pass.barriers.push_back(barrier);
+          state.visible_stages |= usage.stages;
+        }
+
+        if (access.write) {
+          state.write_stages = usage.stages;
+          state.write_access = usage.write_access;
+          state.read_stages = VK_PIPELINE_STAGE_2_NONE;
+          state.visible_stages = VK_PIPELINE_STAGE_2_NONE;
+        } else if (layout_change) {
+          // the transition is a write the later readers have to wait for
+          state.write_stages = usage.stages;
+          state.write_access = VK_ACCESS_2_NONE;
+          state.read_stages = usage.stages;
+          state.visible_stages = usage.stages;
+        } else {
+          state.read_stages |= usage.stages;
+        }
+        state.layout = usage.layout;
+      }
+    }
+    end_states = states;
+  }
+  for (uint32_t i = 0; i < textures.size(); ++i) {
+    textures[i].end_layout = end_states[i].layout;
+    textures[i].end_stages =
+        end_states[i].write_stages | end_states[i].read_stages;
+  }
+}
+
+bool RenderGraph::is_read_later(uint32_t p_texture,
+                                uint32_t p_pass_index) const {
+  for (uint32_t i = p_pass_index + 1; i < passes.size(); ++i) {
+    if (passes[i].culled) {
+      continue;
+    }
+    for (const RenderGraphPass::Access &access : passes[i].accesses) {
+      if (access.texture == p_texture) {
+        return !access.clear;
+      }
+    }
+  }
+  return false;
+}
+
+void RenderGraph::plan_rendering(RenderGraphPass &p_pass,
+                                 uint32_t p_pass_index) {
+  p_pass.rendering = {};
+  if (p_pass.culled) {
+    return;
+  }
+  for (const RenderGraphPass::Access &access : p_pass.accesses) {
+    if (!is_attachment(access.usage)) {
+      continue;
+    }
+    const GraphTexture &texture = textures[access.texture];
+    VkRenderingAttachmentInfo attachment = {};
+    attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    attachment.imageView = texture.texture.view;
+    attachment.imageLayout = USAGE_INFOS[access.usage].layout;
+    attachment.clearValue = access.clear_value;
+    if (access.clear) {
+      attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    } else if (texture.first_pass == p_pass_index &&
+               !texture.description.persistent) {
+      // nothing was written into it yet this frame
+      attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    } else {
+      attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
+    // read-only attachments keep their contents
+    const bool keep = !access.write || texture.description.persistent ||
+                      is_read_later(access.texture, p_pass_index);
+    attachment.storeOp =
+        keep ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+    if (access.usage == GRAPH_DEPTH_ATTACHMENT) {
+      p_pass.rendering.depth_attachment = attachment;
+      p_pass.rendering.depth_format = texture.texture.format;
+    } else {
+      p_pass.rendering.color_attachments.push_back(attachment);
+      p_pass.rendering.color_formats.push_back(texture.texture.format);
+    }
+    p_pass.rendering.extent = {texture.texture.extent.width,
+                               texture.texture.extent.height};
+  }
+}
+
+void RenderGraph::retire_resources() {
+  std::vector<Texture> old_textures;
+  std::vector<VmaAllocation> old_memory;
+  for (GraphTexture &texture : textures) {
+    if (texture.texture.image != VK_NULL_HANDLE) {
+      old_textures.push_back(texture.texture);
+    }
+    texture.texture = {};
+  }
+  for (MemoryBlock &block : blocks) {
+    old_memory.push_back(block.memory);
+  }
+  blocks.clear();
+  if (old_textures.empty() && old_memory.empty()) {
+    return;
+  }
+  // frames in flight may still render into them
+  device->queue_frame_deletion(
+      [device = device, old_textures, old_memory]() mutable {
+        for (Texture &texture : old_textures) {
+          device->clear_texture(texture);
+        }
+        for (VmaAllocation memory : old_memory) {
+          device->free_memory(memory);
+        }
+      });
+}
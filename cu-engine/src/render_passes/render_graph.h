@@ -0,0 +1,201 @@
+#pragma once
+
+#include "render_device/render_device.h"
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+class RenderGraph;
+
+enum RenderGraphUsage : uint32_t {
+  GRAPH_COLOR_ATTACHMENT,
+  GRAPH_DEPTH_ATTACHMENT,
+  // read through a sampler by fragment or compute shaders
+  GRAPH_SAMPLED,
+  // image load/store in compute shaders
+  GRAPH_STORAGE,
+  GRAPH_TRANSFER_SRC,
+  GRAPH_TRANSFER_DST,
+  GRAPH_USAGE_COUNT,
+};
+
+struct RenderGraphTextureDescription {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  // a size of 0 follows the swapchain
+  VkExtent2D extent = {};
+  // contents are kept from frame to frame. Other textures only live from
+  // their first to their last use within a frame and share memory with
+  // textures whose lifetimes don't overlap
+  bool persistent = false;
+};
+
+/**
+what the graph passes to a pass while it's being recorded.
+ */
+class RenderGraphContext {
+public:
+  const Texture &get_texture(uint32_t p_texture) const;
+  /**
+   begins rendering into the pass's attachments, with the load and store
+   ops the graph picked for them. The graph ends it after the pass.
+   */
+  void begin_rendering(bool p_secondary = false);
+  CuRenderDevice *get_device() const { return device; }
+
+private:
+  friend class RenderGraph;
+  RenderGraph *graph = nullptr;
+  CuRenderDevice *device = nullptr;
+  const RenderingDescription *rendering = nullptr;
+  bool rendering_begun = false;
+};
+
+/**
+a pass of the graph. It declares every texture it reads or writes, the
+graph derives barriers, load/store ops and image usage from that.
+ */
+class RenderGraphPass {
+public:
+  void read(uint32_t p_texture, RenderGraphUsage p_usage);
+  /**
+   writes that don't clear keep what earlier passes wrote, so they count
+   as reads too.
+   */
+  void write(uint32_t p_texture, RenderGraphUsage p_usage);
+  /**
+   writes the attachment after clearing it with its load op.
+   */
+  void clear_color(uint32_t p_texture, std::array<float, 4> p_color = {
+                                           0.0f, 0.0f, 0.0f, 1.0f});
+  void clear_depth(uint32_t p_texture, float p_depth = 1.0f);
+  /**
+   keeps the pass even when nothing reads what it writes, for example
+   because it presents.
+   */
+  void set_side_effects() { side_effects = true; }
+  const std::string &get_name() const { return name; }
+
+  std::function<void(RenderGraphContext &)> execute;
+
+private:
+  friend class RenderGraph;
+  struct Access {
+    uint32_t texture = 0;
+    RenderGraphUsage usage = GRAPH_SAMPLED;
+    bool write = false;
+    bool clear = false;
+    VkClearValue clear_value = {};
+  };
+  void add_access(const Access &p_access);
+
+  std::string name;
+  std::vector<Access> accesses = {};
+  bool side_effects = false;
+  // filled in by RenderGraph::compile()
+  bool culled = false;
+  std::vector<VkImageMemoryBarrier2> barriers = {};
+  RenderingDescription rendering = {};
+};
+
+/**
+Passes run in the order they were added, minus the ones whose results
+nothing reads. From the declared accesses the graph records the barriers
+between passes, picks load and store ops, creates the textures with just
+the usage they need and lets transient textures alias memory.
+ */
+class RenderGraph {
+public:
+  /**
+   returns the texture's handle. Names are unique, creating a texture
+   twice returns the existing one.
+   */
+  uint32_t create_texture(const std::string &p_name,
+                          const RenderGraphTextureDescription &p_description);
+  uint32_t find_texture(const std::string &p_name) const;
+  /**
+   the reference stays valid while passes are added.
+   */
+  RenderGraphPass &add_pass(const std::string &p_name);
+  /**
+   adds a pass that blits p_texture into the swapchain image.
+   */
+  void present(uint32_t p_texture);
+  /**
+   records the passes into the current frame, compiling the graph first
+   if it changed. Until a compile succeeds the swapchain image is cleared
+   instead, so it can still be presented.
+   */
+  void execute();
+  /**
+   textures that follow the swapchain get recreated before the next frame.
+   */
+  void on_resize(uint32_t p_width, uint32_t p_height);
+  void clear();
+
+  const Texture &get_texture(uint32_t p_texture) const {
+    return textures[p_texture].texture;
+  }
+
+  static const uint32_t INVALID_TEXTURE = UINT32_MAX;
+
+private:
+  struct GraphTexture {
+    std::string name;
+    RenderGraphTextureDescription description = {};
+    Texture texture = {};
+    VkImageUsageFlags usage = 0;
+    // first and last pass using it, UINT32_MAX while culled
+    uint32_t first_pass = UINT32_MAX;
+    uint32_t last_pass = 0;
+    // memory block of transient textures and the part of it they need
+    uint32_t block = UINT32_MAX;
+    VkDeviceSize size = 0;
+    // where the frame leaves it, persistent textures start there
+    VkImageLayout end_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 end_stages = VK_PIPELINE_STAGE_2_NONE;
+  };
+  struct MemoryBlock {
+    VkMemoryRequirements requirements = {};
+    VmaAllocation memory = VK_NULL_HANDLE;
+    uint32_t last_pass = 0;
+    // transient textures in the block, in the order they're used
+    std::vector<uint32_t> textures = {};
+  };
+  /**
+   where a texture is left after an access.
+   */
+  struct TextureState {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 write_stages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 write_access = VK_ACCESS_2_NONE;
+    // readers since the last write, later writes have to wait for them
+    VkPipelineStageFlags2 read_stages = VK_PIPELINE_STAGE_2_NONE;
+    // stages the last write has been made visible to
+    VkPipelineStageFlags2 visible_stages = VK_PIPELINE_STAGE_2_NONE;
+  };
+
+  void compile();
+  void cull_passes();
+  bool create_textures();
+  void plan_barriers();
+  void plan_rendering(RenderGraphPass &p_pass, uint32_t p_pass_index);
+  /**
+   whether a pass after p_pass_index reads what's in p_texture.
+   */
+  bool is_read_later(uint32_t p_texture, uint32_t p_pass_index) const;
+  void retire_resources();
+
+  std::vector<GraphTexture> textures = {};
+  std::deque<RenderGraphPass> passes = {};
+  std::vector<MemoryBlock> blocks = {};
+  CuRenderDevice *device = nullptr;
+  VkExtent2D extent = {};
+  bool dirty = true;
+  // whether a present() pass was added, see execute()
+  bool presents = false;
+  // the last compile couldn't create the textures, it's retried every frame
+  bool compile_failed = false;
+  // persistent textures that still have to leave UNDEFINED layout
+  bool initial_transitions = false;
+};
@@ -1,9 +1,31 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+
+class RenderGraph;
+
 class RenderPassBase {
 public:
   virtual void init() = 0;
+  /**
+   called once after init(). Declares the pass's textures and graph passes,
+   the graph records those after every pass's update().
+   */
+  virtual void setup_graph(RenderGraph &p_graph) {}
+  /**
+   work that has to happen before the graph runs, like CPU side updates or
+   commands outside of the graph's passes.
+   */
   virtual void update() = 0;
   virtual void clear() = 0;
+  /**
+   called before update() once the swapchain got a new size. The graph
+   recreates its own textures, other targets still used by frames in flight
+   have to be retired through CuRenderDevice::queue_frame_deletion().
+   */
+  virtual void on_resize(uint32_t p_width, uint32_t p_height) {}
+  // shows up in the GPU timings
+  virtual std::string get_name() const { return "RenderPass"; }
   virtual ~RenderPassBase() = default;
 };
\ No newline at end of file
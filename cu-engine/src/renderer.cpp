@@ -3,7 +3,9 @@
 #include "camera.h"
 #include "item.h"
 #include "logger.h"
+#include "profiler.h"
 #include "render_device/render_device.h"
+#include "render_passes/render_graph.h"
 #include "render_passes/render_pass_base.h"
 #include "window.h"
 
@@ -11,46 +13,100 @@ CuRenderDevice device;
 
 CuRenderer *CuRenderer::singleton = nullptr;
 
-CuRenderer::CuRenderer() { singleton = this; }
+CuRenderer::CuRenderer() : render_graph(std::make_unique<RenderGraph>()) {
+  singleton = this;
+}
 
 CuRenderer::~CuRenderer() { singleton = nullptr; }
 
 CuRenderer *CuRenderer::get_singleton() { return singleton; }
 
-bool CuRenderer::init(CuWindow *p_window) {
-  if (!device.init(p_window)) {
+bool CuRenderer::init(CuWindow *p_window,
+                      const RenderDeviceOptions &p_options) {
+  if (!device.init(p_window, p_options)) {
     ENGINE_INFO("Renderer ready");
     return false;
   }
+  // passes create their targets at this size
+  width = device.get_swapchain_size().width;
+  height = device.get_swapchain_size().height;
   return true;
 }
 
+int CuRenderer::get_frame_count() const { return device.get_frame_count(); }
+
+void CuRenderer::set_vsync(bool p_vsync) {
+  device.set_present_mode(p_vsync ? VK_PRESENT_MODE_FIFO_KHR
+                                  : VK_PRESENT_MODE_MAILBOX_KHR);
+}
+
+void CuRenderer::report_latency() const {
+  const FrameLatency &latency = device.get_latency();
+  ENGINE_INFO("{} frames in flight: input to present {:.2f} ms, input to "
+              "GPU completion {:.2f} ms",
+              device.get_frame_overlap(),
+              latency.input_to_present_milliseconds,
+              latency.input_to_completion_milliseconds);
+}
+
 void CuRenderer::create_material(const std::vector<std::string> &p_shaders) {}
 
 void CuRenderer::add_render_pass(
     std::unique_ptr<RenderPassBase> p_render_pass) {
   render_passes.push_back(std::move(p_render_pass));
   render_passes.back()->init();
+  render_passes.back()->setup_graph(*render_graph);
 };
 
 void CuRenderer::draw() {
-  device.begin_recording();
+  CU_PROFILE_SCOPE("CuRenderer::draw");
+  if (!device.begin_recording()) {
+    return;
+  }
+  const VkExtent2D extent = device.get_swapchain_size();
+  if (extent.width != width || extent.height != height) {
+    for (int i = 0; i < render_passes.size(); ++i) {
+      render_passes[i]->on_resize(extent.width, extent.height);
+    }
+    render_graph->on_resize(extent.width, extent.height);
+    width = extent.width;
+    height = extent.height;
+  }
   CameraManager *camera_manager = CameraManager::get_singleton();
   if (camera_manager) {
     camera_manager->update_active_camera();
   }
 
   for (int i = 0; i < render_passes.size(); ++i) {
+    CU_PROFILE_SCOPE_NAMED(render_passes[i]->get_name());
+    const uint32_t zone =
+        device.begin_gpu_zone(render_passes[i]->get_name());
     render_passes[i]->update();
+    device.end_gpu_zone(zone);
+  }
+  render_graph->execute();
+  {
+    CU_PROFILE_SCOPE("Submit and present");
+    device.finish_recording();
+  }
+  if (benchmark) {
+    frame_stats.tick();
+    if (frame_stats.report_interval()) {
+      report_latency();
+    }
   }
-  device.finish_recording();
 }
 
 void CuRenderer::clear() {
+  if (benchmark) {
+    frame_stats.report();
+    report_latency();
+  }
   device.stop_rendering();
   for (int i = 0; i < render_passes.size(); ++i) {
     render_passes[i]->clear();
   }
+  render_graph->clear();
   CameraManager *camera_manager = CameraManager::get_singleton();
   CuItemManager *item_manager = CuItemManager::get_singleton();
   if (camera_manager) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "frame_stats.h"
 #include "shader_compiler.h"
 #include <memory>
 #include <string>
@@ -9,17 +10,31 @@ class CuWindow;
 
 class RenderPassBase;
 
+class RenderGraph;
+
 class CuGlobalGpuDataManager;
 
+struct RenderDeviceOptions;
+
 class CuRenderer {
 public:
   CuRenderer();
   ~CuRenderer();
-  bool init(CuWindow *p_window);
+  bool init(CuWindow *p_window, const RenderDeviceOptions &p_options);
   void create_material(const std::vector<std::string> &p_shaders);
   void add_render_pass(std::unique_ptr<RenderPassBase> p_render_pass);
   void draw();
   void clear();
+  int get_frame_count() const;
+  /**
+   without vsync frames are presented with MAILBOX, or IMMEDIATE where the
+   surface lacks it. Takes effect on the next frame.
+   */
+  void set_vsync(bool p_vsync);
+  /**
+   measures the time between frames and logs frame rates, see CuFrameStats.
+   */
+  void enable_benchmark() { benchmark = true; }
 
   static CuRenderer *get_singleton();
 
@@ -27,6 +42,14 @@ private:
   CuWindow *window = nullptr;
   ShaderCompiler shader_compiler;
   std::vector<std::shared_ptr<RenderPassBase>> render_passes;
+  // records what the passes declared in setup_graph()
+  std::unique_ptr<RenderGraph> render_graph;
+  // size the passes' targets have
+  uint32_t width = 0;
+  uint32_t height = 0;
+  bool benchmark = false;
+  CuFrameStats frame_stats;
+  void report_latency() const;
 
   static CuRenderer *singleton;
 };
\ No newline at end of file
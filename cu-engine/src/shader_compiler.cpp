@@ -81,8 +81,7 @@ bool get_shader_stage(const std::string &p_file_extension,
   } else if (stage == "frag") {
     p_out_stage = FRAGMENT;
   } else if (stage == "comp") {
-    // p_out_stage = EShLangCompute;
-    return false;
+    p_out_stage = COMPUTE;
   } else {
     return false;
   }
@@ -218,5 +217,8 @@ bool ShaderCompiler::compile_shader(const std::string &p_filepath,
     ENGINE_ERROR("Failed to compile: {}", p_filepath);
     return false;
   }
+  if (out_info) {
+    out_info->path = p_filepath;
+  }
   return true;
 }
\ No newline at end of file
@@ -6,11 +6,14 @@
 enum ShaderStage {
   VERTEX,
   FRAGMENT,
+  COMPUTE,
 };
 
 struct CompiledShaderInfo {
   std::vector<uint32_t> buffer;
   ShaderStage stage;
+  // source file, empty for SPIR-V that didn't come from compile_shader()
+  std::string path;
 };
 
 class ShaderCompiler {
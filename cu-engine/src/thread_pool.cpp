@@ -0,0 +1,83 @@
+#include "thread_pool.h"
+#include "logger.h"
+#include <algorithm>
+
+CuThreadPool *CuThreadPool::singleton = nullptr;
+thread_local uint32_t thread_index = 0;
+
+CuThreadPool::CuThreadPool(unsigned int p_worker_count /*= 0*/) {
+  singleton = this;
+  unsigned int worker_count = p_worker_count;
+  if (worker_count == 0) {
+    // leave one core to the main thread
+    const unsigned int cores = std::thread::hardware_concurrency();
+    worker_count = cores > 1 ? cores - 1 : 1;
+  }
+  for (unsigned int i = 0; i < worker_count; ++i) {
+    workers.emplace_back(&CuThreadPool::worker_loop, this, i + 1);
+  }
+  ENGINE_INFO("Thread pool ready with {} workers", worker_count);
+}
+
+CuThreadPool::~CuThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  for (std::thread &worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  singleton = nullptr;
+}
+
+CuThreadPool *CuThreadPool::get_singleton() { return singleton; }
+
+uint32_t CuThreadPool::get_thread_index() { return thread_index; }
+
+void CuThreadPool::parallel_for(
+    size_t p_count, const std::function<void(size_t, size_t)> &p_function) {
+  if (p_count == 0) {
+    return;
+  }
+  const size_t range_count = std::min(p_count, workers.size() + 1);
+  const size_t range_size = (p_count + range_count - 1) / range_count;
+
+  std::vector<std::future<void>> ranges = {};
+  for (size_t begin = range_size; begin < p_count; begin += range_size) {
+    const size_t end = std::min(begin + range_size, p_count);
+    ranges.push_back(
+        submit([&p_function, begin, end]() { p_function(begin, end); }));
+  }
+  p_function(0, std::min(range_size, p_count));
+  for (std::future<void> &range : ranges) {
+    range.get();
+  }
+}
+
+void CuThreadPool::push_job(std::function<void()> &&p_job) {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    jobs.push_back(std::move(p_job));
+  }
+  condition.notify_one();
+}
+
+void CuThreadPool::worker_loop(uint32_t p_thread_index) {
+  thread_index = p_thread_index;
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (stopping && jobs.empty()) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+Fixed set of worker threads that run queued jobs. Jobs shouldn't block on
+other jobs of the same pool, there are only as many workers as cores.
+ */
+class CuThreadPool {
+public:
+  CuThreadPool(unsigned int p_worker_count = 0);
+  ~CuThreadPool();
+
+  /**
+   queues p_function on a worker and returns a future for its result.
+   */
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(F &&p_function) {
+    using Result = std::invoke_result_t<F>;
+    std::shared_ptr<std::packaged_task<Result()>> task =
+        std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(p_function));
+    std::future<Result> result = task->get_future();
+    push_job([task]() { (*task)(); });
+    return result;
+  }
+
+  /**
+   splits [0, p_count) into one range per worker and blocks until all of
+   them are processed. The calling thread works on the first range.
+   */
+  void parallel_for(size_t p_count,
+                    const std::function<void(size_t, size_t)> &p_function);
+
+  size_t get_worker_count() const { return workers.size(); }
+  /**
+   0 on threads outside the pool, 1 to get_worker_count() on the workers.
+   Use it to pick per-thread resources.
+   */
+  static uint32_t get_thread_index();
+
+  static CuThreadPool *get_singleton();
+
+private:
+  void push_job(std::function<void()> &&p_job);
+  void worker_loop(uint32_t p_thread_index);
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+
+  static CuThreadPool *singleton;
+};
@@ -29,7 +29,20 @@ bool CuWindow::init(const std::string p_title, int p_width, int p_height) {
   return true;
 }
 
-void CuWindow::poll_events() { glfwPollEvents(); }
+void CuWindow::poll_events() {
+  // headless engines never create the window
+  if (raw_window) {
+    glfwPollEvents();
+  }
+  input_time = std::chrono::steady_clock::now();
+}
+
+void CuWindow::wait_events() {
+  if (raw_window) {
+    glfwWaitEvents();
+  }
+  input_time = std::chrono::steady_clock::now();
+}
 
 void CuWindow::clear() {
   glfwDestroyWindow(raw_window);
@@ -37,5 +50,5 @@ void CuWindow::clear() {
 }
 
 bool CuWindow::should_close() const {
-  return glfwWindowShouldClose(raw_window);
+  return !raw_window || glfwWindowShouldClose(raw_window);
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 
 class GLFWwindow;
@@ -8,12 +9,25 @@ class CuWindow {
 public:
   bool init(const std::string p_title, int p_width, int p_height);
   void poll_events();
+  /**
+   sleeps until the next event arrives.
+   */
+  void wait_events();
   void clear();
 
   bool should_close() const;
+  /**
+   when events were polled last, frames rendered after it react to them.
+   */
+  std::chrono::steady_clock::time_point get_input_time() const {
+    return input_time;
+  }
 
   GLFWwindow *raw_window = nullptr;
   int width;
   int height;
   bool resize = false;
+
+private:
+  std::chrono::steady_clock::time_point input_time = {};
 };
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include <camera.h>
 #include <chrono>
 #include <cu-engine.h>
+#include <cstdlib>
 #include <item.h>
+#include <mesh_importer.h>
 #include <physics-server.h>
 #include <renderer.h>
 
@@ -56,6 +58,18 @@ int main() {
     floor->set_position(glm::vec3(0, 0, -5.0));
   }
 
+  // CU_MESH=<file.obj> draws the spinning cubes with an imported mesh
+  const char *mesh_path = std::getenv("CU_MESH");
+  if (mesh_path) {
+    const uint32_t mesh =
+        import_mesh(mesh_path, item_manager.get_mesh_registry());
+    if (mesh != CuMeshRegistry::INVALID_MESH) {
+      cube->set_mesh(mesh);
+      cube1->set_mesh(mesh);
+      cube2->set_mesh(mesh);
+    }
+  }
+
   cube->set_position(glm::vec3(-8.0, -8.0, 7.0));
   cube1->set_position(glm::vec3(3.0, 0.0, 0.0));
   cube2->set_position(glm::vec3(-3.0, 0.0, 0.0));